@@ -19,11 +19,17 @@ Buffer Buffer::readFile(const std::string& path)
     return buf;
 }
 
-void Buffer::writeFile(const std::string& path)
+bool Buffer::writeFile(const std::string& path) const
 {
     FILE* f = fopen(path.c_str(), "w");
-    if (fwrite(mData, mSize, 1, f) != 1) {
+    if (!f) {
+        printf("failed to open file '%s'\n", path.c_str());
+        return false;
+    }
+    const bool ok = fwrite(mData, mSize, 1, f) == 1;
+    if (!ok) {
         printf("failed to write file '%s'\n", path.c_str());
     }
     fclose(f);
+    return ok;
 }
@@ -29,7 +29,7 @@ public:
     bool empty() const { return !mSize; }
 
     static Buffer readFile(const std::string& path);
-    void writeFile(const std::string& path);
+    bool writeFile(const std::string& path) const;
 
 private:
     uint8_t* mData;
@@ -1,11 +1,14 @@
 #include "Fetch.h"
+#ifndef FETCH_FILE_ONLY
 #include <httplib.h>
 #include <LUrlParser.h>
+#endif
 
 Buffer Fetch::fetch(const std::string& uri)
 {
     const auto css = uri.find("://");
     if (css != std::string::npos) {
+#ifndef FETCH_FILE_ONLY
         // http/https?
         const auto url = LUrlParser::ParseURL::parseURL(uri);
         if (!url.isValid())
@@ -33,6 +36,7 @@ Buffer Fetch::fetch(const std::string& uri)
                 return buf;
             }
         }
+#endif
     } else {
         // plain file?
         return Buffer::readFile(uri);
@@ -0,0 +1,110 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <assert.h>
+
+static thread_local uint32_t sThreadIndex = 0;
+
+JobSystem::JobSystem(uint32_t workers)
+{
+    if (workers == 0) {
+        workers = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+    }
+    for (uint32_t i = 0; i < workers; ++i) {
+        mThreads.emplace_back(&JobSystem::work, this, i + 1);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+    }
+    mStart.notify_all();
+    for (auto& thread : mThreads) {
+        thread.join();
+    }
+}
+
+uint32_t JobSystem::threadIndex()
+{
+    return sThreadIndex;
+}
+
+void JobSystem::work(uint32_t index)
+{
+    sThreadIndex = index;
+    uint64_t generation = 0;
+    for (;;) {
+        const std::function<void(size_t)>* job;
+        size_t count;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mStart.wait(lock, [this, generation]() { return mStopped || mGeneration != generation; });
+            if (mStopped)
+                return;
+            generation = mGeneration;
+            // woke up after the run was over
+            if (!mJob)
+                continue;
+            // run() doesn't return or set up the next job while this is taking indices
+            job = mJob;
+            count = mCount;
+            ++mActive;
+        }
+        const size_t finished = take(*job, count);
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        --mActive;
+        mRemaining -= finished;
+        if (mRemaining == 0 && mActive == 0) {
+            mDone.notify_all();
+        }
+    }
+}
+
+size_t JobSystem::take(const std::function<void(size_t)>& job, size_t count)
+{
+    size_t finished = 0;
+    for (;;) {
+        const size_t index = mNext.fetch_add(1);
+        if (index >= count)
+            break;
+        job(index);
+        ++finished;
+    }
+    return finished;
+}
+
+void JobSystem::run(size_t count, const std::function<void(size_t index)>& job)
+{
+    assert(sThreadIndex == 0);
+    if (count == 0)
+        return;
+    if (count == 1 || mThreads.empty()) {
+        for (size_t i = 0; i < count; ++i) {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        assert(mRemaining == 0 && mActive == 0);
+        mJob = &job;
+        mCount = count;
+        mNext = 0;
+        mRemaining = count;
+        ++mGeneration;
+    }
+    mStart.notify_all();
+
+    const size_t finished = take(job, count);
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mRemaining -= finished;
+    // every index is done and no worker is still looking at mNext
+    mDone.wait(lock, [this]() { return mRemaining == 0 && mActive == 0; });
+    mJob = nullptr;
+    mCount = 0;
+}
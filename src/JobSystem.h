@@ -0,0 +1,59 @@
+#ifndef JOBSYSTEM_H
+#define JOBSYSTEM_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+// A fixed set of worker threads for data parallel work. run() hands the
+// indices of a job out to the workers and the calling thread, one at a time
+// in order, and returns once all of them are done so jobs can use whatever
+// the caller has on its stack. Only one run() at a time, and not from
+// within a job.
+//
+// threadIndex() tells jobs which thread they're on, for per thread
+// resources such as command pools: 0 on the thread that calls run() and
+// 1 to threadCount() - 1 on the workers.
+class JobSystem
+{
+public:
+    // workers in addition to the calling thread, hardware_concurrency - 1 when 0
+    explicit JobSystem(uint32_t workers = 0);
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    uint32_t threadCount() const { return static_cast<uint32_t>(mThreads.size()) + 1; }
+    static uint32_t threadIndex();
+
+    void run(size_t count, const std::function<void(size_t index)>& job);
+
+private:
+    void work(uint32_t index);
+    // takes indices of job until there are none left, returns how many it ran
+    size_t take(const std::function<void(size_t)>& job, size_t count);
+
+private:
+    std::vector<std::thread> mThreads;
+    std::mutex mMutex;
+    std::condition_variable mStart, mDone;
+    // bumped for every run(), workers wait for it to change
+    uint64_t mGeneration { 0 };
+    bool mStopped { false };
+
+    const std::function<void(size_t)>* mJob { nullptr };
+    size_t mCount { 0 };
+    std::atomic<size_t> mNext { 0 };
+    // indices that haven't finished yet
+    size_t mRemaining { 0 };
+    // workers taking indices of the current job
+    uint32_t mActive { 0 };
+};
+
+#endif // JOBSYSTEM_H
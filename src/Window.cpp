@@ -2,6 +2,8 @@
 #include <unordered_set>
 #include <optional>
 #include <array>
+#include <algorithm>
+#include <string.h>
 
 #ifdef NDEBUG
 static const bool enableValidationLayers = false;
@@ -9,8 +11,6 @@ static const bool enableValidationLayers = false;
 static bool enableValidationLayers = true;
 #endif
 
-const int MAX_FRAMES_IN_FLIGHT = 2;
-
 static const std::vector<const char*> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
 };
@@ -68,6 +68,8 @@ static bool checkValidationLayerSupport()
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    // only if there's one that does nothing but transfers
+    std::optional<uint32_t> transferFamily;
 
     bool isComplete() const {
         return graphicsFamily.has_value() && presentFamily.has_value();
@@ -97,6 +99,17 @@ static QueueFamilyIndices findQueueFamilies(vk::PhysicalDevice device, const vk:
         i++;
     }
 
+    // usually the copy engine of a discrete gpu, uploads there run alongside rendering
+    i = 0;
+    for (const auto& queueFamily : queueFamilies) {
+        const vk::QueueFlags other = vk::QueueFlagBits::eGraphics | vk::QueueFlagBits::eCompute;
+        if ((queueFamily.queueFlags & vk::QueueFlagBits::eTransfer) && !(queueFamily.queueFlags & other)) {
+            indices.transferFamily = i;
+            break;
+        }
+        i++;
+    }
+
     return indices;
 }
 
@@ -113,6 +126,27 @@ static bool checkDeviceExtensionSupport(vk::PhysicalDevice device)
     return requiredExtensions.empty();
 }
 
+// what Render's texture table needs, see render/TextureTable.h. vulkan 1.1 for
+// getFeatures2, the extension is core in 1.2 but still advertised
+static bool checkDescriptorIndexingSupport(vk::PhysicalDevice device, uint32_t apiVersion)
+{
+    if (apiVersion < VK_API_VERSION_1_1)
+        return false;
+
+    const auto availableExtensions = device.enumerateDeviceExtensionProperties();
+    const bool extensionSupported = std::any_of(availableExtensions.begin(), availableExtensions.end(), [](const vk::ExtensionProperties& extension) {
+        return !strcmp(extension.extensionName, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+    });
+    if (!extensionSupported)
+        return false;
+
+    const auto features = device.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+    const auto& indexing = features.get<vk::PhysicalDeviceDescriptorIndexingFeaturesEXT>();
+    return indexing.shaderSampledImageArrayNonUniformIndexing && indexing.runtimeDescriptorArray
+        && indexing.descriptorBindingPartiallyBound && indexing.descriptorBindingSampledImageUpdateAfterBind
+        && indexing.descriptorBindingUpdateUnusedWhilePending;
+}
+
 struct SwapChainSupportDetails {
     vk::SurfaceCapabilitiesKHR capabilities;
     std::vector<vk::SurfaceFormatKHR> formats;
@@ -207,6 +241,11 @@ Window::Window(uint32_t width, uint32_t height)
     mWindow.reset(window, [](GLFWwindow* w) {
         glfwDestroyWindow(w);
     });
+    // clipped swapchain images lose what was under other windows
+    glfwSetWindowUserPointer(window, this);
+    glfwSetWindowRefreshCallback(window, [](GLFWwindow* w) {
+        static_cast<Window*>(glfwGetWindowUserPointer(w))->mExposed = true;
+    });
 
 #ifndef NDEBUG
     if (enableValidationLayers && !checkValidationLayerSupport()) {
@@ -238,7 +277,16 @@ Window::Window(uint32_t width, uint32_t height)
         layerNames = validationLayers.data();
     }
 
-    vk::ApplicationInfo applicationInfo("Scenery", 1, "No Engine", 1, VK_API_VERSION_1_0);
+    // 1.1 where the loader has it, for descriptor indexing. 1.0 implementations may refuse an
+    // instance that asks for more, and vkEnumerateInstanceVersion is only there from 1.1
+    uint32_t instanceVersion = VK_API_VERSION_1_0;
+    const auto enumerateInstanceVersion =
+        reinterpret_cast<PFN_vkEnumerateInstanceVersion>(vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion"));
+    if (!enumerateInstanceVersion || enumerateInstanceVersion(&instanceVersion) != VK_SUCCESS) {
+        instanceVersion = VK_API_VERSION_1_0;
+    }
+    mApiVersion = instanceVersion >= VK_API_VERSION_1_1 ? VK_API_VERSION_1_1 : VK_API_VERSION_1_0;
+    vk::ApplicationInfo applicationInfo("Scenery", 1, "No Engine", 1, mApiVersion);
     vk::InstanceCreateInfo instanceCreateInfo({} /* flags */, &applicationInfo,
                                               layerCount, layerNames,
                                               instanceExtensions.size(), instanceExtensions.data());
@@ -295,14 +343,18 @@ Window::Window(uint32_t width, uint32_t height)
         printf("failed to find suitable physical device\n");
         return;
     }
+    if (mPhysicalDevice.getProperties().apiVersion < VK_API_VERSION_1_1) {
+        mApiVersion = VK_API_VERSION_1_0;
+    }
 
     QueueFamilyIndices indices = findQueueFamilies(mPhysicalDevice, mSurface);
 
     mPresentFamily = indices.presentFamily.value();
     mGraphicsFamily = indices.graphicsFamily.value();
+    mTransferFamily = indices.transferFamily.value_or(mGraphicsFamily);
 
     std::vector<vk::DeviceQueueCreateInfo> queueCreateInfos;
-    std::unordered_set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+    std::unordered_set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value(), mTransferFamily};
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -319,10 +371,27 @@ Window::Window(uint32_t width, uint32_t height)
 
     vk::PhysicalDeviceFeatures deviceFeatures;
     deviceFeatures.samplerAnisotropy = VK_TRUE;
+
+    std::vector<const char*> enabledExtensions = deviceExtensions;
+    vk::PhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures;
+    mDescriptorIndexing = checkDescriptorIndexingSupport(mPhysicalDevice, mApiVersion);
+    if (mDescriptorIndexing) {
+        enabledExtensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+        indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+        indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+    }
+    printf("descriptor indexing %s\n", mDescriptorIndexing ? "supported" : "not supported, images are drawn one by one");
+
     vk::DeviceCreateInfo createDeviceInfo({}, queueCreateInfos.size(), queueCreateInfos.data(),
                                           deviceLayerCount, deviceLayerNames,
-                                          deviceExtensions.size(), deviceExtensions.data(),
+                                          enabledExtensions.size(), enabledExtensions.data(),
                                           &deviceFeatures);
+    if (mDescriptorIndexing) {
+        createDeviceInfo.setPNext(&indexingFeatures);
+    }
 
     mDevice = mPhysicalDevice.createDeviceUnique(createDeviceInfo);
     if (!mDevice) {
@@ -332,10 +401,12 @@ Window::Window(uint32_t width, uint32_t height)
 
     mPresentQueue = mDevice->getQueue(indices.presentFamily.value(), 0);
     mGraphicsQueue = mDevice->getQueue(indices.graphicsFamily.value(), 0);
-    if (!mPresentQueue || !mGraphicsQueue) {
+    mTransferQueue = mDevice->getQueue(mTransferFamily, 0);
+    if (!mPresentQueue || !mGraphicsQueue || !mTransferQueue) {
         printf("unable to get device queues\n");
         return;
     }
+    printf("%s\n", indices.transferFamily ? "dedicated transfer queue" : "no dedicated transfer queue, uploading on the graphics queue");
 
     SwapChainSupportDetails swapChainSupport = querySwapChainSupport(mPhysicalDevice, mSurface);
     vk::SurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -408,6 +479,15 @@ Window::Window(uint32_t width, uint32_t height)
         return;
     }
 
+    // the image has been presented before, what's outside of the render area stays. the load op only
+    // touches the render area, that's cleared like in full frames so both draw the same
+    colorAttachment.initialLayout = vk::ImageLayout::ePresentSrcKHR;
+    mLoadRenderPass = mDevice->createRenderPassUnique(renderPassInfo);
+    if (!mLoadRenderPass) {
+        printf("failed to create load render pass!\n");
+        return;
+    }
+
     mSwapChainFramebuffers.resize(mSwapChainImageViews.size());
     for (size_t i = 0; i < mSwapChainImageViews.size(); i++) {
         vk::ImageView attachments[] = {
@@ -436,15 +516,15 @@ void Window::exec()
     std::vector<vk::Semaphore> renderFinishedSemaphores;
     std::vector<vk::Fence> inFlightFences;
     std::vector<vk::Fence> imagesInFlight;
-    imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
-    inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    imageAvailableSemaphores.resize(MaxFramesInFlight);
+    renderFinishedSemaphores.resize(MaxFramesInFlight);
+    inFlightFences.resize(MaxFramesInFlight);
     imagesInFlight.resize(mSwapChainImages.size());
 
     vk::SemaphoreCreateInfo semaphoreInfo;
     vk::FenceCreateInfo fenceInfo(vk::FenceCreateFlagBits::eSignaled);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+    for (size_t i = 0; i < MaxFramesInFlight; i++) {
         imageAvailableSemaphores[i] = mDevice->createSemaphore(semaphoreInfo);
         renderFinishedSemaphores[i] = mDevice->createSemaphore(semaphoreInfo);
         inFlightFences[i] = mDevice->createFence(fenceInfo);
@@ -476,17 +556,29 @@ void Window::exec()
             imageAvailableSemaphores[currentFrame],
             renderFinishedSemaphores[currentFrame],
             inFlightFences[currentFrame],
+            mExposed
         };
+        mExposed = false;
         mRender(renderData);
 
         vk::PresentInfoKHR presentInfo(1, &renderFinishedSemaphores[currentFrame], 1, &*mSwapChain, &imageIndex);
         mPresentQueue.presentKHR(presentInfo);
 
-        currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+        currentFrame = (currentFrame + 1) % MaxFramesInFlight;
     };
 
     while(!glfwWindowShouldClose(mWindow.get())) {
         glfwPollEvents();
+        const bool changed = !mUpdate || mUpdate();
+        if (!changed && !mExposed) {
+            // nothing to draw, sleep until something happens
+            if (mIdleTimeout > 0.) {
+                glfwWaitEventsTimeout(mIdleTimeout);
+            } else {
+                glfwWaitEvents();
+            }
+            continue;
+        }
         drawFrame();
     }
 }
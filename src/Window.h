@@ -25,16 +25,30 @@ public:
     const vk::UniqueSurfaceKHR& surface() const { return mSurface; }
     const vk::Queue& presentQueue() const { return mPresentQueue; }
     const vk::Queue& graphicsQueue() const { return mGraphicsQueue; }
+    // the graphics queue unless the device has a queue family just for transfers
+    const vk::Queue& transferQueue() const { return mTransferQueue; }
     const vk::Extent2D& extent() const { return mExtent; }
     const vk::UniqueSwapchainKHR& swapChain() const { return mSwapChain; }
     const std::vector<vk::Image>& swapChainImages() const { return mSwapChainImages; }
     const std::vector<vk::ImageView>& swapChainImageViews() const { return mSwapChainImageViews; }
     const std::vector<vk::Framebuffer>& swapChainFramebuffers() const { return mSwapChainFramebuffers; }
     const vk::UniqueRenderPass& renderPass() const { return mRenderPass; }
+    // compatible with renderPass() but keeps what the image had outside of the render area, which
+    // is cleared, for drawing part of an image that's been drawn before
+    const vk::UniqueRenderPass& loadRenderPass() const { return mLoadRenderPass; }
     uint32_t presentFamily() const { return mPresentFamily; }
     uint32_t graphicsFamily() const { return mGraphicsFamily; }
+    uint32_t transferFamily() const { return mTransferFamily; }
+    // what both the instance and the device were made for, VK_API_VERSION_1_0 or 1_1
+    uint32_t apiVersion() const { return mApiVersion; }
+    // the device was made with what Render needs for its texture table
+    bool descriptorIndexing() const { return mDescriptorIndexing; }
     const std::shared_ptr<GLFWwindow>& window() const { return mWindow; }
 
+    // frames that can be recorded before the first of them has finished on
+    // the gpu, RenderData::currentFrame goes round these
+    static constexpr uint32_t MaxFramesInFlight = 2;
+
     struct RenderData
     {
         const Window* window;
@@ -43,11 +57,23 @@ public:
         vk::Semaphore wait;
         vk::Semaphore signal;
         vk::Fence fence;
+        // the window system may have lost what was on screen, every image needs to be drawn in full
+        bool exposed;
     };
     void registerRender(std::function<void(const RenderData&)>&& render)
     {
         mRender = std::move(render);
     }
+    // called before every frame, returns whether there's anything to draw. when there isn't
+    // exec() waits for events instead of drawing, see setIdleTimeout()
+    void registerUpdate(std::function<bool()>&& update)
+    {
+        mUpdate = std::move(update);
+    }
+    // how long exec() waits for events when there's nothing to draw, in seconds. 0 waits until
+    // there are some, for updates that don't come with an event (animations, polled files)
+    // set this or wake the loop with glfwPostEmptyEvent()
+    void setIdleTimeout(double seconds) { mIdleTimeout = seconds; }
 
 private:
     uint32_t mWidth, mHeight;
@@ -57,17 +83,23 @@ private:
     vk::PhysicalDevice mPhysicalDevice;
     vk::UniqueDevice mDevice;
     vk::UniqueSurfaceKHR mSurface;
-    vk::Queue mPresentQueue, mGraphicsQueue;
+    vk::Queue mPresentQueue, mGraphicsQueue, mTransferQueue;
     vk::Extent2D mExtent;
     vk::UniqueSwapchainKHR mSwapChain;
     std::vector<vk::Image> mSwapChainImages;
     std::vector<vk::ImageView> mSwapChainImageViews;
-    vk::UniqueRenderPass mRenderPass;
+    vk::UniqueRenderPass mRenderPass, mLoadRenderPass;
     std::vector<vk::Framebuffer> mSwapChainFramebuffers;
-    uint32_t mPresentFamily, mGraphicsFamily;
+    uint32_t mPresentFamily, mGraphicsFamily, mTransferFamily;
+    uint32_t mApiVersion { VK_API_VERSION_1_0 };
+    bool mDescriptorIndexing { false };
     std::shared_ptr<GLFWwindow> mWindow;
 
     std::function<void(const RenderData&)> mRender;
+    std::function<bool()> mUpdate;
+    double mIdleTimeout { 0. };
+    // set by the refresh callback until the images have been drawn again
+    bool mExposed { true };
 };
 
 #endif
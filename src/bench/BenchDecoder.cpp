@@ -0,0 +1,472 @@
+#include <Decoder.h>
+#include <Buffer.h>
+#include <webp/encode.h>
+#include <png.h>
+#include <turbojpeg.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <new>
+
+// decode benchmark, builds Decoder/Buffer/Fetch without any of the vulkan bits.
+// generates a corpus of png/jpeg/webp files in a temporary directory and times
+// Decoder::decode over each of them, reporting megapixels per second, heap
+// allocations per decode and peak rss.
+
+struct AllocStats
+{
+    size_t count { 0 };
+    size_t bytes { 0 };
+};
+static AllocStats allocStats;
+
+#if defined(__GLIBC__)
+// interpose malloc so that allocations done by libpng/libjpeg/libwebp are counted as well
+extern "C" {
+void* __libc_malloc(size_t size);
+void* __libc_calloc(size_t num, size_t size);
+void* __libc_realloc(void* ptr, size_t size);
+void* __libc_memalign(size_t alignment, size_t size);
+void __libc_free(void* ptr);
+
+void* malloc(size_t size)
+{
+    ++allocStats.count;
+    allocStats.bytes += size;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t num, size_t size)
+{
+    ++allocStats.count;
+    allocStats.bytes += num * size;
+    return __libc_calloc(num, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    ++allocStats.count;
+    allocStats.bytes += size;
+    return __libc_realloc(ptr, size);
+}
+
+void* memalign(size_t alignment, size_t size)
+{
+    ++allocStats.count;
+    allocStats.bytes += size;
+    return __libc_memalign(alignment, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size)
+{
+    return memalign(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size)
+{
+    void* p = memalign(alignment, size);
+    if (!p)
+        return ENOMEM;
+    *ptr = p;
+    return 0;
+}
+
+void free(void* ptr)
+{
+    __libc_free(ptr);
+}
+}
+#else
+// only c++ allocations can be counted on this platform
+void* operator new(size_t size)
+{
+    ++allocStats.count;
+    allocStats.bytes += size;
+    if (void* p = malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    free(ptr);
+}
+#endif
+
+enum CorpusFormat { CorpusPNG, CorpusJPEG, CorpusWEBP };
+
+struct CorpusEntry
+{
+    std::string name;
+    std::string path;
+    CorpusFormat format;
+    uint32_t width, height;
+    size_t fileSize;
+};
+
+static const char* formatName(CorpusFormat format)
+{
+    switch (format) {
+    case CorpusPNG:
+        return "png";
+    case CorpusJPEG:
+        return "jpeg";
+    case CorpusWEBP:
+        return "webp";
+    }
+    return "<invalid format>";
+}
+
+// reasonably compressible content, smooth gradients with some noise on top
+static std::vector<uint8_t> makePixels(uint32_t width, uint32_t height, uint32_t channels, uint32_t bytesPerChannel)
+{
+    std::vector<uint8_t> pixels(width * height * channels * bytesPerChannel);
+    uint32_t seed = 0x12345678;
+    size_t idx = 0;
+    for (uint32_t y = 0; y < height; ++y) {
+        for (uint32_t x = 0; x < width; ++x) {
+            seed = seed * 1664525 + 1013904223;
+            const uint32_t noise = (seed >> 24) & 0x1f;
+            for (uint32_t c = 0; c < channels; ++c) {
+                uint32_t v;
+                switch (c) {
+                case 0: v = (x * 0xffff) / width; break;
+                case 1: v = (y * 0xffff) / height; break;
+                case 2: v = ((x + y) * 0xffff) / (width + height); break;
+                default: v = 0xffff - ((x * 0x7fff) / width); break;
+                }
+                v = (v + (noise << 8)) & 0xffff;
+                if (bytesPerChannel == 2) {
+                    // png wants big endian samples
+                    pixels[idx++] = v >> 8;
+                    pixels[idx++] = v & 0xff;
+                } else {
+                    pixels[idx++] = v >> 8;
+                }
+            }
+        }
+    }
+    return pixels;
+}
+
+static Buffer encodePNG(uint32_t width, uint32_t height, int colorType, int bitDepth)
+{
+    auto png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (!png_ptr)
+        return Buffer();
+    auto info_ptr = png_create_info_struct(png_ptr);
+    if (!info_ptr) {
+        png_destroy_write_struct(&png_ptr, nullptr);
+        return Buffer();
+    }
+
+    Buffer out;
+    if (setjmp(png_jmpbuf(png_ptr))) {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        return Buffer();
+    }
+
+    png_set_write_fn(png_ptr, &out, [](png_structp png_ptr, png_bytep data, png_size_t length) -> void {
+        Buffer* out = static_cast<Buffer*>(png_get_io_ptr(png_ptr));
+        out->append(data, length);
+    }, nullptr);
+
+    uint32_t channels = 0;
+    switch (colorType) {
+    case PNG_COLOR_TYPE_GRAY:
+    case PNG_COLOR_TYPE_PALETTE:
+        channels = 1;
+        break;
+    case PNG_COLOR_TYPE_GRAY_ALPHA:
+        channels = 2;
+        break;
+    case PNG_COLOR_TYPE_RGB:
+        channels = 3;
+        break;
+    case PNG_COLOR_TYPE_RGB_ALPHA:
+        channels = 4;
+        break;
+    }
+
+    png_set_IHDR(png_ptr, info_ptr, width, height, bitDepth, colorType,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+
+    if (colorType == PNG_COLOR_TYPE_PALETTE) {
+        png_color palette[256];
+        for (int i = 0; i < 256; ++i) {
+            palette[i].red = i;
+            palette[i].green = 255 - i;
+            palette[i].blue = (i * 7) & 0xff;
+        }
+        png_set_PLTE(png_ptr, info_ptr, palette, 256);
+    }
+
+    png_write_info(png_ptr, info_ptr);
+
+    const uint32_t bytesPerChannel = bitDepth == 16 ? 2 : 1;
+    auto pixels = makePixels(width, height, channels, bytesPerChannel);
+    const size_t rowBytes = width * channels * bytesPerChannel;
+    for (uint32_t y = 0; y < height; ++y) {
+        png_write_row(png_ptr, pixels.data() + y * rowBytes);
+    }
+
+    png_write_end(png_ptr, nullptr);
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    return out;
+}
+
+static Buffer encodeJPEG(uint32_t width, uint32_t height, int quality)
+{
+    auto handle = tjInitCompress();
+    if (!handle)
+        return Buffer();
+
+    auto pixels = makePixels(width, height, 3, 1);
+    unsigned char* jpeg = nullptr;
+    unsigned long jpegSize = 0;
+    if (tjCompress2(handle, pixels.data(), width, 0, height, TJPF_RGB, &jpeg, &jpegSize, TJSAMP_420, quality, TJFLAG_FASTDCT) != 0) {
+        tjDestroy(handle);
+        return Buffer();
+    }
+
+    Buffer out(jpeg, jpegSize);
+    tjFree(jpeg);
+    tjDestroy(handle);
+    return out;
+}
+
+static Buffer encodeWEBP(uint32_t width, uint32_t height, bool alpha, bool lossless)
+{
+    const uint32_t channels = alpha ? 4 : 3;
+    auto pixels = makePixels(width, height, channels, 1);
+    uint8_t* webp = nullptr;
+    size_t webpSize = 0;
+    if (alpha) {
+        webpSize = lossless
+            ? WebPEncodeLosslessRGBA(pixels.data(), width, height, width * channels, &webp)
+            : WebPEncodeRGBA(pixels.data(), width, height, width * channels, 80.f, &webp);
+    } else {
+        webpSize = lossless
+            ? WebPEncodeLosslessRGB(pixels.data(), width, height, width * channels, &webp)
+            : WebPEncodeRGB(pixels.data(), width, height, width * channels, 80.f, &webp);
+    }
+    if (!webpSize)
+        return Buffer();
+
+    Buffer out(webp, webpSize);
+    WebPFree(webp);
+    return out;
+}
+
+static bool addEntry(std::vector<CorpusEntry>& corpus, const std::string& dir, const std::string& name,
+                     CorpusFormat format, uint32_t width, uint32_t height, Buffer&& data)
+{
+    if (data.empty()) {
+        printf("failed to encode %s\n", name.c_str());
+        return false;
+    }
+    const std::string path = dir + "/" + name + "." + formatName(format);
+    data.writeFile(path);
+    corpus.push_back({ name, path, format, width, height, data.size() });
+    return true;
+}
+
+static std::vector<CorpusEntry> makeCorpus(const std::string& dir, const std::vector<uint32_t>& sizes)
+{
+    std::vector<CorpusEntry> corpus;
+    for (uint32_t size : sizes) {
+        const std::string dim = std::to_string(size) + "x" + std::to_string(size);
+
+        addEntry(corpus, dir, "gray8-" + dim, CorpusPNG, size, size, encodePNG(size, size, PNG_COLOR_TYPE_GRAY, 8));
+        addEntry(corpus, dir, "palette8-" + dim, CorpusPNG, size, size, encodePNG(size, size, PNG_COLOR_TYPE_PALETTE, 8));
+        addEntry(corpus, dir, "rgb8-" + dim, CorpusPNG, size, size, encodePNG(size, size, PNG_COLOR_TYPE_RGB, 8));
+        addEntry(corpus, dir, "rgba8-" + dim, CorpusPNG, size, size, encodePNG(size, size, PNG_COLOR_TYPE_RGB_ALPHA, 8));
+        addEntry(corpus, dir, "rgba16-" + dim, CorpusPNG, size, size, encodePNG(size, size, PNG_COLOR_TYPE_RGB_ALPHA, 16));
+
+        addEntry(corpus, dir, "q75-" + dim, CorpusJPEG, size, size, encodeJPEG(size, size, 75));
+        addEntry(corpus, dir, "q95-" + dim, CorpusJPEG, size, size, encodeJPEG(size, size, 95));
+
+        addEntry(corpus, dir, "lossy-rgb-" + dim, CorpusWEBP, size, size, encodeWEBP(size, size, false, false));
+        addEntry(corpus, dir, "lossy-rgba-" + dim, CorpusWEBP, size, size, encodeWEBP(size, size, true, false));
+        addEntry(corpus, dir, "lossless-rgba-" + dim, CorpusWEBP, size, size, encodeWEBP(size, size, true, true));
+    }
+    return corpus;
+}
+
+// resets the high water mark so that peak rss can be reported per corpus entry
+static bool resetPeakRSS()
+{
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/clear_refs", "w");
+    if (!f)
+        return false;
+    const bool ok = fputs("5", f) >= 0;
+    fclose(f);
+    return ok;
+#else
+    return false;
+#endif
+}
+
+static size_t processPeakRSS()
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss;
+#else
+    return usage.ru_maxrss * 1024;
+#endif
+}
+
+static size_t peakRSS()
+{
+#if defined(__linux__)
+    FILE* f = fopen("/proc/self/status", "r");
+    if (f) {
+        char line[256];
+        size_t kb = 0;
+        while (fgets(line, sizeof(line), f)) {
+            if (sscanf(line, "VmHWM: %zu kB", &kb) == 1)
+                break;
+        }
+        fclose(f);
+        if (kb)
+            return kb * 1024;
+    }
+#endif
+    return processPeakRSS();
+}
+
+struct Result
+{
+    uint32_t iterations { 0 };
+    double seconds { 0. };
+    size_t allocs { 0 };
+    size_t allocBytes { 0 };
+    size_t peak { 0 };
+    bool ok { true };
+};
+
+static Result run(const CorpusEntry& entry, double minSeconds, uint32_t minIterations)
+{
+    Result result;
+    const bool perEntryPeak = resetPeakRSS();
+
+    const auto start = std::chrono::steady_clock::now();
+    const AllocStats before = allocStats;
+    for (;;) {
+        // new decoder for every iteration, the decoder caches by path
+        Decoder decoder(Decoder::Format_Auto);
+        auto img = decoder.decode(entry.path);
+        if (!img || img->width != entry.width || img->height != entry.height) {
+            result.ok = false;
+            break;
+        }
+        ++result.iterations;
+
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        if (result.iterations >= minIterations && elapsed.count() >= minSeconds)
+            break;
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    result.seconds = elapsed.count();
+    result.allocs = allocStats.count - before.count;
+    result.allocBytes = allocStats.bytes - before.bytes;
+    result.peak = perEntryPeak ? peakRSS() : 0;
+    return result;
+}
+
+static void usage(const char* argv0)
+{
+    printf("usage: %s [--time <seconds>] [--iterations <count>] [--sizes <n,n,...>] [--dir <corpus dir>]\n", argv0);
+}
+
+int main(int argc, char** argv)
+{
+    double minSeconds = 0.5;
+    uint32_t minIterations = 3;
+    std::vector<uint32_t> sizes = { 64, 256, 1024, 2048 };
+    std::string dir;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        if (arg == "--time" && i + 1 < argc) {
+            minSeconds = atof(argv[++i]);
+        } else if (arg == "--iterations" && i + 1 < argc) {
+            minIterations = atoi(argv[++i]);
+        } else if (arg == "--sizes" && i + 1 < argc) {
+            sizes.clear();
+            for (char* s = argv[++i]; *s;) {
+                char* end;
+                const auto v = strtoul(s, &end, 10);
+                if (end == s)
+                    break;
+                if (v > 0)
+                    sizes.push_back(v);
+                s = *end ? end + 1 : end;
+            }
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else {
+            usage(argv[0]);
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    bool removeDir = false;
+    if (dir.empty()) {
+        char tmpl[] = "/tmp/bench_decoder.XXXXXX";
+        if (!mkdtemp(tmpl)) {
+            printf("unable to create corpus directory\n");
+            return 1;
+        }
+        dir = tmpl;
+        removeDir = true;
+    } else {
+        mkdir(dir.c_str(), 0755);
+    }
+
+    const auto corpus = makeCorpus(dir, sizes);
+
+    printf("%-6s %-24s %12s %8s %10s %12s %12s %14s %10s\n",
+           "format", "name", "file bytes", "iters", "ms/decode", "MP/s", "allocs/dec", "alloc KB/dec", "peak MB");
+
+    bool failed = false;
+    size_t totalAllocs = 0;
+    uint64_t totalIterations = 0;
+    for (const auto& entry : corpus) {
+        const Result result = run(entry, minSeconds, minIterations);
+        if (!result.ok) {
+            printf("%-6s %-24s decode failed\n", formatName(entry.format), entry.name.c_str());
+            failed = true;
+            continue;
+        }
+        const double megapixels = (static_cast<double>(entry.width) * entry.height * result.iterations) / 1e6;
+        printf("%-6s %-24s %12zu %8u %10.3f %12.2f %12.1f %14.1f %10.1f\n",
+               formatName(entry.format), entry.name.c_str(), entry.fileSize, result.iterations,
+               (result.seconds * 1000.) / result.iterations, megapixels / result.seconds,
+               static_cast<double>(result.allocs) / result.iterations,
+               (static_cast<double>(result.allocBytes) / result.iterations) / 1024.,
+               result.peak / (1024. * 1024.));
+        totalAllocs += result.allocs;
+        totalIterations += result.iterations;
+    }
+
+    printf("\n%zu allocations over %llu decodes, peak rss %.1f MB\n",
+           totalAllocs, static_cast<unsigned long long>(totalIterations), processPeakRSS() / (1024. * 1024.));
+
+    if (removeDir) {
+        for (const auto& entry : corpus)
+            unlink(entry.path.c_str());
+        rmdir(dir.c_str());
+    }
+
+    return failed ? 1 : 0;
+}
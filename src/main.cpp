@@ -14,11 +14,15 @@
 #include <vector>
 #include <string>
 #include <cstring>
+#include <memory>
 #include <unordered_set>
 
 #include <functional>
 
 #include "scene/Scene.h"
+#include "scene/SceneLoader.h"
+#include "scene/SceneWatcher.h"
+#include "scene/Animator.h"
 #include "render/Render.h"
 
 #define STRINGIFY(x) #x
@@ -40,13 +44,25 @@ bool enableValidationLayers = true;
 
 const int WIDTH = 1280;
 const int HEIGHT = 720;
+// scene data in subtrees loaded from childrenSrc
+const size_t LOADED_SUBTREES_BUDGET = 256 * 1024 * 1024;
+// how often to look for changes nothing wakes the loop for when there's nothing to draw, in seconds
+const double ANIMATION_POLL_INTERVAL = 1. / 60.;
+const double WATCH_POLL_INTERVAL = 0.25;
 
 int main(int argc, char** argv)
 {
     if (argc < 2) {
-        printf("Needs a json argument\n");
+        printf("Needs a json or binary scene argument\n");
         return 1;
     }
+    // reload the scene whenever it or the local files it uses change
+    bool watch = false;
+    for (int i = 2; i < argc; ++i) {
+        if (!strcmp(argv[i], "--watch")) {
+            watch = true;
+        }
+    }
 
 #ifdef VULKAN_SDK
 #ifdef __APPLE__
@@ -66,12 +82,51 @@ int main(int argc, char** argv)
     printf("got png %u %u\n", png.width, png.height);
     */
 
-    Scene scene = Scene::sceneFromJSON(argv[1]);
+    Scene scene = Scene::sceneFromFile(argv[1]);
     Window win(WIDTH, HEIGHT);
 
     Render render(scene, win);
+    SceneLoader loader(scene);
+    loader.setMemoryBudget(LOADED_SUBTREES_BUDGET);
+    // a loaded subtree is attached in the next update
+    loader.setLoadedCallback([]() {
+        glfwPostEmptyEvent();
+    });
+
+    Animator animator;
+    std::unique_ptr<SceneWatcher> watcher;
+    if (watch) {
+        watcher = std::make_unique<SceneWatcher>(argv[1]);
+        watcher->watch(scene);
+    }
 
-    win.registerRender(std::bind(&Render::render, &render, std::placeholders::_1));
+    const Rect viewport { 0.f, 0.f, static_cast<float>(win.width()), static_cast<float>(win.height()) };
+    win.registerUpdate([&win, &render, &loader, &watcher, &animator, &scene, &viewport]() -> bool {
+        std::vector<Scene::Change> changes;
+        if (watcher) {
+            std::vector<std::string> changedFiles;
+            if (watcher->poll(scene, changes, changedFiles)) {
+                loader.applyChanges(changes);
+                loader.reload(changedFiles, changes);
+            }
+        }
+        loader.update(render.spatialIndex(), viewport, changes);
+        animator.applyChanges(changes);
+        animator.update(glfwGetTime(), changes);
+        if (!changes.empty()) {
+            render.applyChanges(changes);
+            if (watcher) {
+                // loaded subtrees bring files of their own
+                watcher->watch(scene);
+            }
+        }
+        // animations that haven't started and file changes don't come with an event
+        win.setIdleTimeout(!animator.empty() ? ANIMATION_POLL_INTERVAL : watcher ? WATCH_POLL_INTERVAL : 0.);
+        return render.needsFrame();
+    });
+    win.registerRender([&render](const Window::RenderData& data) {
+        render.render(data);
+    });
     win.exec();
 
     return 0;
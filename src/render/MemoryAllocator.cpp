@@ -0,0 +1,372 @@
+#include "MemoryAllocator.h"
+#include "Render.h"
+#include "RenderLimits.h"
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+
+static inline vk::DeviceSize alignUp(vk::DeviceSize value, vk::DeviceSize alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+MemoryAllocator::Allocation::Allocation(Allocation&& other)
+    : mAllocator(other.mAllocator), mBlock(other.mBlock), mOffset(other.mOffset), mSize(other.mSize), mAlignment(other.mAlignment)
+{
+    other.mAllocator = nullptr;
+    other.mBlock = nullptr;
+}
+
+MemoryAllocator::Allocation& MemoryAllocator::Allocation::operator=(Allocation&& other)
+{
+    if (this != &other) {
+        reset();
+        mAllocator = other.mAllocator;
+        mBlock = other.mBlock;
+        mOffset = other.mOffset;
+        mSize = other.mSize;
+        mAlignment = other.mAlignment;
+        other.mAllocator = nullptr;
+        other.mBlock = nullptr;
+    }
+    return *this;
+}
+
+void MemoryAllocator::Allocation::reset()
+{
+    if (!mBlock)
+        return;
+    mAllocator->release(mBlock, mOffset, mSize);
+    mAllocator = nullptr;
+    mBlock = nullptr;
+}
+
+vk::DeviceMemory MemoryAllocator::Allocation::memory() const
+{
+    return mBlock ? *mBlock->memory : vk::DeviceMemory();
+}
+
+uint8_t* MemoryAllocator::Allocation::mapped() const
+{
+    return mBlock && mBlock->mapped ? mBlock->mapped + mOffset : nullptr;
+}
+
+bool MemoryAllocator::Allocation::isCoherent() const
+{
+    return !mBlock || mBlock->coherent;
+}
+
+void MemoryAllocator::Allocation::flush() const
+{
+    if (!mBlock || mBlock->coherent)
+        return;
+    mAllocator->mRender.window().device()->flushMappedMemoryRanges({ vk::MappedMemoryRange(*mBlock->memory, mOffset, mSize) });
+}
+
+MemoryAllocator::MemoryAllocator(const Render& render)
+    : mRender(render)
+{
+    const auto& physicalDevice = mRender.window().physicalDevice();
+    mMemoryProperties = physicalDevice.getMemoryProperties();
+    mNonCoherentAtomSize = std::max<vk::DeviceSize>(physicalDevice.getProperties().limits.nonCoherentAtomSize, 1);
+}
+
+MemoryAllocator::~MemoryAllocator()
+{
+    const auto& device = mRender.window().device();
+    for (const auto& block : mBlocks) {
+        if (block->allocations > 0) {
+            printf("memory block of %llu bytes destroyed with %zu allocations\n",
+                   static_cast<unsigned long long>(block->size), block->allocations);
+        }
+        if (block->mapped) {
+            device->unmapMemory(*block->memory);
+        }
+    }
+}
+
+void MemoryAllocator::padding(uint32_t memoryType, vk::DeviceSize& size, vk::DeviceSize& alignment) const
+{
+    alignment = std::max<vk::DeviceSize>(alignment, 1);
+    const auto flags = mMemoryProperties.memoryTypes[memoryType].propertyFlags;
+    if ((flags & vk::MemoryPropertyFlagBits::eHostVisible) && !(flags & vk::MemoryPropertyFlagBits::eHostCoherent)) {
+        // so that flushing one allocation can't touch its neighbours
+        alignment = std::max(alignment, mNonCoherentAtomSize);
+        size = alignUp(size, mNonCoherentAtomSize);
+    }
+}
+
+MemoryAllocator::Block* MemoryAllocator::makeBlock(uint32_t memoryType, vk::DeviceSize size, Kind kind, bool dedicated)
+{
+    const auto& device = mRender.window().device();
+
+    auto block = std::make_unique<Block>();
+    vk::MemoryAllocateInfo allocInfo(size, memoryType);
+    block->memory = device->allocateMemoryUnique(allocInfo);
+    if (!block->memory) {
+        printf("failed to allocate memory block of %llu bytes\n", static_cast<unsigned long long>(size));
+        return nullptr;
+    }
+    block->size = size;
+    block->memoryType = memoryType;
+    block->kind = kind;
+    block->dedicated = dedicated;
+
+    const auto flags = mMemoryProperties.memoryTypes[memoryType].propertyFlags;
+    block->coherent = !(flags & vk::MemoryPropertyFlagBits::eHostVisible) || (flags & vk::MemoryPropertyFlagBits::eHostCoherent);
+    if (flags & vk::MemoryPropertyFlagBits::eHostVisible) {
+        block->mapped = static_cast<uint8_t*>(device->mapMemory(*block->memory, 0, VK_WHOLE_SIZE, {}));
+        if (!block->mapped) {
+            printf("failed to map memory block\n");
+            return nullptr;
+        }
+    }
+    block->free.push_back({ 0, size });
+
+    mBlocks.push_back(std::move(block));
+    return mBlocks.back().get();
+}
+
+bool MemoryAllocator::place(Block& block, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset)
+{
+    for (size_t i = 0; i < block.free.size(); ++i) {
+        const Range range = block.free[i];
+        const vk::DeviceSize start = alignUp(range.offset, alignment);
+        if (start + size > range.offset + range.size)
+            continue;
+
+        // what's left on either side stays free
+        const vk::DeviceSize end = start + size;
+        const vk::DeviceSize rangeEnd = range.offset + range.size;
+        block.free.erase(block.free.begin() + i);
+        if (end < rangeEnd) {
+            block.free.insert(block.free.begin() + i, { end, rangeEnd - end });
+        }
+        if (start > range.offset) {
+            block.free.insert(block.free.begin() + i, { range.offset, start - range.offset });
+        }
+
+        block.used += size;
+        ++block.allocations;
+        offset = start;
+        return true;
+    }
+    return false;
+}
+
+bool MemoryAllocator::placeAnywhere(uint32_t memoryType, Kind kind, vk::DeviceSize size, vk::DeviceSize alignment,
+                                    const Block* exclude, Block*& block, vk::DeviceSize& offset)
+{
+    for (const auto& candidate : mBlocks) {
+        if (candidate.get() == exclude || candidate->dedicated || candidate->memoryType != memoryType || candidate->kind != kind)
+            continue;
+        if (candidate->size - candidate->used < size)
+            continue;
+        if (place(*candidate, size, alignment, offset)) {
+            block = candidate.get();
+            return true;
+        }
+    }
+    return false;
+}
+
+MemoryAllocator::Allocation MemoryAllocator::allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, Kind kind)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    const uint32_t memoryType = mRender.findMemoryType(requirements.memoryTypeBits, properties);
+    if (memoryType >= mMemoryProperties.memoryTypeCount) {
+        printf("no memory type for allocation\n");
+        return {};
+    }
+
+    vk::DeviceSize size = requirements.size;
+    vk::DeviceSize alignment = requirements.alignment;
+    padding(memoryType, size, alignment);
+
+    Block* block = nullptr;
+    vk::DeviceSize offset = 0;
+    if (size > RenderLimits::MemoryBlockSize / 2) {
+        // not worth sharing a block with anything
+        block = makeBlock(memoryType, size, kind, true);
+        if (!block || !place(*block, size, alignment, offset))
+            return {};
+    } else if (!placeAnywhere(memoryType, kind, size, alignment, nullptr, block, offset)) {
+        block = makeBlock(memoryType, RenderLimits::MemoryBlockSize, kind, false);
+        if (!block || !place(*block, size, alignment, offset))
+            return {};
+    }
+
+    Allocation allocation;
+    allocation.mAllocator = this;
+    allocation.mBlock = block;
+    allocation.mOffset = offset;
+    allocation.mSize = size;
+    allocation.mAlignment = alignment;
+    return allocation;
+}
+
+MemoryAllocator::Allocation MemoryAllocator::allocate(vk::Buffer buffer, vk::MemoryPropertyFlags properties)
+{
+    const auto& device = mRender.window().device();
+    auto allocation = allocate(device->getBufferMemoryRequirements(buffer), properties, Linear);
+    if (allocation) {
+        device->bindBufferMemory(buffer, allocation.memory(), allocation.offset());
+    }
+    return allocation;
+}
+
+MemoryAllocator::Allocation MemoryAllocator::allocate(vk::Image image, vk::MemoryPropertyFlags properties)
+{
+    const auto& device = mRender.window().device();
+    auto allocation = allocate(device->getImageMemoryRequirements(image), properties, Optimal);
+    if (allocation) {
+        device->bindImageMemory(image, allocation.memory(), allocation.offset());
+    }
+    return allocation;
+}
+
+void MemoryAllocator::release(Block* block, vk::DeviceSize offset, vk::DeviceSize size)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    assert(block->allocations > 0);
+    block->movers.erase(offset);
+    block->used -= size;
+    --block->allocations;
+
+    // back into the free list, merged with whatever it touches
+    auto& free = block->free;
+    auto next = std::lower_bound(free.begin(), free.end(), offset, [](const Range& range, vk::DeviceSize value) {
+        return range.offset < value;
+    });
+    next = free.insert(next, { offset, size });
+    auto after = next + 1;
+    if (after != free.end() && next->offset + next->size == after->offset) {
+        next->size += after->size;
+        free.erase(after);
+    }
+    if (next != free.begin()) {
+        auto before = next - 1;
+        if (before->offset + before->size == next->offset) {
+            before->size += next->size;
+            free.erase(next);
+        }
+    }
+
+    if (block->allocations > 0)
+        return;
+
+    // keep one empty block of each kind around so that a single allocation
+    // coming and going doesn't allocate a block every time
+    if (!block->dedicated) {
+        const bool another = std::any_of(mBlocks.begin(), mBlocks.end(), [block](const std::unique_ptr<Block>& other) {
+            return other.get() != block && !other->dedicated && other->memoryType == block->memoryType && other->kind == block->kind
+                && other->allocations == 0;
+        });
+        if (!another)
+            return;
+    }
+    auto it = std::find_if(mBlocks.begin(), mBlocks.end(), [block](const std::unique_ptr<Block>& other) {
+        return other.get() == block;
+    });
+    assert(it != mBlocks.end());
+    if (block->mapped) {
+        mRender.window().device()->unmapMemory(*block->memory);
+    }
+    mBlocks.erase(it);
+}
+
+void MemoryAllocator::setMover(const Allocation& allocation, Mover&& mover)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    if (!allocation || allocation.mBlock->dedicated)
+        return;
+    allocation.mBlock->movers[allocation.mOffset] = { allocation.mSize, allocation.mAlignment, std::move(mover) };
+}
+
+size_t MemoryAllocator::defragment(size_t maxMoves)
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    size_t moves = 0;
+
+    std::vector<Block*> sources;
+    for (const auto& block : mBlocks) {
+        if (!block->dedicated && !block->movers.empty()) {
+            sources.push_back(block.get());
+        }
+    }
+    // emptiest first, those are the ones that can be given back
+    std::sort(sources.begin(), sources.end(), [](const Block* a, const Block* b) {
+        return a->used < b->used;
+    });
+
+    for (Block* source : sources) {
+        std::vector<vk::DeviceSize> offsets;
+        offsets.reserve(source->movers.size());
+        for (const auto& movable : source->movers) {
+            offsets.push_back(movable.first);
+        }
+
+        for (vk::DeviceSize from : offsets) {
+            if (moves >= maxMoves)
+                return moves;
+            const auto it = source->movers.find(from);
+            if (it == source->movers.end())
+                continue;
+            const Movable movable = it->second;
+
+            // only into blocks that are already there and fuller than this one
+            Block* target = nullptr;
+            vk::DeviceSize offset = 0;
+            if (!placeAnywhere(source->memoryType, source->kind, movable.size, movable.alignment, source, target, offset))
+                break;
+            if (target->used - movable.size < source->used) {
+                release(target, offset, movable.size);
+                break;
+            }
+
+            Allocation replacement;
+            replacement.mAllocator = this;
+            replacement.mBlock = target;
+            replacement.mOffset = offset;
+            replacement.mSize = movable.size;
+            replacement.mAlignment = movable.alignment;
+
+            // taking over the replacement frees the old allocation, and
+            // with the last one the source block
+            const bool last = source->allocations == 1;
+            if (movable.mover(std::move(replacement))) {
+                ++moves;
+                if (last)
+                    break;
+            }
+        }
+    }
+    return moves;
+}
+
+MemoryAllocator::Stats MemoryAllocator::stats() const
+{
+    std::lock_guard<std::recursive_mutex> lock(mMutex);
+    Stats stats;
+    for (const auto& block : mBlocks) {
+        ++stats.blocks;
+        if (block->dedicated)
+            ++stats.dedicatedBlocks;
+        stats.allocations += block->allocations;
+        stats.reserved += block->size;
+        stats.used += block->used;
+        stats.freeRanges += block->free.size();
+        for (const auto& range : block->free) {
+            stats.largestFree = std::max(stats.largestFree, range.size);
+        }
+    }
+    return stats;
+}
+
+void MemoryAllocator::printStats() const
+{
+    const Stats s = stats();
+    printf("gpu memory: %zu allocations in %zu blocks (%zu dedicated), %.1f of %.1f MB used, %zu free ranges, largest %.1f MB\n",
+           s.allocations, s.blocks, s.dedicatedBlocks, s.used / (1024. * 1024.), s.reserved / (1024. * 1024.),
+           s.freeRanges, s.largestFree / (1024. * 1024.));
+}
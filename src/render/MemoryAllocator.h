@@ -0,0 +1,150 @@
+#ifndef MEMORYALLOCATOR_H
+#define MEMORYALLOCATOR_H
+
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+
+class Render;
+
+// Sub-allocates device memory out of large blocks per memory type rather
+// than making an allocation per buffer and image. Each block keeps a free
+// list of ranges sorted by offset, allocations go first fit with the
+// alignment the resource needs and freed ranges are merged with their
+// neighbours. Buffers and optimally tiled images never share a block so
+// bufferImageGranularity doesn't need to be considered. Anything larger
+// than half a block gets a block of its own.
+//
+// Blocks of host visible memory are mapped once when they're made, use
+// Allocation::mapped() rather than mapping the memory. For non-coherent
+// types allocations are padded to nonCoherentAtomSize so that flush()
+// can flush them on their own.
+//
+// Allocating and freeing is thread safe, Render makes drawables on worker
+// threads.
+class MemoryAllocator
+{
+    struct Block;
+
+public:
+    MemoryAllocator(const Render& render);
+    ~MemoryAllocator();
+
+    MemoryAllocator(const MemoryAllocator&) = delete;
+    MemoryAllocator& operator=(const MemoryAllocator&) = delete;
+
+    // gives its range back when destroyed, the allocator has to outlive it
+    class Allocation
+    {
+    public:
+        Allocation() = default;
+        Allocation(Allocation&& other);
+        Allocation& operator=(Allocation&& other);
+        ~Allocation() { reset(); }
+
+        Allocation(const Allocation&) = delete;
+        Allocation& operator=(const Allocation&) = delete;
+
+        void reset();
+        explicit operator bool() const { return mBlock != nullptr; }
+
+        vk::DeviceMemory memory() const;
+        vk::DeviceSize offset() const { return mOffset; }
+        vk::DeviceSize size() const { return mSize; }
+        // null unless the memory is host visible
+        uint8_t* mapped() const;
+        bool isCoherent() const;
+        // of the whole allocation, nothing to do for coherent memory
+        void flush() const;
+
+    private:
+        friend class MemoryAllocator;
+
+        MemoryAllocator* mAllocator { nullptr };
+        Block* mBlock { nullptr };
+        vk::DeviceSize mOffset { 0 }, mSize { 0 }, mAlignment { 1 };
+    };
+
+    enum Kind {
+        Linear, // buffers
+        Optimal // optimally tiled images
+    };
+
+    Allocation allocate(const vk::MemoryRequirements& requirements, vk::MemoryPropertyFlags properties, Kind kind);
+    // allocates for the resource and binds it
+    Allocation allocate(vk::Buffer buffer, vk::MemoryPropertyFlags properties);
+    Allocation allocate(vk::Image image, vk::MemoryPropertyFlags properties);
+
+    // Defragmentation hook. defragment() moves allocations out of the
+    // emptiest block of each memory type by handing their mover a new
+    // allocation in another block. The mover copies the contents, binds
+    // its resource to the new allocation and takes it over (which frees the
+    // old one), or returns false to leave things as they were. Only
+    // allocations with a mover are ever moved, movers need to be set again
+    // on the allocation they're given.
+    typedef std::function<bool(Allocation&& replacement)> Mover;
+    void setMover(const Allocation& allocation, Mover&& mover);
+    // returns the number of allocations moved, at most maxMoves
+    size_t defragment(size_t maxMoves = 64);
+
+    struct Stats
+    {
+        size_t blocks { 0 }, dedicatedBlocks { 0 };
+        size_t allocations { 0 };
+        vk::DeviceSize reserved { 0 }, used { 0 };
+        size_t freeRanges { 0 };
+        vk::DeviceSize largestFree { 0 };
+    };
+    Stats stats() const;
+    void printStats() const;
+
+private:
+    struct Range
+    {
+        vk::DeviceSize offset, size;
+    };
+
+    struct Movable
+    {
+        vk::DeviceSize size, alignment;
+        Mover mover;
+    };
+
+    struct Block
+    {
+        vk::UniqueDeviceMemory memory;
+        vk::DeviceSize size { 0 }, used { 0 };
+        uint8_t* mapped { nullptr };
+        uint32_t memoryType { 0 };
+        Kind kind { Linear };
+        bool dedicated { false };
+        bool coherent { true };
+        size_t allocations { 0 };
+        // sorted by offset, never adjacent
+        std::vector<Range> free;
+        // by offset
+        std::unordered_map<vk::DeviceSize, Movable> movers;
+    };
+
+    Block* makeBlock(uint32_t memoryType, vk::DeviceSize size, Kind kind, bool dedicated);
+    bool place(Block& block, vk::DeviceSize size, vk::DeviceSize alignment, vk::DeviceSize& offset);
+    bool placeAnywhere(uint32_t memoryType, Kind kind, vk::DeviceSize size, vk::DeviceSize alignment,
+                       const Block* exclude, Block*& block, vk::DeviceSize& offset);
+    void release(Block* block, vk::DeviceSize offset, vk::DeviceSize size);
+    // alignment and size of what's actually reserved for requirements in memoryType
+    void padding(uint32_t memoryType, vk::DeviceSize& size, vk::DeviceSize& alignment) const;
+
+private:
+    const Render& mRender;
+    vk::PhysicalDeviceMemoryProperties mMemoryProperties;
+    vk::DeviceSize mNonCoherentAtomSize { 1 };
+    std::vector<std::unique_ptr<Block> > mBlocks;
+    // recursive, movers free the allocation they replace from within defragment()
+    mutable std::recursive_mutex mMutex;
+};
+
+#endif // MEMORYALLOCATOR_H
@@ -0,0 +1,111 @@
+#include "PipelineCache.h"
+#include <Window.h>
+#include <Buffer.h>
+#include <cstring>
+#include <cstddef>
+#include <stdio.h>
+
+static const uint32_t Magic = 0x43505456; // VTPC
+static const uint32_t Version = 1;
+
+static uint64_t hashData(const uint8_t* data, size_t size)
+{
+    // fnv-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+PipelineCache::PipelineCache(const Window& window, const std::string& path)
+    : mWindow(window), mPath(path)
+{
+    const auto& device = mWindow.device();
+    const Header expected = expectedHeader();
+
+    const Buffer file = Buffer::readFile(mPath);
+    const uint8_t* data = nullptr;
+    size_t dataSize = 0;
+    if (file.size() >= sizeof(Header)) {
+        Header header;
+        memcpy(&header, file.data(), sizeof(Header));
+        const size_t identity = offsetof(Header, dataSize);
+        if (memcmp(&header, &expected, identity) != 0) {
+            printf("pipeline cache '%s' is from another device or driver, starting over\n", mPath.c_str());
+        } else if (header.dataSize != file.size() - sizeof(Header)
+                   || header.dataHash != hashData(file.data() + sizeof(Header), header.dataSize)) {
+            printf("pipeline cache '%s' is corrupt, starting over\n", mPath.c_str());
+        } else {
+            data = file.data() + sizeof(Header);
+            dataSize = header.dataSize;
+            mDataSize = header.dataSize;
+            mDataHash = header.dataHash;
+        }
+    }
+
+    vk::PipelineCacheCreateInfo createInfo({}, dataSize, data);
+    mCache = device->createPipelineCacheUnique(createInfo);
+    if (!mCache && data) {
+        // the driver didn't like what it wrote last time after all
+        createInfo = vk::PipelineCacheCreateInfo();
+        mCache = device->createPipelineCacheUnique(createInfo);
+        mDataSize = mDataHash = 0;
+        data = nullptr;
+    }
+    if (!mCache) {
+        printf("failed to create pipeline cache\n");
+        return;
+    }
+    mLoaded = data != nullptr;
+}
+
+PipelineCache::~PipelineCache()
+{
+    save();
+}
+
+PipelineCache::Header PipelineCache::expectedHeader() const
+{
+    const auto properties = mWindow.physicalDevice().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceIDProperties>();
+    const auto& device = properties.get<vk::PhysicalDeviceProperties2>().properties;
+    const auto& id = properties.get<vk::PhysicalDeviceIDProperties>();
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    header.magic = Magic;
+    header.version = Version;
+    header.vendorID = device.vendorID;
+    header.deviceID = device.deviceID;
+    header.driverVersion = device.driverVersion;
+    memcpy(header.deviceUUID, &id.deviceUUID[0], VK_UUID_SIZE);
+    memcpy(header.pipelineCacheUUID, &device.pipelineCacheUUID[0], VK_UUID_SIZE);
+    return header;
+}
+
+bool PipelineCache::save()
+{
+    if (!mCache)
+        return false;
+
+    const std::vector<uint8_t> data = mWindow.device()->getPipelineCacheData(*mCache);
+    const uint64_t hash = hashData(data.data(), data.size());
+    if (data.empty() || (data.size() == mDataSize && hash == mDataHash))
+        return true;
+
+    Header header = expectedHeader();
+    header.dataSize = data.size();
+    header.dataHash = hash;
+
+    Buffer file(reinterpret_cast<const uint8_t*>(&header), sizeof(Header));
+    file.append(data.data(), data.size());
+    // a run that's killed halfway through writing leaves the old cache
+    const std::string temporary = mPath + ".tmp";
+    if (!file.writeFile(temporary) || rename(temporary.c_str(), mPath.c_str()) != 0) {
+        printf("failed to save pipeline cache '%s'\n", mPath.c_str());
+        return false;
+    }
+    mDataSize = data.size();
+    mDataHash = hash;
+    return true;
+}
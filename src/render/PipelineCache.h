@@ -0,0 +1,62 @@
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <string>
+
+class Window;
+
+// The pipeline cache every pipeline is made with, kept in a file between
+// runs so that pipelines only compile from scratch the first time.
+//
+// The file has a header of its own in front of the driver's data with the
+// vendor, device, driver version and UUIDs it was made with and a hash of
+// the data. Anything that doesn't match the device it's loaded on, or is
+// cut short, is ignored and the cache starts out empty. Drivers are
+// supposed to check their own header as well but not all of them survive
+// data that's corrupt.
+//
+// Written back when destroyed if the driver added anything.
+class PipelineCache
+{
+public:
+    PipelineCache(const Window& window, const std::string& path);
+    ~PipelineCache();
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+
+    vk::PipelineCache cache() const { return *mCache; }
+    // whether there was a valid cache on disk to start out with
+    bool loaded() const { return mLoaded; }
+
+    bool save();
+
+private:
+    struct Header
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t vendorID;
+        uint32_t deviceID;
+        uint32_t driverVersion;
+        uint8_t deviceUUID[VK_UUID_SIZE];
+        uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+        uint32_t reserved; // no padding to compare
+        uint64_t dataSize;
+        uint64_t dataHash;
+    };
+    // what a file made on this device needs to start with, less the data size and hash
+    Header expectedHeader() const;
+
+private:
+    const Window& mWindow;
+    std::string mPath;
+    vk::UniquePipelineCache mCache;
+    bool mLoaded { false };
+    // of the data as loaded or last saved
+    uint64_t mDataSize { 0 }, mDataHash { 0 };
+};
+
+#endif // PIPELINECACHE_H
@@ -1,6 +1,15 @@
 #include "Render.h"
 #include "RenderText.h"
+#include "RenderLimits.h"
+#include "ShaderCache.h"
 #include <Buffer.h>
+#include <chrono>
+#include <math.h>
+
+// where the glsl of the pipelines is, see ShaderCache
+#ifndef SHADER_SOURCE_DIR
+#define SHADER_SOURCE_DIR "./shaders"
+#endif
 
 #define GLM_FORCE_RADIANS
 #define GLM_FORCE_DEPTH_ZERO_TO_ONE
@@ -21,69 +30,73 @@ struct RenderImageData
     glm::vec4 geometry;
 };
 
+// an image drawable's RenderImageData and its slot in the texture table
+struct RenderImageInstance
+{
+    glm::vec4 geometry;
+    uint32_t texture;
+};
+
 struct RenderTextData
 {
     glm::vec4 color;
     glm::mat4 projection;
 };
 
+static_assert(sizeof(RenderColorData) == RenderLimits::ColorInstanceSize, "RenderLimits out of date");
+static_assert(sizeof(RenderImageData) == RenderLimits::ImageUniformSize, "RenderLimits out of date");
+static_assert(sizeof(RenderTextData) == RenderLimits::TextUniformSize, "RenderLimits out of date");
+static_assert(offsetof(RenderImageInstance, texture) + sizeof(uint32_t) == RenderLimits::ImageInstanceSize, "RenderLimits out of date");
+static_assert(sizeof(RenderImageData) <= RenderLimits::MaxUniformSize && sizeof(RenderTextData) <= RenderLimits::MaxUniformSize,
+              "uniform data doesn't fit a slot");
+
+// has no uniform slot, data is copied to the color instances of the frame
 struct Render::RenderColorDrawable : public Render::Node::Drawable
 {
 public:
-    virtual void update(const vk::UniqueDevice& device, uint32_t currentImage);
+    RenderColorDrawable() : Drawable(DrawableColor, &data, sizeof(data)) { }
 
-    std::vector<bool> changed;
     RenderColorData data;
 };
 
-void Render::RenderColorDrawable::update(const vk::UniqueDevice& device, uint32_t currentImage)
-{
-    if (!changed[currentImage])
-        return;
-    void* out = device->mapMemory(*ubosMemory[currentImage], 0, sizeof(data), {});
-    memcpy(out, &data, sizeof(data));
-    device->unmapMemory(*ubosMemory[currentImage]);
-    changed[currentImage] = false;
-}
-
 struct Render::RenderImageDrawable : public Render::Node::Drawable
 {
 public:
-    virtual void update(const vk::UniqueDevice& device, uint32_t currentImage);
+    RenderImageDrawable() : Drawable(DrawableImage, &data, sizeof(data)) { }
 
-    std::vector<bool> changed;
     RenderImageData data;
 };
 
-void Render::RenderImageDrawable::update(const vk::UniqueDevice& device, uint32_t currentImage)
-{
-    if (!changed[currentImage])
-        return;
-    void* out = device->mapMemory(*ubosMemory[currentImage], 0, sizeof(data), {});
-    memcpy(out, &data, sizeof(data));
-    device->unmapMemory(*ubosMemory[currentImage]);
-    changed[currentImage] = false;
-}
-
 struct Render::RenderTextDrawable : public Render::Node::Drawable
 {
 public:
-    virtual void update(const vk::UniqueDevice& device, uint32_t currentText);
+    RenderTextDrawable() : Drawable(DrawableText, &data, sizeof(data)) { }
 
-    std::vector<bool> changed;
     RenderTextData data;
+    float layoutWidth { 0.f };
+    // of the layout, scaled to the size of the text
+    float renderedWidth { 0.f }, renderedHeight { 0.f };
 };
 
-void Render::RenderTextDrawable::update(const vk::UniqueDevice& device, uint32_t currentImage)
+void Render::Node::Drawable::update(uint32_t currentImage)
 {
     if (!changed[currentImage])
         return;
-    void* out = device->mapMemory(*ubosMemory[currentImage], 0, sizeof(data), {});
-    memcpy(out, &data, sizeof(data));
-    device->unmapMemory(*ubosMemory[currentImage]);
+    uniforms->write(uniform, currentImage, uniformData, uniformSize);
     changed[currentImage] = false;
 }
 
+void Render::Node::Drawable::record(const vk::CommandBuffer& commandBuffer, uint32_t imageIndex, const std::array<float, 2>& offset) const
+{
+    commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipeline);
+    commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline->layout, 0, { descriptorSet }, { uniforms->dynamicOffset(uniform, imageIndex) });
+    commandBuffer.pushConstants(*pipeline->layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(offset), offset.data());
+    if (vertices) {
+        commandBuffer.bindVertexBuffers(0, { vertices }, { 0 });
+    }
+    commandBuffer.draw(vertexCount, 1, 0, 0);
+}
+
 static vk::UniqueShaderModule createShaderModule(const vk::UniqueDevice& device, const Buffer& buffer)
 {
     if (buffer.empty()) {
@@ -95,99 +108,91 @@ static vk::UniqueShaderModule createShaderModule(const vk::UniqueDevice& device,
     return device->createShaderModuleUnique(createInfo);
 }
 
-/*
-static void copyBuffer(vk::Device device, vk::CommandPool commandPool, vk::Queue graphicsQueue,
-                       vk::Buffer srcBuffer, vk::Buffer dstBuffer, vk::DeviceSize size)
+Render::Render(const Scene& scene, const Window& window)
+    : mWindow(window)
 {
-    vk::CommandBufferAllocateInfo allocInfo(commandPool, vk::CommandBufferLevel::ePrimary, 1);
-
-    const std::vector<vk::UniqueCommandBuffer> commandBuffers = device.allocateCommandBuffersUnique(allocInfo);
-    if (commandBuffers.empty() || !commandBuffers[0]) {
-        printf("failed to allocate command buffer for copy\n");
+    if (!init())
         return;
-    }
-    const auto& commandBuffer = commandBuffers[0];
-
-    vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-
-    commandBuffer->begin(beginInfo);
-    vk::BufferCopy copyRegion(0, 0, size);
-    commandBuffer->copyBuffer(srcBuffer, dstBuffer, { copyRegion });
-    commandBuffer->end();
-
-    vk::SubmitInfo submitInfo({}, {}, {}, 1, &*commandBuffer);
+    makeRenderTree(scene);
+    mUploads->submit();
+    mUploads->printStats();
+}
 
-    graphicsQueue.submit({ submitInfo }, {});
-    graphicsQueue.waitIdle();
+Render::~Render()
+{
+    // the last frames may still be in flight
+    if (mWindow.device()) {
+        mWindow.device()->waitIdle();
+    }
 }
-*/
 
-Render::Render(const Scene& scene, const Window& window)
-    : mWindow(window)
+bool Render::init()
 {
-    const auto& device = window.device();
-    const uint32_t graphicsFamily = window.graphicsFamily();
+    const auto& device = mWindow.device();
+    const uint32_t graphicsFamily = mWindow.graphicsFamily();
+
+    mJobs = std::make_unique<JobSystem>();
+
+    const auto& swapChainFramebuffers = mWindow.swapChainFramebuffers();
 
+    // one command buffer per swapchain image, reset and recorded again when the draw list changes
+    vk::CommandPoolCreateInfo framePoolInfo(vk::CommandPoolCreateFlagBits::eResetCommandBuffer, graphicsFamily);
+    mFrameCommandPool = device->createCommandPoolUnique(framePoolInfo);
+    if (!mFrameCommandPool) {
+        printf("failed to create frame command pool!\n");
+        return false;
+    }
+    vk::CommandBufferAllocateInfo allocInfo(*mFrameCommandPool, vk::CommandBufferLevel::ePrimary, swapChainFramebuffers.size());
+    auto commandBuffers = device->allocateCommandBuffersUnique(allocInfo);
+    if (commandBuffers.size() != swapChainFramebuffers.size()) {
+        printf("failed to allocate frame command buffers!\n");
+        return false;
+    }
+    // command pools can only be used by one thread at a time
     vk::CommandPoolCreateInfo poolInfo({}, graphicsFamily);
-    mCommandPool = device->createCommandPoolUnique(poolInfo);
-    if (!mCommandPool) {
-        printf("failed to create command pool!\n");
-        return;
+    mImageFrames.resize(swapChainFramebuffers.size());
+    for (size_t i = 0; i < commandBuffers.size(); ++i) {
+        auto& frame = mImageFrames[i];
+        frame.commandBuffer = std::move(commandBuffers[i]);
+        frame.secondaries.resize(mJobs->threadCount());
+        for (auto& secondaries : frame.secondaries) {
+            secondaries.pool = device->createCommandPoolUnique(poolInfo);
+            if (!secondaries.pool) {
+                printf("failed to create secondary command pool!\n");
+                return false;
+            }
+        }
     }
 
-    const auto& swapChainFramebuffers = window.swapChainFramebuffers();
-
     std::array<vk::DescriptorPoolSize, 2> poolSizes = {};
-    poolSizes[0] = vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, swapChainFramebuffers.size());
-    poolSizes[1] = vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, swapChainFramebuffers.size());
-    // enough for 1000 'widgets'
-    vk::DescriptorPoolCreateInfo descriptorPoolInfo({}, swapChainFramebuffers.size() * 1000, poolSizes.size(), poolSizes.data());
+    // every set has a dynamic ubo and at most one sampler
+    poolSizes[0] = vk::DescriptorPoolSize(vk::DescriptorType::eUniformBufferDynamic, RenderLimits::MaxDescriptorSets);
+    poolSizes[1] = vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, RenderLimits::MaxDescriptorSets);
+    // sets are freed individually when drawables are replaced
+    vk::DescriptorPoolCreateInfo descriptorPoolInfo(vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet, RenderLimits::MaxDescriptorSets,
+                                                    poolSizes.size(), poolSizes.data());
     mDescriptorPool = device->createDescriptorPoolUnique(descriptorPoolInfo);
     if (!mDescriptorPool) {
         printf("failed to create descriptor pool\n");
-        return;
+        return false;
     }
 
+    mAllocator = std::make_unique<MemoryAllocator>(*this);
+    mUploads = std::make_unique<UploadQueue>(*this);
+    if (!mUploads->isValid())
+        return false;
+    mSamplers = std::make_unique<SamplerCache>(*this);
+    mUniforms = std::make_unique<UniformArena>(*this, swapChainFramebuffers.size());
+    mTextures = std::make_unique<TextureTable>(*this);
     mRenderText = std::make_shared<RenderText>(*this);
 
+    // in the working directory like the shaders
+    mPipelineCache = std::make_unique<PipelineCache>(mWindow, "./pipeline-cache.bin");
+    const auto start = std::chrono::steady_clock::now();
     makeDrawableDatas();
-    makeRenderTree(scene);
-}
-
-vk::CommandBuffer Render::beginSingleCommand() const
-{
-    const auto& device = mWindow.device();
-
-    vk::CommandBufferAllocateInfo allocInfo(*mCommandPool, vk::CommandBufferLevel::ePrimary, 1);
-
-    const std::vector<vk::CommandBuffer> commandBuffers = device->allocateCommandBuffers(allocInfo);
-    if (commandBuffers.empty() || !commandBuffers[0]) {
-        printf("failed to allocate command buffer for copy\n");
-        return {};
-    }
-    const auto& commandBuffer = commandBuffers[0];
-
-    vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit);
-
-    commandBuffer.begin(beginInfo);
-
-    return commandBuffer;
-}
-
-void Render::endSingleCommand(const vk::CommandBuffer& commandBuffer) const
-{
-    const auto& device = mWindow.device();
-
-    commandBuffer.end();
-
-    const auto& graphicsQueue = mWindow.graphicsQueue();
-
-    vk::SubmitInfo submitInfo({}, {}, {}, 1, &commandBuffer);
-
-    graphicsQueue.submit({ submitInfo }, {});
-    graphicsQueue.waitIdle();
-
-    device->freeCommandBuffers(*mCommandPool, { commandBuffer });
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    printf("made pipelines in %.1fms, %s\n", elapsed.count(), mPipelineCache->loaded() ? "pipeline cache hit" : "no pipeline cache");
+    return true;
 }
 
 uint32_t Render::findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) const
@@ -216,15 +221,10 @@ Render::VertexBuffer Render::createBuffer(vk::DeviceSize size, vk::BufferUsageFl
         return Render::VertexBuffer();
     }
 
-    vk::MemoryRequirements memRequirements = device.getBufferMemoryRequirements(*buf.buffer);
-    vk::MemoryAllocateInfo allocInfo(memRequirements.size, findMemoryType(memRequirements.memoryTypeBits, properties));
-
-    buf.memory = device.allocateMemoryUnique(allocInfo);
+    buf.memory = mAllocator->allocate(*buf.buffer, properties);
     if (!buf.memory) {
         return Render::VertexBuffer();
     }
-
-    device.bindBufferMemory(*buf.buffer, *buf.memory, 0);
     return buf;
 }
 
@@ -273,14 +273,17 @@ std::shared_ptr<Render::PipelineResult> Render::makePipeline(const PipelineData&
 
     vk::PipelineColorBlendStateCreateInfo colorBlending({}, VK_FALSE, vk::LogicOp::eCopy, 1, &colorBlendAttachment);
 
+    // set when recording, the scissor is the damage of the frame
     vk::DynamicState dynamicStates[] = {
         vk::DynamicState::eViewport,
-        vk::DynamicState::eLineWidth
+        vk::DynamicState::eScissor
     };
 
     vk::PipelineDynamicStateCreateInfo dynamicState({}, 2, dynamicStates);
 
-    vk::PipelineLayoutCreateInfo pipelineLayoutInfo;
+    // every vertex shader takes the offset of the template instance it draws
+    vk::PushConstantRange pushConstantRange(vk::ShaderStageFlagBits::eVertex, 0, sizeof(std::array<float, 2>));
+    vk::PipelineLayoutCreateInfo pipelineLayoutInfo({}, 0, nullptr, 1, &pushConstantRange);
     vk::UniqueDescriptorSetLayout descriptorSetLayout;
     if (data.descriptorSetLayout) {
         descriptorSetLayout = data.descriptorSetLayout(device);
@@ -297,10 +300,10 @@ std::shared_ptr<Render::PipelineResult> Render::makePipeline(const PipelineData&
     const auto& renderPass = mWindow.renderPass();
 
     vk::GraphicsPipelineCreateInfo pipelineInfo({}, 2, shaderStages, &vertexInputInfo, &inputAssembly, nullptr, &viewportState,
-                                                &rasterizer, &multisampling, nullptr, &colorBlending, nullptr, *pipelineLayout,
+                                                &rasterizer, &multisampling, nullptr, &colorBlending, &dynamicState, *pipelineLayout,
                                                 *renderPass, 0, {}, -1);
 
-    auto graphicsPipelines = device->createGraphicsPipelinesUnique({}, { pipelineInfo });
+    auto graphicsPipelines = device->createGraphicsPipelinesUnique(mPipelineCache->cache(), { pipelineInfo });
     if (graphicsPipelines.empty() || !graphicsPipelines[0]) {
         printf("failed to create graphics pipeline!\n");
         return std::shared_ptr<PipelineResult>();
@@ -309,18 +312,21 @@ std::shared_ptr<Render::PipelineResult> Render::makePipeline(const PipelineData&
     return std::make_shared<PipelineResult>(std::move(graphicsPipelines[0]), std::move(pipelineLayout), std::move(descriptorSetLayout));
 }
 
-void Render::makeColorDrawableData()
+void Render::makeColorDrawableData(ShaderCache& shaders)
 {
     // make pipeline
     const PipelineData createData = {
-        Buffer::readFile("./color-vert.spv"),
-        Buffer::readFile("./color-frag.spv"),
-        {}, {},
-        [](const vk::UniqueDevice& device) -> vk::UniqueDescriptorSetLayout {
-            vk::DescriptorSetLayoutBinding uboLayoutBinding(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex);
-            vk::DescriptorSetLayoutCreateInfo layoutInfo({}, 1, &uboLayoutBinding);
-            return device->createDescriptorSetLayoutUnique(layoutInfo);
-        }
+        shaders.spirv("color", ShaderCache::Vertex),
+        shaders.spirv("color", ShaderCache::Fragment),
+        // one RenderColorData per instance, the four corners come from gl_VertexIndex
+        []() { return vk::VertexInputBindingDescription(0, sizeof(RenderColorData), vk::VertexInputRate::eInstance); },
+        []() {
+            return std::vector<vk::VertexInputAttributeDescription> {
+                { 0, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(RenderColorData, color) },
+                { 1, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(RenderColorData, geometry) }
+            };
+        },
+        {}
     };
 
     DrawableData drawableData;
@@ -332,15 +338,15 @@ void Render::makeColorDrawableData()
     mDrawableData.push_back(std::move(drawableData));
 }
 
-void Render::makeImageDrawableData()
+void Render::makeImageDrawableData(ShaderCache& shaders)
 {
     // make pipeline
     const PipelineData createData = {
-        Buffer::readFile("./image-vert.spv"),
-        Buffer::readFile("./image-frag.spv"),
+        shaders.spirv("image", ShaderCache::Vertex),
+        shaders.spirv("image", ShaderCache::Fragment),
         {}, {},
         [](const vk::UniqueDevice& device) -> vk::UniqueDescriptorSetLayout {
-            vk::DescriptorSetLayoutBinding uboLayoutBindingVert(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex);
+            vk::DescriptorSetLayoutBinding uboLayoutBindingVert(0, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex);
             vk::DescriptorSetLayoutBinding uboLayoutBindingFrag(1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment);
             vk::DescriptorSetLayoutBinding uboLayoutBindings[] = { uboLayoutBindingVert, uboLayoutBindingFrag };
             vk::DescriptorSetLayoutCreateInfo layoutInfo({}, 2, uboLayoutBindings);
@@ -353,20 +359,40 @@ void Render::makeImageDrawableData()
     auto pipeline = makePipeline(createData, vk::PrimitiveTopology::eTriangleStrip);
     drawableData.pipeline = pipeline;
 
+    if (mTextures->isValid()) {
+        const uint32_t capacity = mTextures->capacity();
+        const PipelineData batchData = {
+            shaders.spirv("imagebatch", ShaderCache::Vertex),
+            shaders.spirv("imagebatch", ShaderCache::Fragment),
+            // one RenderImageInstance per instance, the texture coordinates come from gl_VertexIndex
+            []() { return vk::VertexInputBindingDescription(0, RenderLimits::ImageInstanceSize, vk::VertexInputRate::eInstance); },
+            []() {
+                return std::vector<vk::VertexInputAttributeDescription> {
+                    { 0, 0, vk::Format::eR32G32B32A32Sfloat, offsetof(RenderImageInstance, geometry) },
+                    { 1, 0, vk::Format::eR32Uint, offsetof(RenderImageInstance, texture) }
+                };
+            },
+            [capacity](const vk::UniqueDevice& device) -> vk::UniqueDescriptorSetLayout {
+                return TextureTable::makeLayout(device, capacity);
+            }
+        };
+        drawableData.batchPipeline = makePipeline(batchData, vk::PrimitiveTopology::eTriangleStrip);
+    }
+
     assert(mDrawableData.size() == DrawableImage);
     mDrawableData.push_back(std::move(drawableData));
 }
 
-void Render::makeTextDrawableData()
+void Render::makeTextDrawableData(ShaderCache& shaders)
 {
     // make pipeline
     const PipelineData createData = {
-        Buffer::readFile("./text-vert.spv"),
-        Buffer::readFile("./text-frag.spv"),
+        shaders.spirv("text", ShaderCache::Vertex),
+        shaders.spirv("text", ShaderCache::Fragment),
         []() { return RenderTextVertex::getBindingDescription(); },
         []() { return RenderTextVertex::getAttributeDescriptions(); },
         [](const vk::UniqueDevice& device) -> vk::UniqueDescriptorSetLayout {
-            vk::DescriptorSetLayoutBinding uboLayoutBindingVert(0, vk::DescriptorType::eUniformBuffer, 1, vk::ShaderStageFlagBits::eVertex);
+            vk::DescriptorSetLayoutBinding uboLayoutBindingVert(0, vk::DescriptorType::eUniformBufferDynamic, 1, vk::ShaderStageFlagBits::eVertex);
             vk::DescriptorSetLayoutBinding uboLayoutBindingFrag(1, vk::DescriptorType::eCombinedImageSampler, 1, vk::ShaderStageFlagBits::eFragment);
             vk::DescriptorSetLayoutBinding uboLayoutBindings[] = { uboLayoutBindingVert, uboLayoutBindingFrag };
             vk::DescriptorSetLayoutCreateInfo layoutInfo({}, 2, uboLayoutBindings);
@@ -385,9 +411,18 @@ void Render::makeTextDrawableData()
 
 void Render::makeDrawableDatas()
 {
-    makeColorDrawableData();
-    makeImageDrawableData();
-    makeTextDrawableData();
+    // compiled in parallel up front, or read back from the cache when unchanged
+    ShaderCache shaders(SHADER_SOURCE_DIR, "./shader-cache", mWindow.apiVersion());
+    const auto start = std::chrono::steady_clock::now();
+    shaders.load({ "color", "image", "imagebatch", "text" }, *mJobs);
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    const auto& stats = shaders.stats();
+    printf("loaded shaders in %.1fms, %zu compiled, %zu cached, %zu precompiled, %zu failed\n", elapsed.count(),
+           stats.compiled, stats.cached, stats.precompiled, stats.failed);
+
+    makeColorDrawableData(shaders);
+    makeImageDrawableData(shaders);
+    makeTextDrawableData(shaders);
 }
 
 static inline float mix(float coord, float limit, float min, float max)
@@ -401,135 +436,113 @@ static inline float mixScreen(float coord, float limit)
     return mix(coord, limit, -1.f, 1.f);
 }
 
-std::shared_ptr<Render::Node::Drawable> Render::makeColorDrawable(const Color& color, const Rect& geom)
+static inline glm::vec4 screenGeometry(const Rect& geom, float width, float height)
 {
-    assert(mDrawableData.size() > DrawableColor);
-    const auto& drawableData = mDrawableData[DrawableColor];
-
-    const auto& swapChainFramebuffers = mWindow.swapChainFramebuffers();
-    const auto& device = mWindow.device();
-    const auto& pipeline = drawableData.pipeline;
-
-    auto colorDrawable = std::make_shared<RenderColorDrawable>();
-
-    // make ubos
-    vk::DeviceSize colorSize = sizeof(RenderColorData);
-    colorDrawable->ubos.reserve(swapChainFramebuffers.size());
-    colorDrawable->ubosMemory.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        auto ubo = createBuffer(colorSize,
-                                vk::BufferUsageFlagBits::eUniformBuffer,
-                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        colorDrawable->ubos.push_back(std::move(ubo.buffer));
-        colorDrawable->ubosMemory.push_back(std::move(ubo.memory));
-    }
-
-    // allocate descriptor sets
-    std::vector<vk::DescriptorSetLayout> layouts(swapChainFramebuffers.size(), *pipeline->descriptorSetLayout);
-    vk::DescriptorSetAllocateInfo allocInfo(*mDescriptorPool, swapChainFramebuffers.size(), layouts.data());
-    auto sets = device->allocateDescriptorSetsUnique(allocInfo);
-    colorDrawable->descriptorSets.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        vk::DescriptorBufferInfo bufferInfo(*colorDrawable->ubos[i], 0, sizeof(RenderColorData));
-        vk::WriteDescriptorSet descriptorWrite(*sets[i], 0, 0, 1, vk::DescriptorType::eUniformBuffer, {}, &bufferInfo);
-        device->updateDescriptorSets({ descriptorWrite }, {});
-
-        colorDrawable->descriptorSets.push_back(std::move(sets[i]));
-    }
+    return { mixScreen(geom.x, width), mixScreen(geom.y, height), mixScreen(geom.x + geom.width, width), mixScreen(geom.y + geom.height, height) };
+}
 
-    vk::CommandBufferAllocateInfo allocCommandBufferInfo(*mCommandPool, vk::CommandBufferLevel::eSecondary, swapChainFramebuffers.size());
-    auto commandBuffers = device->allocateCommandBuffersUnique(allocCommandBufferInfo);
-    if (commandBuffers.empty()) {
-        printf("failed to allocate command buffers!\n");
-        std::shared_ptr<Render::Node::Drawable>();
-    }
+static glm::mat4 textProjection(const Text& text, const Rect& geometry, uint32_t renderSize, float width, float height)
+{
+    const float factor = text.size / static_cast<float>(renderSize);
+    const float tx = mix(geometry.x, width, -1.0f, 1.0f);
+    const float ty = mix(geometry.y, height, -1.0f, 1.0f);
 
-    colorDrawable->commandBuffers.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-        vk::CommandBufferBeginInfo beginInfo;
-        commandBuffers[i]->begin(beginInfo);
+    glm::mat4 projection = glm::mat4(1.0f);
+    projection = glm::scale(projection, glm::vec3(factor, factor, 1.0f));
+    projection = glm::translate(projection, glm::vec3(1.0f + (tx / factor), 1.0f + (ty / factor), 0.0f));
+    return projection;
+}
 
-        commandBuffers[i]->bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipeline);
-        commandBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline->layout, 0, { *colorDrawable->descriptorSets[i] }, {});
-        commandBuffers[i]->draw(4, 1, 0, 0);
+// glyphs can reach outside of the layout's size and the item's geometry
+static inline Rect textBounds(const Text& text, const Rect& geometry, float renderedWidth, float renderedHeight)
+{
+    const float margin = text.size * 0.25f;
+    return { geometry.x - margin, geometry.y - margin,
+             std::max(geometry.width, renderedWidth) + 2.f * margin, std::max(geometry.height, renderedHeight) + 2.f * margin };
+}
 
-        commandBuffers[i]->end();
+template<typename T>
+std::shared_ptr<T> Render::makeDrawable()
+{
+    T* drawable = new T;
+    drawable->id = mNextDrawableId++;
+    return std::shared_ptr<T>(drawable, [this](T* drawable) {
+        // drawables that couldn't be made are let go of on worker threads
+        std::lock_guard<std::mutex> lock(mMutex);
+        mGarbage.push_back({ mFrameNumber, std::unique_ptr<Node::Drawable>(drawable) });
+        mDrawListDirty = true;
+    });
+}
 
-        colorDrawable->commandBuffers.push_back(std::move(commandBuffers[i]));
+void Render::collectGarbage()
+{
+    // Window waited for the frame that last used this frame's slot, which is the frame
+    // MaxFramesInFlight ago. everything let go of before the frame after that started is done with
+    while (!mGarbage.empty() && mGarbage.front().frame + Window::MaxFramesInFlight <= mFrameNumber + 1) {
+        mGarbage.pop_front();
     }
-
-    colorDrawable->changed = std::vector<bool>(mWindow.swapChainFramebuffers().size(), true);
-
-    const float width = static_cast<float>(mWindow.width());
-    const float height = static_cast<float>(mWindow.height());
-
-    colorDrawable->data.color = { color.r, color.g, color.b, color.a };
-    colorDrawable->data.geometry = { mixScreen(geom.x, width), mixScreen(geom.y, height), mixScreen(geom.x + geom.width, width), mixScreen(geom.y + geom.height, height) };
-    //printf("ball %f %f %f %f\n", colorDrawable->data.geometry[0], colorDrawable->data.geometry[1], colorDrawable->data.geometry[2], colorDrawable->data.geometry[3]);
-
-    return colorDrawable;
 }
 
-void Render::transitionImageLayout(const vk::UniqueImage& image, vk::Format format, vk::ImageLayout oldLayout, vk::ImageLayout newLayout) const
+bool Render::makeUniform(Node::Drawable& drawable)
 {
-    vk::PipelineStageFlags srcStage, dstStage;
-    vk::ImageMemoryBarrier barrier({}, {}, oldLayout, newLayout, VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED,
-                                   *image, { {}, 0, 1, 0, 1 });
-    if (oldLayout == vk::ImageLayout::eUndefined && newLayout == vk::ImageLayout::eTransferDstOptimal) {
-        barrier.srcAccessMask = {};
-        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    const auto& device = mWindow.device();
 
-        srcStage = vk::PipelineStageFlagBits::eTopOfPipe;
-        dstStage = vk::PipelineStageFlagBits::eTransfer;
-    } else if (oldLayout == vk::ImageLayout::eTransferDstOptimal && newLayout == vk::ImageLayout::eShaderReadOnlyOptimal) {
-        barrier.srcAccessMask = vk::AccessFlagBits::eTransferWrite;
-        barrier.dstAccessMask = vk::AccessFlagBits::eShaderRead;
+    drawable.uniform = mUniforms->allocate();
+    if (!drawable.uniform.isValid())
+        return false;
+    drawable.uniforms = mUniforms.get();
 
-        srcStage = vk::PipelineStageFlagBits::eTransfer;
-        dstStage = vk::PipelineStageFlagBits::eFragmentShader;
-    } else if (oldLayout == vk::ImageLayout::eShaderReadOnlyOptimal && newLayout == vk::ImageLayout::eTransferDstOptimal) {
-        barrier.srcAccessMask = vk::AccessFlagBits::eShaderRead;
-        barrier.dstAccessMask = vk::AccessFlagBits::eTransferWrite;
+    const uint32_t page = drawable.uniform.page;
+    assert(drawable.imageView);
 
-        srcStage = vk::PipelineStageFlagBits::eFragmentShader;
-        dstStage = vk::PipelineStageFlagBits::eTransfer;
-    } else {
-        printf("invalid image transition\n");
-        return;
+    vk::DescriptorSetAllocateInfo allocInfo(*mDescriptorPool, 1, &*drawable.pipeline->descriptorSetLayout);
+    std::vector<vk::UniqueDescriptorSet> sets;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        sets = device->allocateDescriptorSetsUnique(allocInfo);
+    }
+    if (sets.empty() || !sets[0]) {
+        printf("failed to allocate descriptor set\n");
+        return false;
     }
 
-    vk::CommandBuffer commandBuffer = beginSingleCommand();
-    commandBuffer.pipelineBarrier(srcStage, dstStage, {}, {}, {}, { barrier });
-    endSingleCommand(commandBuffer);
+    // the range is one slot, the dynamic offset picks the swapchain image's region and the slot in it
+    vk::DescriptorBufferInfo bufferInfo(mUniforms->buffer(page), 0, drawable.uniformSize);
+    vk::WriteDescriptorSet bufferDescriptorWrite(*sets[0], 0, 0, 1, vk::DescriptorType::eUniformBufferDynamic, {}, &bufferInfo);
+    vk::DescriptorImageInfo imageInfo(drawable.imageSampler, drawable.imageView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::WriteDescriptorSet imageDescriptorWrite(*sets[0], 1, 0, 1, vk::DescriptorType::eCombinedImageSampler, &imageInfo, {});
+    device->updateDescriptorSets({ bufferDescriptorWrite, imageDescriptorWrite }, {});
+    drawable.descriptorSet = *sets[0];
+    drawable.ownDescriptorSet = std::move(sets[0]);
+    return true;
 }
 
-void Render::copyBufferToImage(const vk::UniqueBuffer& buffer, const vk::UniqueImage& image, uint32_t width, uint32_t height) const
+std::shared_ptr<Render::Node::Drawable> Render::makeColorDrawable(const Color& color, const Rect& geom)
 {
-    vk::CommandBuffer commandBuffer = beginSingleCommand();
-
-    vk::BufferImageCopy region({}, 0, 0, { vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, {}, { width, height, 1 });
-    commandBuffer.copyBufferToImage(*buffer, *image, vk::ImageLayout::eTransferDstOptimal, { region });
+    assert(mDrawableData.size() > DrawableColor);
+    const auto& drawableData = mDrawableData[DrawableColor];
 
-    endSingleCommand(commandBuffer);
-}
+    auto colorDrawable = makeDrawable<RenderColorDrawable>();
+    colorDrawable->pipeline = drawableData.pipeline;
+    colorDrawable->changed = std::vector<bool>(mWindow.swapChainFramebuffers().size(), true);
 
-void Render::copyBufferToImage(vk::DeviceSize bufferOffset, uint32_t bufferRowLength, uint32_t bufferImageHeight, const vk::UniqueBuffer& buffer,
-                               const vk::UniqueImage& image, int32_t x, int32_t y, uint32_t width, uint32_t height) const
-{
-    vk::CommandBuffer commandBuffer = beginSingleCommand();
+    const float width = static_cast<float>(mWindow.width());
+    const float height = static_cast<float>(mWindow.height());
 
-    vk::BufferImageCopy region(bufferOffset, bufferRowLength, bufferImageHeight, { vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, { x, y, 0 }, { width, height, 1 });
-    commandBuffer.copyBufferToImage(*buffer, *image, vk::ImageLayout::eTransferDstOptimal, { region });
+    colorDrawable->data.color = { color.r, color.g, color.b, color.a };
+    colorDrawable->data.geometry = screenGeometry(geom, width, height);
+    colorDrawable->bounds = geom;
+    colorDrawable->opaque = color.a >= 1.f;
+    //printf("ball %f %f %f %f\n", colorDrawable->data.geometry[0], colorDrawable->data.geometry[1], colorDrawable->data.geometry[2], colorDrawable->data.geometry[3]);
 
-    endSingleCommand(commandBuffer);
+    return colorDrawable;
 }
 
 std::shared_ptr<Render::Node::Drawable> Render::makeImageDrawable(const Scene::ImageData& image, const Rect& geom)
 {
     const auto& device = mWindow.device();
-    const auto& swapChainFramebuffers = mWindow.swapChainFramebuffers();
 
-    auto imageDrawable = std::make_shared<RenderImageDrawable>();
+    auto imageDrawable = makeDrawable<RenderImageDrawable>();
 
     vk::Format vkFormat = vk::Format::eUndefined;
     int bpp = 0;
@@ -551,31 +564,17 @@ std::shared_ptr<Render::Node::Drawable> Render::makeImageDrawable(const Scene::I
     // allocate image
     vk::ImageCreateInfo imageCreateInfo({}, vk::ImageType::e2D, vkFormat, { image.image->width, image.image->height, 1 }, 1, 1);
     imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+    mUploads->share(imageCreateInfo);
     vk::UniqueImage textureImage = device->createImageUnique(imageCreateInfo);
     if (!textureImage) {
         printf("failed to create texture image\n");
         return {};
     }
-    const vk::MemoryRequirements memRequirements = device->getImageMemoryRequirements(*textureImage);
-    vk::MemoryAllocateInfo memoryAllocInfo(memRequirements.size, findMemoryType(memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal));
-    vk::UniqueDeviceMemory textureImageMemory = device->allocateMemoryUnique(memoryAllocInfo);
+    auto textureImageMemory = mAllocator->allocate(*textureImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
     if (!textureImageMemory) {
         printf("failed to allocate texture image memory\n");
         return {};
     }
-    device->bindImageMemory(*textureImage, *textureImageMemory, 0);
-
-    vk::DeviceSize imageSize = image.image->width * image.image->height * bpp;
-    assert(imageSize == image.image->data.size());
-    auto staging = createBuffer(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-    void* data = device->mapMemory(*staging.memory, 0, imageSize, {});
-    memcpy(data, image.image->data.data(), imageSize);
-    device->unmapMemory(*staging.memory);
-
-    transitionImageLayout(textureImage, vkFormat, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-    copyBufferToImage(staging.buffer, textureImage, image.image->width, image.image->height);
-    transitionImageLayout(textureImage, vkFormat, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
 
     vk::ImageViewCreateInfo imageViewCreateInfo({}, *textureImage, vk::ImageViewType::e2D, vkFormat, {},
                                                 { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
@@ -585,78 +584,40 @@ std::shared_ptr<Render::Node::Drawable> Render::makeImageDrawable(const Scene::I
         return {};
     }
 
-    vk::SamplerCreateInfo samplerCreateInfo({}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear);
-    samplerCreateInfo.anisotropyEnable = VK_TRUE;
-    samplerCreateInfo.maxAnisotropy = 16.f;
-    samplerCreateInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
-    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerCreateInfo.compareEnable = VK_FALSE;
-    samplerCreateInfo.compareOp = vk::CompareOp::eAlways;
-    samplerCreateInfo.mipLodBias = 0.f;
-    samplerCreateInfo.minLod = 0.f;
-    samplerCreateInfo.maxLod = 0.f;
-    vk::UniqueSampler textureImageSampler = device->createSamplerUnique(samplerCreateInfo);
-    if (!textureImageSampler) {
-        printf("failed to create texture image sampler\n");
+    // the same for every image
+    const vk::Sampler textureImageSampler = mSamplers->get();
+    if (!textureImageSampler)
         return {};
-    }
 
     imageDrawable->imageMemory = std::move(textureImageMemory);
     imageDrawable->image = std::move(textureImage);
-    imageDrawable->imageView = std::move(textureImageView);
-    imageDrawable->imageSampler = std::move(textureImageSampler);
+    imageDrawable->ownImageView = std::move(textureImageView);
+    imageDrawable->imageView = *imageDrawable->ownImageView;
+    imageDrawable->imageSampler = textureImageSampler;
 
     assert(mDrawableData.size() > DrawableImage);
     const auto& drawableData = mDrawableData[DrawableImage];
 
-    const auto& pipeline = drawableData.pipeline;
-
-    // make ubos
-    vk::DeviceSize colorSize = sizeof(RenderColorData);
-    imageDrawable->ubos.reserve(swapChainFramebuffers.size());
-    imageDrawable->ubosMemory.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        auto ubo = createBuffer(colorSize,
-                                vk::BufferUsageFlagBits::eUniformBuffer,
-                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        imageDrawable->ubos.push_back(std::move(ubo.buffer));
-        imageDrawable->ubosMemory.push_back(std::move(ubo.memory));
-    }
-
-    // allocate descriptor sets
-    std::vector<vk::DescriptorSetLayout> layouts(swapChainFramebuffers.size(), *pipeline->descriptorSetLayout);
-    vk::DescriptorSetAllocateInfo descriptorAllocInfo(*mDescriptorPool, swapChainFramebuffers.size(), layouts.data());
-    auto sets = device->allocateDescriptorSetsUnique(descriptorAllocInfo);
-    imageDrawable->descriptorSets.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        vk::DescriptorBufferInfo bufferInfo(*imageDrawable->ubos[i], 0, sizeof(RenderColorData));
-        vk::DescriptorImageInfo imageInfo(*imageDrawable->imageSampler, *imageDrawable->imageView, vk::ImageLayout::eShaderReadOnlyOptimal);
-        vk::WriteDescriptorSet bufferDescriptorWrite(*sets[i], 0, 0, 1, vk::DescriptorType::eUniformBuffer, {}, &bufferInfo);
-        vk::WriteDescriptorSet imageDescriptorWrite(*sets[i], 1, 0, 1, vk::DescriptorType::eCombinedImageSampler, &imageInfo, {});
-        device->updateDescriptorSets({ bufferDescriptorWrite, imageDescriptorWrite }, {});
-
-        imageDrawable->descriptorSets.push_back(std::move(sets[i]));
+    // drawn in batches out of the texture table unless it's full
+    if (drawableData.batchPipeline) {
+        imageDrawable->texture = mTextures->add(imageDrawable->imageView, imageDrawable->imageSampler);
     }
-
-    vk::CommandBufferAllocateInfo allocCommandBufferInfo(*mCommandPool, vk::CommandBufferLevel::eSecondary, swapChainFramebuffers.size());
-    auto commandBuffers = device->allocateCommandBuffersUnique(allocCommandBufferInfo);
-    if (commandBuffers.empty()) {
-        printf("failed to allocate command buffers!\n");
-        std::shared_ptr<Render::Node::Drawable>();
+    if (imageDrawable->texture != TextureTable::Invalid) {
+        imageDrawable->textures = mTextures.get();
+        imageDrawable->pipeline = drawableData.batchPipeline;
+    } else {
+        imageDrawable->pipeline = drawableData.pipeline;
+        if (!makeUniform(*imageDrawable))
+            return {};
     }
 
-    imageDrawable->commandBuffers.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-        vk::CommandBufferBeginInfo beginInfo;
-        commandBuffers[i]->begin(beginInfo);
-
-        commandBuffers[i]->bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipeline);
-        commandBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline->layout, 0, { *imageDrawable->descriptorSets[i] }, {});
-        commandBuffers[i]->draw(4, 1, 0, 0);
-
-        commandBuffers[i]->end();
-
-        imageDrawable->commandBuffers.push_back(std::move(commandBuffers[i]));
+    // last, once nothing can fail and destroy the image while its copy is queued
+    assert(image.image->width * image.image->height * bpp == image.image->data.size());
+    // in eShaderReadOnlyOptimal by the time a frame draws it
+    if (!mUploads->upload(*imageDrawable->image, vk::ImageLayout::eUndefined, 0, 0, image.image->width, image.image->height,
+                          image.image->data.data(), image.image->width, bpp)) {
+        printf("failed to upload texture image\n");
+        return {};
     }
 
     imageDrawable->changed = std::vector<bool>(mWindow.swapChainFramebuffers().size(), true);
@@ -664,195 +625,837 @@ std::shared_ptr<Render::Node::Drawable> Render::makeImageDrawable(const Scene::I
     const float width = static_cast<float>(mWindow.width());
     const float height = static_cast<float>(mWindow.height());
 
-    imageDrawable->data.geometry = { mixScreen(geom.x, width), mixScreen(geom.y, height), mixScreen(geom.x + geom.width, width), mixScreen(geom.y + geom.height, height) };
+    imageDrawable->data.geometry = screenGeometry(geom, width, height);
+    // stretched over all of geom
+    imageDrawable->bounds = geom;
+    imageDrawable->opaque = !image.image->alpha;
 
     return imageDrawable;
 }
 
 std::shared_ptr<Render::Node::Drawable> Render::makeTextDrawable(const Text& text, const Rect& geometry)
 {
-    const auto& device = mWindow.device();
-    const auto& swapChainFramebuffers = mWindow.swapChainFramebuffers();
-
-    auto textDrawable = std::make_shared<RenderTextDrawable>();
+    auto textDrawable = makeDrawable<RenderTextDrawable>();
 
     uint32_t vertexCount;
     const auto renderData = mRenderText->renderText(text, geometry, vertexCount);
-    const vk::UniqueImageView& imageView = mRenderText->imageView();
+    // the glyph atlas, shared by all text
+    const vk::ImageView imageView = mRenderText->imageView();
     if (!imageView) {
         printf("failed to get image view\n");
         return {};
     }
-
-    vk::SamplerCreateInfo samplerCreateInfo({}, vk::Filter::eLinear, vk::Filter::eLinear, vk::SamplerMipmapMode::eLinear);
-    samplerCreateInfo.anisotropyEnable = VK_TRUE;
-    samplerCreateInfo.maxAnisotropy = 16.f;
-    samplerCreateInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
-    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
-    samplerCreateInfo.compareEnable = VK_FALSE;
-    samplerCreateInfo.compareOp = vk::CompareOp::eAlways;
-    samplerCreateInfo.mipLodBias = 0.f;
-    samplerCreateInfo.minLod = 0.f;
-    samplerCreateInfo.maxLod = 0.f;
-    vk::UniqueSampler imageSampler = device->createSamplerUnique(samplerCreateInfo);
-    if (!imageSampler) {
-        printf("failed to create texture image sampler\n");
+    const vk::Sampler imageSampler = mSamplers->get();
+    if (!imageSampler)
         return {};
-    }
 
-    textDrawable->imageSampler = std::move(imageSampler);
-    textDrawable->imageView = mRenderText->imageView();
+    textDrawable->imageSampler = imageSampler;
+    textDrawable->imageView = imageView;
 
     assert(mDrawableData.size() > DrawableText);
     const auto& drawableData = mDrawableData[DrawableText];
 
-    const auto& pipeline = drawableData.pipeline;
+    textDrawable->pipeline = drawableData.pipeline;
+    if (!makeUniform(*textDrawable))
+        return {};
+    textDrawable->vertices = renderData.buffer;
+    textDrawable->vertexCount = vertexCount;
 
-    // make ubos
-    vk::DeviceSize colorSize = sizeof(RenderColorData);
-    textDrawable->ubos.reserve(swapChainFramebuffers.size());
-    textDrawable->ubosMemory.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        auto ubo = createBuffer(colorSize,
-                                vk::BufferUsageFlagBits::eUniformBuffer,
-                                vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-        textDrawable->ubos.push_back(std::move(ubo.buffer));
-        textDrawable->ubosMemory.push_back(std::move(ubo.memory));
-    }
+    textDrawable->changed = std::vector<bool>(mWindow.swapChainFramebuffers().size(), true);
 
-    // allocate descriptor sets
-    std::vector<vk::DescriptorSetLayout> layouts(swapChainFramebuffers.size(), *pipeline->descriptorSetLayout);
-    vk::DescriptorSetAllocateInfo descriptorAllocInfo(*mDescriptorPool, swapChainFramebuffers.size(), layouts.data());
-    auto sets = device->allocateDescriptorSetsUnique(descriptorAllocInfo);
-    textDrawable->descriptorSets.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < swapChainFramebuffers.size(); ++i) {
-        vk::DescriptorBufferInfo bufferInfo(*textDrawable->ubos[i], 0, sizeof(RenderColorData));
-        vk::DescriptorImageInfo imageInfo(*textDrawable->imageSampler, *textDrawable->imageView, vk::ImageLayout::eShaderReadOnlyOptimal);
-        vk::WriteDescriptorSet bufferDescriptorWrite(*sets[i], 0, 0, 1, vk::DescriptorType::eUniformBuffer, {}, &bufferInfo);
-        vk::WriteDescriptorSet imageDescriptorWrite(*sets[i], 1, 0, 1, vk::DescriptorType::eCombinedImageSampler, &imageInfo, {});
-        device->updateDescriptorSets({ bufferDescriptorWrite, imageDescriptorWrite }, {});
+    textDrawable->data.projection = textProjection(text, geometry, mRenderText->renderSize(), mWindow.width(), mWindow.height());
+    textDrawable->data.color = { text.color.r, text.color.g, text.color.b, text.color.a };
+    textDrawable->layoutWidth = geometry.width;
+    const float factor = text.size / static_cast<float>(mRenderText->renderSize());
+    textDrawable->renderedWidth = renderData.geometry.width * factor;
+    textDrawable->renderedHeight = renderData.geometry.height * factor;
+    textDrawable->bounds = textBounds(text, geometry, textDrawable->renderedWidth, textDrawable->renderedHeight);
 
-        textDrawable->descriptorSets.push_back(std::move(sets[i]));
-    }
+    return textDrawable;
+}
 
-    vk::CommandBufferAllocateInfo allocCommandBufferInfo(*mCommandPool, vk::CommandBufferLevel::eSecondary, swapChainFramebuffers.size());
-    auto commandBuffers = device->allocateCommandBuffersUnique(allocCommandBufferInfo);
-    if (commandBuffers.empty()) {
-        printf("failed to allocate command buffers!\n");
-        std::shared_ptr<Render::Node::Drawable>();
+std::shared_ptr<Render::Node::Drawable> Render::makeItemDrawable(const Scene::Item& item, DrawableType type)
+{
+    if (!item.geometry.isValid())
+        return {};
+    switch (type) {
+    case DrawableColor:
+        if (item.color.isValid())
+            return makeColorDrawable(item.color, item.geometry);
+        break;
+    case DrawableImage:
+        if (item.image.image)
+            return makeImageDrawable(item.image, item.geometry);
+        break;
+    case DrawableText:
+        if (!item.text.contents.empty() && item.text.size > 0)
+            return makeTextDrawable(item.text, item.geometry);
+        break;
     }
+    return {};
+}
 
-    textDrawable->commandBuffers.reserve(swapChainFramebuffers.size());
-    for (size_t i = 0; i < commandBuffers.size(); i++) {
-        vk::CommandBufferBeginInfo beginInfo;
-        commandBuffers[i]->begin(beginInfo);
-
-        commandBuffers[i]->bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline->pipeline);
-        commandBuffers[i]->bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline->layout, 0, { *textDrawable->descriptorSets[i] }, {});
-        commandBuffers[i]->bindVertexBuffers(0, { renderData.buffer }, { 0 });
-        commandBuffers[i]->draw(vertexCount, 1, 0, 0);
-        //commandBuffers[i]->draw(6, 1, 0, 0);
+void Render::makeDrawables(const Scene::Item& item, std::vector<std::shared_ptr<Node::Drawable> >& drawables)
+{
+    drawables.clear();
+    for (DrawableType type : { DrawableColor, DrawableImage, DrawableText }) {
+        if (auto drawable = makeItemDrawable(item, type)) {
+            drawables.push_back(std::move(drawable));
+        }
+    }
+}
 
-        commandBuffers[i]->end();
+void Render::makeDrawables(const Scene::Item& item, Node& node)
+{
+    makeDrawables(item, node.drawables);
+}
 
-        textDrawable->commandBuffers.push_back(std::move(commandBuffers[i]));
+void Render::makeDrawables(size_t count, const std::function<Node*(size_t)>& node,
+                           const std::function<std::shared_ptr<Node::Drawable>(size_t, DrawableType)>& make)
+{
+    // images are most of the work, creating them and copying their pixels into the upload queue's staging
+    // ring, the uploads go out in one batch before the next frame
+    std::vector<std::array<std::shared_ptr<Node::Drawable>, 2> > made(count);
+    mJobs->run(count, [&made, &make](size_t i) {
+        made[i][0] = make(i, DrawableColor);
+        made[i][1] = make(i, DrawableImage);
+    });
+
+    // painter's order within the node, text goes last
+    for (size_t i = 0; i < count; ++i) {
+        auto& drawables = node(i)->drawables;
+        drawables.clear();
+        for (auto& drawable : made[i]) {
+            if (drawable) {
+                drawables.push_back(std::move(drawable));
+            }
+        }
+        if (auto text = make(i, DrawableText)) {
+            drawables.push_back(std::move(text));
+        }
     }
+}
 
-    textDrawable->changed = std::vector<bool>(mWindow.swapChainFramebuffers().size(), true);
+void Render::makeDrawables(const PendingItems& pending)
+{
+    makeDrawables(pending.size(), [&pending](size_t i) { return pending[i].first; },
+                  [this, &pending](size_t i, DrawableType type) { return makeItemDrawable(*pending[i].second, type); });
+}
 
-    const float factor = text.size / static_cast<float>(mRenderText->renderSize());
-    const float tx = mix(geometry.x, mWindow.width(), -1.0f, 1.0f);
-    const float ty = mix(geometry.y, mWindow.height(), -1.0f, 1.0f);
+static inline std::array<float, 2> instanceOffset(const Rect& geometry, float width, float height)
+{
+    // clip space is 2 units across
+    return { geometry.x * 2.f / width, geometry.y * 2.f / height };
+}
 
-    glm::mat4 projection = glm::mat4(1.0f);
-    projection = glm::scale(projection, glm::vec3(factor, factor, 1.0f));
-    projection = glm::translate(projection, glm::vec3(1.0f + (tx / factor), 1.0f + (ty / factor), 0.0f));
+void Render::makeInstance(const Scene::Item& item, Node& node)
+{
+    node.instance.reset();
+    if (!item.instance)
+        return;
 
-    textDrawable->data.projection = projection;
-    textDrawable->data.color = { text.color.r, text.color.g, text.color.b, text.color.a };
+    const auto& tmpl = item.instance->tmpl;
+    auto instance = std::make_unique<Node::Instance>();
+    auto& cached = mTemplates[tmpl.get()];
+    instance->shared = cached.lock();
+    if (!instance->shared) {
+        instance->shared = std::make_shared<TemplateDrawables>();
+        instance->shared->tmpl = tmpl;
+        instance->shared->items.resize(tmpl->items.size());
+        for (size_t i = 0; i < tmpl->items.size(); ++i) {
+            makeDrawables(*tmpl->items[i], instance->shared->items[i]);
+        }
+        cached = instance->shared;
+    }
 
-    return textDrawable;
+    // only overridden items cost anything per instance
+    for (const auto& override : item.instance->overrides) {
+        const auto& original = *tmpl->items[override.item];
+        Scene::Item overridden;
+        overridden.color = original.color;
+        overridden.geometry = original.geometry;
+        overridden.text = original.text;
+        overridden.image = original.image;
+        overridden.backgroundImage = original.backgroundImage;
+        if (override.hasText)
+            overridden.text.contents = override.text;
+        if (override.hasImage)
+            overridden.image = override.image;
+        instance->overrides.emplace_back(override.item, std::vector<std::shared_ptr<Node::Drawable> >());
+        makeDrawables(overridden, instance->overrides.back().second);
+    }
+
+    instance->offset = instanceOffset(item.geometry, mWindow.width(), mWindow.height());
+    node.instance = std::move(instance);
 }
 
 void Render::traverseSceneItem(const std::shared_ptr<Scene::Item>& sceneItem,
-                               std::shared_ptr<Node>& renderNode)
+                               std::shared_ptr<Node>& renderNode, PendingItems& pending)
 {
     if (!sceneItem)
         return;
     assert(!renderNode);
     renderNode = std::make_shared<Node>();
-    if (sceneItem->geometry.isValid()) {
-        if (sceneItem->color.isValid()) {
-            renderNode->drawables.push_back(makeColorDrawable(sceneItem->color, sceneItem->geometry));
-        }
-        if (sceneItem->image.image) {
-            renderNode->drawables.push_back(makeImageDrawable(sceneItem->image, sceneItem->geometry));
-        }
-        if (!sceneItem->text.contents.empty() && sceneItem->text.size > 0) {
-            renderNode->drawables.push_back(makeTextDrawable(sceneItem->text, sceneItem->geometry));
-        }
-    }
+    mNodes[sceneItem.get()] = renderNode;
+    pending.emplace_back(renderNode.get(), sceneItem.get());
+    makeInstance(*sceneItem, *renderNode);
 
     if (!sceneItem->children.empty()) {
         renderNode->children.resize(sceneItem->children.size());
         for (size_t i = 0; i < sceneItem->children.size(); ++i) {
-            traverseSceneItem(sceneItem->children[i], renderNode->children[i]);
+            traverseSceneItem(sceneItem->children[i], renderNode->children[i], pending);
         }
     }
 }
 
 void Render::makeRenderTree(const Scene& scene)
 {
-    traverseSceneItem(scene.root, mRoot);
+    // the tree first, then the drawables of all of it at once
+    PendingItems pending;
+    traverseSceneItem(scene.root, mRoot, pending);
+    makeDrawables(pending);
+    mIndex.build(scene);
 }
 
-void Render::renderNode(const std::shared_ptr<Node>& node, const vk::CommandBuffer& commandBuffer, uint32_t imageIndex)
+void Render::updateDrawables(const Scene::Item& item, Node& node, uint32_t flags)
 {
-    if (!node)
+    std::shared_ptr<Node::Drawable>* current[3] = { nullptr, nullptr, nullptr };
+    for (auto& drawable : node.drawables) {
+        current[drawable->type] = &drawable;
+    }
+
+    // anything that comes or goes makes a new set of drawables, painter's order within the node needs to hold
+    const bool valid = item.geometry.isValid();
+    const bool wanted[3] = {
+        valid && item.color.isValid(),
+        valid && item.image.image,
+        valid && !item.text.contents.empty() && item.text.size > 0
+    };
+    for (int type = 0; type < 3; ++type) {
+        if (wanted[type] != (current[type] != nullptr)) {
+            makeDrawables(item, node);
+            return;
+        }
+    }
+
+    const float width = static_cast<float>(mWindow.width());
+    const float height = static_cast<float>(mWindow.height());
+
+    if (current[DrawableColor] && (flags & (Scene::Change::Geometry | Scene::Change::Color))) {
+        auto color = std::static_pointer_cast<RenderColorDrawable>(*current[DrawableColor]);
+        color->data.color = { item.color.r, item.color.g, item.color.b, item.color.a };
+        color->data.geometry = screenGeometry(item.geometry, width, height);
+        color->bounds = item.geometry;
+        color->opaque = item.color.a >= 1.f;
+        color->markChanged();
+    }
+
+    if (current[DrawableImage]) {
+        if (flags & Scene::Change::Image) {
+            if (auto drawable = makeImageDrawable(item.image, item.geometry)) {
+                *current[DrawableImage] = std::move(drawable);
+            }
+        } else if (flags & Scene::Change::Geometry) {
+            auto image = std::static_pointer_cast<RenderImageDrawable>(*current[DrawableImage]);
+            image->data.geometry = screenGeometry(item.geometry, width, height);
+            image->bounds = item.geometry;
+            image->markChanged();
+        }
+    }
+
+    if (current[DrawableText]) {
+        auto text = std::static_pointer_cast<RenderTextDrawable>(*current[DrawableText]);
+        if ((flags & Scene::Change::Text) || text->layoutWidth != item.geometry.width) {
+            // needs a new layout
+            if (auto drawable = makeTextDrawable(item.text, item.geometry)) {
+                *current[DrawableText] = std::move(drawable);
+            }
+        } else if (flags & (Scene::Change::Geometry | Scene::Change::TextColor)) {
+            text->data.projection = textProjection(item.text, item.geometry, mRenderText->renderSize(), width, height);
+            text->data.color = { item.text.color.r, item.text.color.g, item.text.color.b, item.text.color.a };
+            text->bounds = textBounds(item.text, item.geometry, text->renderedWidth, text->renderedHeight);
+            text->markChanged();
+        }
+    }
+}
+
+void Render::forgetSceneItem(const Scene::Item& item)
+{
+    const auto it = mNodes.find(&item);
+    if (it != mNodes.end()) {
+        addDamage(*it->second);
+        mNodes.erase(it);
+    }
+    for (const auto& child : item.children) {
+        forgetSceneItem(*child);
+    }
+}
+
+void Render::applyChanges(const std::vector<Scene::Change>& changes)
+{
+    if (changes.empty())
+        return;
+    for (auto& frame : mImageFrames) {
+        frame.changed = true;
+    }
+
+    // whether what moves was in the draw list, it's collected again for anything that comes into
+    // or goes out of the window
+    const Rect viewport { 0.f, 0.f, static_cast<float>(mWindow.width()), static_cast<float>(mWindow.height()) };
+    mWasVisible.resize(changes.size());
+    for (size_t i = 0; i < changes.size(); ++i) {
+        mWasVisible[i] = (changes[i].flags & Scene::Change::Geometry) && mIndex.overlaps(changes[i].item.get(), viewport);
+    }
+
+    Rect damage;
+    mIndex.applyChanges(changes, &damage);
+    addDamage(damage);
+
+    // removed items go first, an item can be removed in one place and
+    // inserted in another by the same patch in which case it's rebuilt
+    for (const auto& change : changes) {
+        for (const auto& removed : change.removed) {
+            forgetSceneItem(*removed);
+            mDrawListDirty = true;
+        }
+    }
+
+    // what the draw list and the culling of it go by
+    struct Culled
+    {
+        uint64_t id;
+        Rect bounds;
+        bool opaque;
+    };
+    std::array<Culled, 3> before;
+
+    for (size_t c = 0; c < changes.size(); ++c) {
+        const auto& change = changes[c];
+        const auto it = mNodes.find(change.item.get());
+        if (it == mNodes.end()) {
+            mDrawListDirty = true;
+            continue;
+        }
+        const auto node = it->second;
+        const auto& item = *change.item;
+        // where the node's drawables were, text draws outside of the item's geometry
+        addDamage(*node);
+
+        // geometry and colors are written to the drawables in place, like for animations. the draw list
+        // is only collected again when drawables come or go, or when culling may come out different
+        const uint32_t inPlace = Scene::Change::Geometry | Scene::Change::Color | Scene::Change::TextColor;
+        bool sameDraws = !(change.flags & ~inPlace) && !(node->instance && (change.flags & Scene::Change::Geometry))
+            && node->drawables.size() <= before.size();
+        if (sameDraws) {
+            for (size_t i = 0; i < node->drawables.size(); ++i) {
+                const auto& drawable = *node->drawables[i];
+                before[i] = { drawable.id, drawable.bounds, drawable.opaque };
+            }
+        }
+        const size_t count = node->drawables.size();
+
+        if (change.flags & Scene::Change::Children) {
+            // kept children that moved here or among their siblings are painted in a different order,
+            // they're the ones that now come after a different node
+            std::unordered_map<const Node*, const Node*> previous;
+            for (size_t i = 0; i < node->children.size(); ++i) {
+                previous[node->children[i].get()] = i > 0 ? node->children[i - 1].get() : nullptr;
+            }
+            std::vector<std::shared_ptr<Node> > children(item.children.size());
+            PendingItems pending;
+            for (size_t i = 0; i < item.children.size(); ++i) {
+                const auto child = mNodes.find(item.children[i].get());
+                if (child != mNodes.end()) {
+                    children[i] = child->second;
+                    const auto was = previous.find(children[i].get());
+                    if (was == previous.end() || was->second != (i > 0 ? children[i - 1].get() : nullptr)) {
+                        addTreeDamage(*children[i]);
+                    }
+                } else {
+                    traverseSceneItem(item.children[i], children[i], pending);
+                }
+            }
+            makeDrawables(pending);
+            for (const auto& added : pending) {
+                addDamage(*added.first);
+            }
+            node->children = std::move(children);
+        }
+
+        if (change.flags & Scene::Change::Instance) {
+            makeInstance(item, *node);
+        } else if ((change.flags & Scene::Change::Geometry) && node->instance) {
+            // moving an instance doesn't touch any of its drawables
+            node->instance->offset = instanceOffset(item.geometry, mWindow.width(), mWindow.height());
+        }
+
+        if (change.flags & ~(Scene::Change::Children | Scene::Change::Instance)) {
+            updateDrawables(item, *node, change.flags);
+        }
+        // and where they are now
+        addDamage(*node);
+
+        if (sameDraws && node->drawables.size() == count) {
+            for (size_t i = 0; i < count && sameDraws; ++i) {
+                const auto& drawable = *node->drawables[i];
+                const Culled& was = before[i];
+                const bool moved = was.bounds.x != drawable.bounds.x || was.bounds.y != drawable.bounds.y
+                    || was.bounds.width != drawable.bounds.width || was.bounds.height != drawable.bounds.height;
+                // an opaque one hides others, anything under an occluder of the last cull may be hidden
+                // there or stop being so. what moves otherwise stays in the list at the same place
+                sameDraws = was.id == drawable.id && was.opaque == drawable.opaque
+                    && (!moved || (!drawable.opaque && !occluded(was.bounds) && !occluded(drawable.bounds)));
+            }
+            if (sameDraws && (change.flags & Scene::Change::Geometry) && !mIndex.empty()) {
+                sameDraws = mWasVisible[c] == mIndex.overlaps(change.item.get(), viewport);
+            }
+        } else {
+            sameDraws = false;
+        }
+        if (!sameDraws) {
+            mDrawListDirty = true;
+        }
+    }
+}
+
+void Render::collectDrawables(const Node& node)
+{
+    for (const auto& drawable : node.drawables) {
+        mDrawList.push_back({ drawable.get(), drawable->id, { 0.f, 0.f }, 0 });
+    }
+
+    if (!node.instance)
         return;
 
-    for (const auto& drawable : node->drawables) {
-        drawable->update(mWindow.device(), imageIndex);
-        commandBuffer.executeCommands({ *drawable->commandBuffers[imageIndex] });
+    // the template's items in pre-order, overridden ones swapped for the instance's own
+    const auto& instance = *node.instance;
+    const auto& items = instance.shared->items;
+    auto override = instance.overrides.begin();
+    for (uint32_t i = 0; i < items.size(); ++i) {
+        const auto* drawables = &items[i];
+        if (override != instance.overrides.end() && override->first == i) {
+            drawables = &override->second;
+            ++override;
+        }
+        for (const auto& drawable : *drawables) {
+            mDrawList.push_back({ drawable.get(), drawable->id, instance.offset, 0 });
+        }
     }
+}
+
+void Render::collectNode(const std::shared_ptr<Node>& node)
+{
+    if (!node)
+        return;
+
+    collectDrawables(*node);
 
     for (const auto& child : node->children) {
-        renderNode(child, commandBuffer, imageIndex);
+        collectNode(child);
     }
 }
 
-void Render::render(const Window::RenderData& data)
+void Render::collectVisible()
+{
+    // only what intersects the window, in painter's order
+    const Rect viewport { 0.f, 0.f, static_cast<float>(mWindow.width()), static_cast<float>(mWindow.height()) };
+    mIndex.query(viewport, mVisible);
+    for (const auto* item : mVisible) {
+        const auto node = mNodes.find(item);
+        if (node == mNodes.end())
+            continue;
+        collectDrawables(*node->second);
+    }
+}
+
+bool Render::occluded(const Rect& bounds) const
+{
+    return std::any_of(mOccluders.begin(), mOccluders.end(), [&bounds](const Rect& occluder) {
+        return occluder.x <= bounds.x && occluder.y <= bounds.y
+            && occluder.x + occluder.width >= bounds.x + bounds.width && occluder.y + occluder.height >= bounds.y + bounds.height;
+    });
+}
+
+void Render::cullOccluded()
+{
+    // front to back, anything inside of an opaque rect that's drawn after it can't be seen. only
+    // whole rects are compared rather than the union of them, which catches panels stacked on
+    // top of each other and backgrounds covered by what's in front
+    mOccluders.clear();
+    size_t kept = mDrawList.size();
+    for (size_t i = mDrawList.size(); i > 0; --i) {
+        const DrawEntry& entry = mDrawList[i - 1];
+        const Node::Drawable& drawable = *entry.drawable;
+        if (!drawable.bounds.isValid()) {
+            mDrawList[--kept] = entry;
+            continue;
+        }
+        const Rect bounds = drawableBounds(drawable, entry.offset);
+        if (occluded(bounds))
+            continue;
+        mDrawList[--kept] = entry;
+
+        if (!drawable.opaque)
+            continue;
+        // the largest ones hide the most
+        if (mOccluders.size() < RenderLimits::MaxOccluders) {
+            mOccluders.push_back(bounds);
+        } else {
+            auto smallest = std::min_element(mOccluders.begin(), mOccluders.end(), [](const Rect& a, const Rect& b) {
+                return a.width * a.height < b.width * b.height;
+            });
+            if (smallest->width * smallest->height < bounds.width * bounds.height) {
+                *smallest = bounds;
+            }
+        }
+    }
+    mDrawList.erase(mDrawList.begin(), mDrawList.begin() + kept);
+}
+
+void Render::rebuildDrawList()
+{
+    std::swap(mDrawList, mPreviousDrawList);
+    mDrawList.clear();
+    if (!mIndex.empty()) {
+        collectVisible();
+    } else {
+        collectNode(mRoot);
+    }
+    cullOccluded();
+
+    // ids rather than pointers, a drawable can be destroyed and another made at its address
+    const bool same = std::equal(mDrawList.begin(), mDrawList.end(), mPreviousDrawList.begin(), mPreviousDrawList.end(),
+                                 [](const DrawEntry& a, const DrawEntry& b) {
+                                     return a.id == b.id && a.offset == b.offset;
+                                 });
+    if (same) {
+        // keeps the instance offsets the recordings use
+        std::swap(mDrawList, mPreviousDrawList);
+    } else {
+        ++mDrawListVersion;
+    }
+    mPreviousDrawList.clear();
+}
+
+uint8_t* Render::reserveInstances(uint32_t imageIndex, vk::DeviceSize size)
+{
+    auto& frame = mImageFrames[imageIndex];
+    if (size > frame.capacity) {
+        // the last frame on this image is done, see Window::exec
+        vk::DeviceSize capacity = std::max<vk::DeviceSize>(frame.capacity * 2, 8192);
+        while (capacity < size) {
+            capacity *= 2;
+        }
+        frame.instances = createBuffer(capacity, vk::BufferUsageFlagBits::eVertexBuffer,
+                                       vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+        if (!frame.instances.buffer) {
+            printf("failed to allocate instance buffer\n");
+            frame.capacity = 0;
+            return nullptr;
+        }
+        frame.capacity = capacity;
+    }
+    return frame.instances.memory.mapped();
+}
+
+static inline vk::DeviceSize instanceSize(bool color)
+{
+    return color ? sizeof(RenderColorData) : RenderLimits::ImageInstanceSize;
+}
+
+void Render::writeInstance(const DrawEntry& entry, uint8_t* instances) const
 {
+    // the template instance offset goes into the geometry
+    const auto& offset = entry.offset;
+    const glm::vec4 translate(offset[0], offset[1], offset[0], offset[1]);
+    if (entry.drawable->type == DrawableColor) {
+        const auto& data = static_cast<const RenderColorDrawable*>(entry.drawable)->data;
+        const RenderColorData instance = { data.color, data.geometry + translate };
+        memcpy(instances + entry.instance, &instance, sizeof(instance));
+    } else {
+        const auto* image = static_cast<const RenderImageDrawable*>(entry.drawable);
+        const RenderImageInstance instance = { image->data.geometry + translate, image->texture };
+        memcpy(instances + entry.instance, &instance, RenderLimits::ImageInstanceSize);
+    }
+}
+
+void Render::recordDraws(const vk::CommandBuffer& commandBuffer, uint32_t imageIndex, const vk::Rect2D& area,
+                         uint8_t* instances, size_t begin, size_t end) const
+{
+    const std::array<float, 2> origin = { 0.f, 0.f };
+
+    // dynamic state isn't inherited by secondaries
     const auto& extent = mWindow.extent();
-    const auto& renderPass = mWindow.renderPass();
-    const auto& swapChainFramebuffers = mWindow.swapChainFramebuffers();
+    commandBuffer.setViewport(0, { vk::Viewport(0.f, 0.f, static_cast<float>(extent.width), static_cast<float>(extent.height), 0.f, 1.f) });
+    commandBuffer.setScissor(0, { area });
+
+    for (size_t i = begin; i < end;) {
+        const auto& entry = mDrawList[i];
+        if (!entry.drawable->isBatched()) {
+            entry.drawable->record(commandBuffer, imageIndex, entry.offset);
+            ++i;
+            continue;
+        }
+
+        // a run of batched drawables of one type is one instanced draw, instances are drawn in order
+        // so painter's order holds
+        const DrawableType type = entry.drawable->type;
+        const auto& pipeline = *entry.drawable->pipeline;
+        const vk::DeviceSize first = entry.instance;
+        uint32_t count = 0;
+        for (; i < end && mDrawList[i].drawable->type == type && mDrawList[i].drawable->isBatched(); ++i) {
+            if (!instances)
+                continue;
+            writeInstance(mDrawList[i], instances);
+            ++count;
+        }
+        if (count == 0)
+            continue;
+
+        commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, *pipeline.pipeline);
+        if (type == DrawableImage) {
+            commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, *pipeline.layout, 0, { mTextures->set() }, {});
+        }
+        commandBuffer.pushConstants(*pipeline.layout, vk::ShaderStageFlagBits::eVertex, 0, sizeof(origin), origin.data());
+        commandBuffer.bindVertexBuffers(0, { *mImageFrames[imageIndex].instances.buffer }, { first });
+        commandBuffer.draw(4, count, 0, 0);
+    }
+}
+
+void Render::recordDrawList(uint32_t imageIndex, const vk::Rect2D& area, bool load)
+{
     const auto& device = mWindow.device();
+    // the two are compatible, pipelines and secondaries work with either
+    const auto& renderPass = load ? mWindow.loadRenderPass() : mWindow.renderPass();
+    const vk::Framebuffer framebuffer = mWindow.swapChainFramebuffers()[imageIndex];
+    auto& frame = mImageFrames[imageIndex];
+
+    vk::DeviceSize size = 0;
+    for (auto& entry : mDrawList) {
+        if (entry.drawable->isBatched()) {
+            entry.instance = size;
+            size += instanceSize(entry.drawable->type == DrawableColor);
+        }
+    }
+    uint8_t* instances = size > 0 ? reserveInstances(imageIndex, size) : nullptr;
 
-    const auto& commandBuffer = beginSingleCommand();
+    const vk::CommandBuffer commandBuffer = *frame.commandBuffer;
+    commandBuffer.reset({});
+    commandBuffer.begin(vk::CommandBufferBeginInfo());
 
     vk::ClearValue clearValue = vk::ClearColorValue(std::array<float,4> { 0.0f, 0.0f, 0.0f, 1.0f });
-    vk::RenderPassBeginInfo renderPassInfo(*renderPass, swapChainFramebuffers[data.imageIndex], { { 0, 0 }, extent }, 1, &clearValue);
-
-    commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+    vk::RenderPassBeginInfo renderPassInfo(*renderPass, framebuffer, area, 1, &clearValue);
 
-    renderNode(mRoot, commandBuffer, data.imageIndex);
+    const size_t parts = mDrawList.size() / RenderLimits::DrawsPerCommandBuffer;
+    if (parts < 2 || mJobs->threadCount() < 2) {
+        commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eInline);
+        recordDraws(commandBuffer, imageIndex, area, instances, 0, mDrawList.size());
+    } else {
+        // the last frame on this image is done, so are the secondaries it executed
+        for (auto& secondaries : frame.secondaries) {
+            device->resetCommandPool(*secondaries.pool, {});
+            secondaries.used = 0;
+        }
 
+        // every part in a secondary of the thread that records it, executed in order
+        std::vector<vk::CommandBuffer> recorded(parts);
+        vk::CommandBufferInheritanceInfo inheritanceInfo(*renderPass, 0, framebuffer);
+        vk::CommandBufferBeginInfo beginInfo(vk::CommandBufferUsageFlagBits::eRenderPassContinue, &inheritanceInfo);
+        mJobs->run(parts, [&](size_t part) {
+            auto& secondaries = frame.secondaries[JobSystem::threadIndex()];
+            if (secondaries.used == secondaries.buffers.size()) {
+                vk::CommandBufferAllocateInfo allocInfo(*secondaries.pool, vk::CommandBufferLevel::eSecondary, 1);
+                const auto buffers = device->allocateCommandBuffers(allocInfo);
+                if (buffers.empty() || !buffers[0]) {
+                    printf("failed to allocate secondary command buffer\n");
+                    return;
+                }
+                secondaries.buffers.push_back(buffers[0]);
+            }
+            const vk::CommandBuffer secondary = secondaries.buffers[secondaries.used++];
+            const size_t begin = part * RenderLimits::DrawsPerCommandBuffer;
+            const size_t end = part + 1 < parts ? begin + RenderLimits::DrawsPerCommandBuffer : mDrawList.size();
+            secondary.begin(beginInfo);
+            recordDraws(secondary, imageIndex, area, instances, begin, end);
+            secondary.end();
+            recorded[part] = secondary;
+        });
+        recorded.erase(std::remove(recorded.begin(), recorded.end(), vk::CommandBuffer()), recorded.end());
+
+        commandBuffer.beginRenderPass(renderPassInfo, vk::SubpassContents::eSecondaryCommandBuffers);
+        if (!recorded.empty()) {
+            commandBuffer.executeCommands(recorded);
+        }
+    }
     commandBuffer.endRenderPass();
     commandBuffer.end();
 
-    vk::Semaphore waitSemaphores[] = { data.wait };
+    // on this thread, a template item's drawable is in the list once per instance
+    for (auto& entry : mDrawList) {
+        if (entry.drawable->isBatched()) {
+            entry.drawable->changed[imageIndex] = false;
+        } else {
+            entry.drawable->update(imageIndex);
+        }
+    }
+}
+
+void Render::updateDrawList(uint32_t imageIndex)
+{
+    // a template item's drawable is in the list once per instance, every one of them is written
+    // before the flags are cleared
+    uint8_t* instances = mImageFrames[imageIndex].instances.memory.mapped();
+    for (const auto& entry : mDrawList) {
+        if (instances && entry.drawable->isBatched() && entry.drawable->changed[imageIndex])
+            writeInstance(entry, instances);
+    }
+    for (auto& entry : mDrawList) {
+        if (entry.drawable->isBatched()) {
+            entry.drawable->changed[imageIndex] = false;
+        } else {
+            entry.drawable->update(imageIndex);
+        }
+    }
+}
+
+void Render::addDamage(const Rect& rect)
+{
+    // off screen changes don't need a frame
+    const float x0 = std::max(rect.x, 0.f);
+    const float y0 = std::max(rect.y, 0.f);
+    const float x1 = std::min(rect.x + rect.width, static_cast<float>(mWindow.width()));
+    const float y1 = std::min(rect.y + rect.height, static_cast<float>(mWindow.height()));
+    if (x1 <= x0 || y1 <= y0)
+        return;
+
+    const Rect visible { x0, y0, x1 - x0, y1 - y0 };
+    for (auto& frame : mImageFrames) {
+        if (frame.damage.isValid()) {
+            frame.damage.unite(visible);
+        } else {
+            frame.damage = visible;
+        }
+    }
+    mDamaged = true;
+}
+
+Rect Render::drawableBounds(const Node::Drawable& drawable, const std::array<float, 2>& offset) const
+{
+    // instance offsets are in clip space
+    Rect bounds = drawable.bounds;
+    bounds.x += offset[0] * mWindow.width() * 0.5f;
+    bounds.y += offset[1] * mWindow.height() * 0.5f;
+    return bounds;
+}
+
+void Render::addDamage(const Node& node)
+{
+    const std::array<float, 2> origin = { 0.f, 0.f };
+    for (const auto& drawable : node.drawables) {
+        addDamage(drawableBounds(*drawable, origin));
+    }
+    if (!node.instance)
+        return;
+
+    const auto& instance = *node.instance;
+    for (const auto& drawables : instance.shared->items) {
+        for (const auto& drawable : drawables) {
+            addDamage(drawableBounds(*drawable, instance.offset));
+        }
+    }
+    for (const auto& override : instance.overrides) {
+        for (const auto& drawable : override.second) {
+            addDamage(drawableBounds(*drawable, instance.offset));
+        }
+    }
+}
+
+void Render::addTreeDamage(const Node& node)
+{
+    addDamage(node);
+    for (const auto& child : node.children) {
+        if (child) {
+            addTreeDamage(*child);
+        }
+    }
+}
+
+void Render::render(const Window::RenderData& data)
+{
+    // before the garbage goes, the last draw list can point at it
+    if (mDrawListDirty) {
+        rebuildDrawList();
+        mDrawListDirty = false;
+    }
+    collectGarbage();
+
+    // what the drawables made since the last frame upload goes out before the frame
+    mUploads->collect(mFrameNumber);
+    mUploads->submit();
+
+    if (data.exposed) {
+        for (auto& frame : mImageFrames) {
+            frame.full = true;
+        }
+    }
+
+    // the last frame on this image is done, see Window::exec
+    auto& frame = mImageFrames[data.imageIndex];
+    const vk::CommandBuffer commandBuffer = *frame.commandBuffer;
+
+    // only what changed since the image was last drawn, unless that's most of it
+    const auto& extent = mWindow.extent();
+    vk::Rect2D area({ 0, 0 }, extent);
+    bool partial = false;
+    if (!frame.full && frame.damage.isValid()) {
+        // damage is in window coordinates, the scissor in framebuffer pixels
+        const float sx = static_cast<float>(extent.width) / mWindow.width();
+        const float sy = static_cast<float>(extent.height) / mWindow.height();
+        const auto& damage = frame.damage;
+        const int32_t x0 = std::max(static_cast<int32_t>(floorf(damage.x * sx)), 0);
+        const int32_t y0 = std::max(static_cast<int32_t>(floorf(damage.y * sy)), 0);
+        const int32_t x1 = std::min(static_cast<int32_t>(ceilf((damage.x + damage.width) * sx)), static_cast<int32_t>(extent.width));
+        const int32_t y1 = std::min(static_cast<int32_t>(ceilf((damage.y + damage.height) * sy)), static_cast<int32_t>(extent.height));
+        const float share = static_cast<float>(x1 - x0) * (y1 - y0) / (static_cast<float>(extent.width) * extent.height);
+        if (x1 > x0 && y1 > y0 && share <= RenderLimits::MaxDamageShare) {
+            area = vk::Rect2D({ x0, y0 }, { static_cast<uint32_t>(x1 - x0), static_cast<uint32_t>(y1 - y0) });
+            partial = true;
+        }
+    }
+
+    if (partial) {
+        // not replayed, the next frame on this image most likely has different damage
+        recordDrawList(data.imageIndex, area, true);
+        frame.drawListVersion = 0;
+    } else if (frame.drawListVersion != mDrawListVersion) {
+        recordDrawList(data.imageIndex, area, false);
+        frame.drawListVersion = mDrawListVersion;
+    } else if (frame.changed) {
+        // same draws as last time on this image, only the data they read changed
+        updateDrawList(data.imageIndex);
+    }
+    frame.changed = false;
+    frame.damage = Rect();
+    frame.full = false;
+    mDamaged = false;
+
+    // whatever was written to uniforms for this frame
+    mUniforms->flush(data.imageIndex);
+
+    std::vector<vk::Semaphore> waitSemaphores = { data.wait };
+    std::vector<vk::PipelineStageFlags> waitStages = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
+    // and on the transfer queue uploads of images the frame may draw
+    mUploads->takeWaits(mFrameNumber, waitSemaphores, waitStages);
     vk::Semaphore signalSemaphores[] = { data.signal };
-    vk::PipelineStageFlags waitStages[] = { vk::PipelineStageFlagBits::eColorAttachmentOutput };
 
     const auto& graphicsQueue = mWindow.graphicsQueue();
-    vk::SubmitInfo submitInfo(1, waitSemaphores, waitStages, 1, &commandBuffer, 1, signalSemaphores);
+    vk::SubmitInfo submitInfo(waitSemaphores.size(), waitSemaphores.data(), waitStages.data(), 1, &commandBuffer, 1, signalSemaphores);
 
     try {
         graphicsQueue.submit({ submitInfo }, data.fence);
-        graphicsQueue.waitIdle();
     } catch (const vk::Error& error) {
         printf("failed to submit draw command buffer\n");
     }
 
-    device->freeCommandBuffers(*mCommandPool, { commandBuffer });
+    ++mFrameNumber;
 }
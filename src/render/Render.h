@@ -2,35 +2,61 @@
 #define RENDER_H
 
 #include "RenderText.h"
+#include "UniformArena.h"
+#include "TextureTable.h"
+#include "MemoryAllocator.h"
+#include "PipelineCache.h"
+#include "UploadQueue.h"
+#include "SamplerCache.h"
 #include <scene/Scene.h>
+#include <scene/SpatialIndex.h>
 #include <Window.h>
+#include <JobSystem.h>
 #include <Buffer.h>
 #include <Rect.h>
 #include <memory>
+#include <array>
 #include <vector>
 #include <functional>
+#include <unordered_map>
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <atomic>
+
+class ShaderCache;
 
 class Render
 {
 public:
     Render(const Scene& scene, const Window& window);
+    ~Render();
 
+    // records and submits without waiting for the gpu, Window has made sure
+    // the frame that last used data.currentFrame and data.imageIndex is done
     void render(const Window::RenderData& data);
 
+    // brings the render tree up to date with changes from Scene::applyPatch
+    void applyChanges(const std::vector<Scene::Change>& changes);
+    // something on screen changed since the last frame, see Window::registerUpdate
+    bool needsFrame() const { return mDamaged; }
+
     const Window& window() const { return mWindow; }
+    // the items of the scene by position, for hit testing
+    const SpatialIndex& spatialIndex() const { return mIndex; }
 
     struct VertexBuffer
     {
         vk::UniqueBuffer buffer;
-        vk::UniqueDeviceMemory memory;
+        MemoryAllocator::Allocation memory;
     };
 
-    void transitionImageLayout(const vk::UniqueImage& image, vk::Format format, vk::ImageLayout oldLayout, vk::ImageLayout newLayout) const;
-    void copyBufferToImage(const vk::UniqueBuffer& buffer, const vk::UniqueImage& image, uint32_t width, uint32_t height) const;
-    void copyBufferToImage(vk::DeviceSize bufferOffset, uint32_t bufferRowLength, uint32_t bufferImageHeight, const vk::UniqueBuffer& buffer,
-                           const vk::UniqueImage& image, int32_t x, int32_t y, uint32_t width, uint32_t height) const;
     VertexBuffer createBuffer(vk::DeviceSize size, vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties) const;
     uint32_t findMemoryType(uint32_t typeFilter, vk::MemoryPropertyFlags properties) const;
+    // every buffer and image allocation goes through this
+    MemoryAllocator& allocator() const { return *mAllocator; }
+    // every image upload goes through this, submitted before the next frame
+    UploadQueue& uploads() const { return *mUploads; }
 
 private:
     struct PipelineData
@@ -56,66 +82,249 @@ private:
     };
     std::shared_ptr<PipelineResult> makePipeline(const PipelineData& data, vk::PrimitiveTopology topology);
 
+    enum DrawableType { DrawableColor, DrawableImage, DrawableText };
+
+    struct TemplateDrawables;
+
     struct Node
     {
         struct Drawable
         {
-            virtual ~Drawable() { }
+            // data is the uniform data of the drawable, copied to its slot in the uniform arena when changed.
+            // color drawables and images in the texture table have no slot, they're batched and their
+            // data goes to the frame's instance buffer instead
+            Drawable(DrawableType t, const void* data, size_t size) : type(t), uniformData(data), uniformSize(size) { }
+            virtual ~Drawable()
+            {
+                if (uniforms)
+                    uniforms->free(uniform);
+                if (textures)
+                    textures->remove(texture);
+            }
+
+            void markChanged() { std::fill(changed.begin(), changed.end(), true); }
+            // binds and draws, offset is the push constant the vertex shaders add to the position
+            void record(const vk::CommandBuffer& commandBuffer, uint32_t imageIndex, const std::array<float, 2>& offset) const;
 
             // shared data
+            DrawableType type;
+            // unique for the lifetime of the Render, what recorded command buffers are compared by
+            uint64_t id { 0 };
             std::shared_ptr<PipelineResult> pipeline;
-            std::vector<vk::UniqueCommandBuffer> commandBuffers;
             vk::UniqueBuffer vertexBuffer;
-            vk::UniqueDeviceMemory imageMemory;
+            MemoryAllocator::Allocation imageMemory;
             vk::UniqueImage image;
-            vk::UniqueImageView imageView;
-            vk::UniqueSampler imageSampler;
-            std::vector<vk::UniqueDeviceMemory> ubosMemory;
-            std::vector<vk::UniqueBuffer> ubos;
-            std::vector<vk::UniqueDescriptorSet> descriptorSets;
+            vk::UniqueImageView ownImageView;
+            vk::ImageView imageView; // not owned for text, RenderText has the atlas
+            vk::Sampler imageSampler; // not owned, see SamplerCache
+            UniformArena* uniforms { nullptr };
+            UniformArena::Slot uniform;
+            TextureTable* textures { nullptr };
+            uint32_t texture { TextureTable::Invalid };
+            vk::UniqueDescriptorSet ownDescriptorSet;
+            vk::DescriptorSet descriptorSet;
+            std::vector<bool> changed;
+            const void* uniformData;
+            size_t uniformSize;
+            vk::Buffer vertices; // not owned, RenderText has the vertices of text
+            uint32_t vertexCount { 4 };
+            // what it draws over in window coordinates, at the template's origin for the drawables of
+            // a template, and whether that's hidden by it. what occlusion culling goes by
+            Rect bounds;
+            bool opaque { false };
+
+            // not virtual, called for every drawable that isn't batched on frames where something changed
+            void update(uint32_t currentImage);
+            bool isBatched() const { return type == DrawableColor || texture != TextureTable::Invalid; }
+        };
 
-            virtual void update(const vk::UniqueDevice& device, uint32_t currentImage) = 0;
+        // the drawables of the template are shared by all instances and
+        // recorded with the instance's offset, overridden items have their own
+        struct Instance
+        {
+            std::shared_ptr<TemplateDrawables> shared;
+            std::vector<std::pair<uint32_t, std::vector<std::shared_ptr<Drawable> > > > overrides;
+            std::array<float, 2> offset;
         };
 
         std::vector<std::shared_ptr<Drawable> > drawables;
+        std::unique_ptr<Instance> instance;
         std::vector<std::shared_ptr<Node> > children;
     };
 
+    // per item of the template, made at the template's origin
+    struct TemplateDrawables
+    {
+        std::shared_ptr<const Scene::Template> tmpl;
+        std::vector<std::vector<std::shared_ptr<Node::Drawable> > > items;
+    };
+
     struct RenderColorDrawable;
     struct RenderImageDrawable;
     struct RenderTextDrawable;
 
+    bool init();
+
+    // nodes of the render tree that have yet to get their drawables, with what they're made from
+    typedef std::vector<std::pair<Node*, const Scene::Item*> > PendingItems;
+
     void traverseSceneItem(const std::shared_ptr<Scene::Item>& sceneItem,
-                           std::shared_ptr<Node>& renderNode);
+                           std::shared_ptr<Node>& renderNode, PendingItems& pending);
     void makeRenderTree(const Scene& scene);
 
-    void makeColorDrawableData();
-    void makeImageDrawableData();
-    void makeTextDrawableData();
+    // the drawable of type for the item, null if it has none
+    std::shared_ptr<Node::Drawable> makeItemDrawable(const Scene::Item& item, DrawableType type);
+    void makeDrawables(const Scene::Item& item, std::vector<std::shared_ptr<Node::Drawable> >& drawables);
+    void makeDrawables(const Scene::Item& item, Node& node);
+    void makeDrawables(const PendingItems& pending);
+    // color and image drawables of many nodes are made on mJobs, text after those on this thread
+    // as RenderText isn't thread safe
+    void makeDrawables(size_t count, const std::function<Node*(size_t)>& node,
+                       const std::function<std::shared_ptr<Node::Drawable>(size_t, DrawableType)>& make);
+    void makeInstance(const Scene::Item& item, Node& node);
+    void updateDrawables(const Scene::Item& item, Node& node, uint32_t flags);
+    void forgetSceneItem(const Scene::Item& item);
+
+    void makeColorDrawableData(ShaderCache& shaders);
+    void makeImageDrawableData(ShaderCache& shaders);
+    void makeTextDrawableData(ShaderCache& shaders);
     void makeDrawableDatas();
 
+    // frames in flight can still draw a drawable the render tree has let go
+    // of, so drawables are made with a deleter that hands them to mGarbage
+    template<typename T> std::shared_ptr<T> makeDrawable();
+    // destroys what no frame in flight can be using anymore
+    void collectGarbage();
+
+    // a uniform slot and a descriptor set pointing at it and the drawable's image view. like
+    // makeColorDrawable and makeImageDrawable this can be called on worker threads
+    bool makeUniform(Node::Drawable& drawable);
     std::shared_ptr<Node::Drawable> makeColorDrawable(const Color& color, const Rect& geometry);
     std::shared_ptr<Node::Drawable> makeImageDrawable(const Scene::ImageData& image, const Rect& geometry);
     std::shared_ptr<Node::Drawable> makeTextDrawable(const Text& image, const Rect& geometry);
 
-    void renderNode(const std::shared_ptr<Node>& node, const vk::CommandBuffer& commandBuffer, uint32_t imageIndex);
-
-    vk::CommandBuffer beginSingleCommand() const;
-    void endSingleCommand(const vk::CommandBuffer& commandBuffer) const;
+    // what a frame draws goes to mDrawList in painter's order, then it's recorded in one go. the
+    // recording of each swapchain image is replayed until the draw list changes
+    struct DrawEntry
+    {
+        Node::Drawable* drawable;
+        uint64_t id;
+        std::array<float, 2> offset;
+        // where a batched drawable's instance data goes, set when recording
+        vk::DeviceSize instance;
+    };
+    void collectDrawables(const Node& node);
+    void collectNode(const std::shared_ptr<Node>& node);
+    void collectVisible();
+    // drops what later opaque drawables hide from mDrawList
+    void cullOccluded();
+    // whether bounds is inside one of the occluders of the last cull
+    bool occluded(const Rect& bounds) const;
+    // a new mDrawListVersion if what's drawn is different than before
+    void rebuildDrawList();
+    // records the frame's command buffer, in secondaries recorded on mJobs for long draw lists.
+    // only area is drawn, load keeps what the image has outside of it rather than clearing it
+    void recordDrawList(uint32_t imageIndex, const vk::Rect2D& area, bool load);
+    // the draws of mDrawList[begin, end) and their instance data, batches don't cross end
+    void recordDraws(const vk::CommandBuffer& commandBuffer, uint32_t imageIndex, const vk::Rect2D& area,
+                     uint8_t* instances, size_t begin, size_t end) const;
+    // copies what changed since the last frame on imageIndex without recording anything
+    void updateDrawList(uint32_t imageIndex);
+    void writeInstance(const DrawEntry& entry, uint8_t* instances) const;
+    // room for size bytes of instance data in the buffer of imageIndex, null if it can't be had
+    uint8_t* reserveInstances(uint32_t imageIndex, vk::DeviceSize size);
+    // rect of the window needs to be drawn again, on every swapchain image
+    void addDamage(const Rect& rect);
+    // where the drawables of node and its instance draw
+    void addDamage(const Node& node);
+    // of node and everything under it
+    void addTreeDamage(const Node& node);
+    // the bounds of drawable moved by an instance offset, in window coordinates
+    Rect drawableBounds(const Node::Drawable& drawable, const std::array<float, 2>& offset) const;
 
 private:
     const Window& mWindow;
-    vk::UniqueCommandPool mCommandPool;
+    std::unique_ptr<JobSystem> mJobs;
+    // of the swapchain images' command buffers, which are reset one by one
+    vk::UniqueCommandPool mFrameCommandPool;
+    // frames rendered so far
+    uint64_t mFrameNumber { 0 };
+    std::atomic<uint64_t> mNextDrawableId { 1 };
+    // of mDescriptorPool, mGarbage and mDrawListDirty while drawables are made on worker threads
+    std::mutex mMutex;
     vk::UniqueDescriptorPool mDescriptorPool;
+    // before anything that allocates
+    std::unique_ptr<MemoryAllocator> mAllocator;
+    // before anything that uploads
+    std::unique_ptr<UploadQueue> mUploads;
+    // before anything that holds drawables, their descriptor sets point at its samplers
+    std::unique_ptr<SamplerCache> mSamplers;
+    // before anything that holds drawables, they give their slots back when destroyed
+    std::unique_ptr<UniformArena> mUniforms;
+    // image drawables get a slot in this rather than a descriptor set where the device allows
+    std::unique_ptr<TextureTable> mTextures;
+    // per swapchain image, Window makes sure the last frame on the image is done before the next
+    struct ImageFrame
+    {
+        // the batched drawables of the frame as per instance vertex data
+        VertexBuffer instances;
+        vk::DeviceSize capacity { 0 };
+        // mDrawList as of drawListVersion, submitted again as long as that's current
+        vk::UniqueCommandBuffer commandBuffer;
+        // per thread of mJobs, what the primary executes when the draw list was recorded in parts.
+        // reset as a whole when the frame is recorded again
+        struct Secondaries
+        {
+            vk::UniqueCommandPool pool;
+            std::vector<vk::CommandBuffer> buffers;
+            size_t used { 0 };
+        };
+        std::vector<Secondaries> secondaries;
+        uint64_t drawListVersion { 0 };
+        // drawables may have changed since the last frame on the image
+        bool changed { true };
+        // what changed on screen since the image was last drawn, all of it when full
+        Rect damage;
+        bool full { true };
+    };
+    std::vector<ImageFrame> mImageFrames;
+
+    // drawables let go of by the render tree, with mFrameNumber at the time. after
+    // everything that destroys drawables' resources and before anything that holds drawables
+    struct Garbage
+    {
+        uint64_t frame;
+        std::unique_ptr<Node::Drawable> drawable;
+    };
+    std::deque<Garbage> mGarbage;
 
     struct DrawableData
     {
         std::shared_ptr<PipelineResult> pipeline;
+        // instanced, for image drawables in the texture table
+        std::shared_ptr<PipelineResult> batchPipeline;
     };
-    enum DrawableType { DrawableColor, DrawableImage, DrawableText };
     std::vector<DrawableData> mDrawableData;
+    // what the pipelines are made with, saved when destroyed
+    std::unique_ptr<PipelineCache> mPipelineCache;
 
     std::shared_ptr<Node> mRoot;
+    std::unordered_map<const Scene::Item*, std::shared_ptr<Node> > mNodes;
+    // made on the first instance, gone with the last one
+    std::unordered_map<const Scene::Template*, std::weak_ptr<TemplateDrawables> > mTemplates;
+    SpatialIndex mIndex;
+    std::vector<const Scene::Item*> mVisible;
+    std::vector<DrawEntry> mDrawList, mPreviousDrawList;
+    // the largest opaque rects of the draw list seen so far when culling
+    std::vector<Rect> mOccluders;
+    // per change of applyChanges, whether the item was in the window before it
+    std::vector<uint8_t> mWasVisible;
+    // starts ahead of every ImageFrame so that the first frame on each image records
+    uint64_t mDrawListVersion { 1 };
+    // drawables were added, removed or changed, what's drawn needs to be collected again
+    bool mDrawListDirty { true };
+    // there's damage no frame has drawn yet
+    bool mDamaged { true };
     std::shared_ptr<RenderText> mRenderText;
 };
 
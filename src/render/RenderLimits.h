@@ -0,0 +1,66 @@
+#ifndef RENDERLIMITS_H
+#define RENDERLIMITS_H
+
+#include <cstdint>
+
+// Fixed sizes and limits of Render, kept free of vulkan so that tools that
+// estimate what a scene will cost (see tools/SceneStats.cpp) can use them.
+struct RenderLimits
+{
+    // descriptor sets in the pool. text drawables have one each, as do
+    // image drawables that aren't in the texture table. color drawables
+    // don't need any
+    static constexpr uint32_t MaxDescriptorSets = 4096;
+
+    // textures in the table image drawables are drawn in batches from, at
+    // most. devices with descriptor indexing tend to allow far more
+    static constexpr uint32_t MaxTextures = 4096;
+    // per instance data of an image drawable in the texture table
+    static constexpr uint32_t ImageInstanceSize = 20;
+
+    // color drawables are per instance vertex data of an instanced draw,
+    // rewritten every frame for what's visible
+    static constexpr uint32_t ColorInstanceSize = 32;
+
+    // uniform data of image and text drawables, in slots of UniformArena
+    // that are MaxUniformSize rounded up to minUniformBufferOffsetAlignment
+    static constexpr uint32_t ImageUniformSize = 16;
+    static constexpr uint32_t TextUniformSize = 80;
+    static constexpr uint32_t MaxUniformSize = 80;
+    // per page and swapchain image
+    static constexpr uint32_t UniformSlotsPerPage = 1024;
+    // the largest minUniformBufferOffsetAlignment drivers report
+    static constexpr uint32_t MaxUniformAlignment = 256;
+
+    // draw list entries per secondary command buffer when a frame is recorded
+    // on worker threads, shorter draw lists than two of these are recorded inline
+    static constexpr uint32_t DrawsPerCommandBuffer = 512;
+
+    // frames where the damaged part of the window is more than this share of
+    // it are drawn in full, clearing is no slower than loading what was there
+    static constexpr float MaxDamageShare = 0.5f;
+
+    // opaque rects that drawables under them are culled against, the largest
+    // of the draw list. each drawable is compared with every one of them
+    static constexpr uint32_t MaxOccluders = 16;
+
+    // glyph atlas, glyphs are rendered at GlyphRenderSize and scaled
+    static constexpr uint32_t GlyphRenderSize = 24;
+    static constexpr uint32_t GlyphAtlasWidth = 1024;
+    static constexpr uint32_t GlyphAtlasHeight = 1024;
+    static constexpr uint32_t TextVertexSize = 16;
+    static constexpr uint32_t VerticesPerGlyph = 6;
+
+    // device memory is allocated in blocks of this size, see MemoryAllocator.
+    // anything larger than half of it gets a block of its own
+    static constexpr uint64_t MemoryBlockSize = 32 * 1024 * 1024;
+    // persistent staging ring of UploadQueue, larger uploads get a staging
+    // buffer of their own
+    static constexpr uint64_t StagingRingSize = 64 * 1024 * 1024;
+
+    // the minimums the spec guarantees, plenty of drivers don't go higher
+    static constexpr uint32_t MaxMemoryAllocations = 4096;
+    static constexpr uint32_t MaxSamplers = 4000;
+};
+
+#endif // RENDERLIMITS_H
@@ -1,15 +1,18 @@
 #include "RenderText.h"
 #include "Render.h"
+#include "RenderLimits.h"
 #include <text/Layout.h>
 #include <Utils.h>
 #include <msdfgen.h>
 #include <glm/glm.hpp>
 
-constexpr uint32_t RenderSize = 24;
-constexpr uint32_t ImageWidth = 1024;
-constexpr uint32_t ImageHeight = 1024;
+constexpr uint32_t RenderSize = RenderLimits::GlyphRenderSize;
+constexpr uint32_t ImageWidth = RenderLimits::GlyphAtlasWidth;
+constexpr uint32_t ImageHeight = RenderLimits::GlyphAtlasHeight;
 constexpr vk::Format ImageFormat = vk::Format::eR8Unorm;
 
+static_assert(sizeof(RenderTextVertex) == RenderLimits::TextVertexSize, "RenderLimits out of date");
+
 struct DrawUserData
 {
     hb_position_t ascender;
@@ -101,39 +104,33 @@ RenderText::RenderText(const Render& render)
     const auto& device = mRender.window().device();
     vk::ImageCreateInfo imageCreateInfo({}, vk::ImageType::e2D, ImageFormat, { ImageWidth, ImageHeight, 1 }, 1, 1);
     imageCreateInfo.usage = vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled;
+    mRender.uploads().share(imageCreateInfo);
     vk::UniqueImage textureImage = device->createImageUnique(imageCreateInfo);
     if (!textureImage) {
         printf("failed to create text image\n");
         return;
     }
-    const vk::MemoryRequirements memRequirements = device->getImageMemoryRequirements(*textureImage);
-    vk::MemoryAllocateInfo memoryAllocInfo(memRequirements.size, mRender.findMemoryType(memRequirements.memoryTypeBits, vk::MemoryPropertyFlagBits::eDeviceLocal));
-    vk::UniqueDeviceMemory textureImageMemory = device->allocateMemoryUnique(memoryAllocInfo);
+    auto textureImageMemory = mRender.allocator().allocate(*textureImage, vk::MemoryPropertyFlagBits::eDeviceLocal);
     if (!textureImageMemory) {
         printf("failed to allocate text image memory\n");
         return;
     }
-    device->bindImageMemory(*textureImage, *textureImageMemory, 0);
-
-    vk::DeviceSize imageSize = ImageWidth * ImageHeight;
-    auto staging = mRender.createBuffer(imageSize, vk::BufferUsageFlagBits::eTransferSrc,
-                                        vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
 
-    // don't know if I need to initialize the buffer memory?
-    void* data = device->mapMemory(*staging.memory, 0, imageSize, {});
-    memset(data, 0x00, imageSize);
-    device->unmapMemory(*staging.memory);
+    vk::ImageViewCreateInfo imageViewCreateInfo({}, *textureImage, vk::ImageViewType::e2D, ImageFormat, {},
+                                                { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
+    vk::UniqueImageView imageView = device->createImageViewUnique(imageViewCreateInfo);
+    if (!imageView) {
+        printf("failed to create text image view\n");
+        return;
+    }
 
-    // ### maybe add a transition directly from eUndefined to eShaderReadOnlyOptimal
-    mRender.transitionImageLayout(textureImage, ImageFormat, vk::ImageLayout::eUndefined, vk::ImageLayout::eTransferDstOptimal);
-    mRender.copyBufferToImage(staging.buffer, textureImage, ImageWidth, ImageHeight);
-    mRender.transitionImageLayout(textureImage, ImageFormat, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+    // cleared, text samples around its glyphs
+    mPixels.resize(ImageWidth * ImageHeight, 0x00);
+    mRender.uploads().upload(*textureImage, vk::ImageLayout::eUndefined, 0, 0, ImageWidth, ImageHeight, mPixels.data(), ImageWidth, 1);
 
     mImage = std::move(textureImage);
     mImageMemory = std::move(textureImageMemory);
-
-    mImageBuffer = std::move(staging.buffer);
-    mImageBufferMemory = std::move(staging.memory);
+    mImageView = std::move(imageView);
 }
 
 uint32_t RenderText::renderSize() const
@@ -141,19 +138,11 @@ uint32_t RenderText::renderSize() const
     return RenderSize;
 }
 
-vk::UniqueImageView RenderText::imageView()
-{
-    const auto& device = mRender.window().device();
-    vk::ImageViewCreateInfo imageViewCreateInfo({}, *mImage, vk::ImageViewType::e2D, ImageFormat, {},
-                                                { vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1 });
-    return device->createImageViewUnique(imageViewCreateInfo);
-}
-
 RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect& rect, uint32_t& vertexCount)
 {
     const std::string fontPath = "./font.ttf";
 
-    FontContentsKey contentsKey { fontPath, text.size, text.contents, rect.x, rect.y };
+    FontContentsKey contentsKey { fontPath, text.size, text.contents, rect.width };
     auto contentsCacheHit = mContentsCache.find(contentsKey);
     if (contentsCacheHit != mContentsCache.end()) {
         // hit!
@@ -199,7 +188,9 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
     Bounds bounds;
 
     std::vector<RenderTextVertex> vertices;
-    vertices.reserve(layout.glyphCount() * 6);
+    // rows of the atlas glyphs were added to, [dirtyTop, dirtyBottom)
+    uint32_t dirtyTop = ImageHeight, dirtyBottom = 0;
+    vertices.reserve(layout.glyphCount() * RenderLimits::VerticesPerGlyph);
 
     const auto screenWidth = mRender.window().width();
     const auto screenHeight = mRender.window().height();
@@ -222,9 +213,6 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
 
     // printf("asc %f desc %f\n", ascender, descender);
 
-    const auto& device = mRender.window().device();
-    const vk::DeviceSize imageSize = ImageWidth * ImageHeight;
-
     Rect renderedGeometry;
 
     for (const auto& line : layout.lines()) {
@@ -298,8 +286,10 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
                 auto node = mRectPacker.insert(xmax - xmin, ymax - ymin);
                 const RectPacker::Rect& prect = node->rect;
 
-                uint8_t* data = static_cast<uint8_t*>(device->mapMemory(*mImageBufferMemory, 0, imageSize, {}));
+                uint8_t* data = mPixels.data();
                 data += prect.y * ImageWidth;
+                dirtyTop = std::min<uint32_t>(dirtyTop, prect.y);
+                dirtyBottom = std::max<uint32_t>(dirtyBottom, prect.y + (ymax - ymin));
 
                 auto pixel = ref.pixels;
                 pixel += ymin * ref.width;
@@ -313,8 +303,6 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
                     data += ImageWidth - (prect.x + (xmax - xmin));;
                 }
 
-                device->unmapMemory(*mImageBufferMemory);
-
                 mGidCache[cacheKey] = { node, { extents.x_bearing / 64.f, extents.y_bearing / 64.f, extents.width / 64.f, extents.height / 64.f } };
 
                 const float dstTop = dstY + (renderAscender - (extents.y_bearing / 64.f));
@@ -338,9 +326,11 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
     }
     renderedGeometry.height = dstY;
 
-    mRender.transitionImageLayout(mImage, ImageFormat, vk::ImageLayout::eShaderReadOnlyOptimal, vk::ImageLayout::eTransferDstOptimal);
-    mRender.copyBufferToImage(mImageBuffer, mImage, ImageWidth, ImageHeight);
-    mRender.transitionImageLayout(mImage, ImageFormat, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal);
+    // only the rows that changed, frames in flight may be drawing from the atlas so this goes behind them
+    if (dirtyTop < dirtyBottom) {
+        mRender.uploads().upload(*mImage, vk::ImageLayout::eShaderReadOnlyOptimal, 0, dirtyTop, ImageWidth, dirtyBottom - dirtyTop,
+                                 mPixels.data() + dirtyTop * ImageWidth, ImageWidth, 1);
+    }
 
     const vk::DeviceSize bufferSize = sizeof(RenderTextVertex) * vertices.size();
     auto buffer = mRender.createBuffer(bufferSize, vk::BufferUsageFlagBits::eVertexBuffer,
@@ -352,9 +342,7 @@ RenderText::RenderTextResult RenderText::renderText(const Text& text, const Rect
     contentsData.numVertices = vertices.size();
     contentsData.geometry = renderedGeometry;
 
-    void* out = device->mapMemory(*contentsData.renderedBufferMemory, 0, bufferSize, {});
-    memcpy(out, vertices.data(), bufferSize);
-    device->unmapMemory(*contentsData.renderedBufferMemory);
+    memcpy(contentsData.renderedBufferMemory.mapped(), vertices.data(), bufferSize);
 
     auto renderedBuffer = *contentsData.renderedBuffer;
 
@@ -395,11 +383,11 @@ bool RenderText::FontGidKey::operator==(const FontGidKey& other) const
 size_t RenderText::FontContentsHasher::operator()(const FontContentsKey& key) const noexcept
 {
     size_t h = 0;
-    hash_combine(h, key.path, key.size, key.contents, key.x, key.y);
+    hash_combine(h, key.path, key.size, key.contents, key.width);
     return h;
 }
 
 bool RenderText::FontContentsKey::operator==(const FontContentsKey& other) const
 {
-    return path == other.path && size == other.size && contents == other.contents && x == other.x && y == other.y;
+    return path == other.path && size == other.size && contents == other.contents && width == other.width;
 }
@@ -2,6 +2,7 @@
 #define RENDERTEXT_H
 
 #include "RectPacker.h"
+#include "MemoryAllocator.h"
 #include <vulkan/vulkan.hpp>
 #include <vector>
 #include <scene/Text.h>
@@ -19,7 +20,8 @@ class RenderText
 public:
     RenderText(const Render& render);
 
-    vk::UniqueImageView imageView();
+    // of the glyph atlas, shared by all text drawables
+    vk::ImageView imageView() const { return *mImageView; }
 
     struct RenderTextResult
     {
@@ -56,14 +58,15 @@ private:
         std::string path;
         uint32_t size;
         std::string contents;
-        float x, y;
+        // the layout only depends on the width, the position is applied by the projection
+        float width;
 
         bool operator==(const FontContentsKey&) const;
     };
     struct FontContentsData
     {
         vk::UniqueBuffer renderedBuffer;
-        vk::UniqueDeviceMemory renderedBufferMemory;
+        MemoryAllocator::Allocation renderedBufferMemory;
         Rect geometry;
         uint32_t numVertices;
     };
@@ -77,9 +80,10 @@ private:
     RectPacker mRectPacker;
 
     vk::UniqueImage mImage;
-    vk::UniqueDeviceMemory mImageMemory;
-    vk::UniqueBuffer mImageBuffer;
-    vk::UniqueDeviceMemory mImageBufferMemory;
+    MemoryAllocator::Allocation mImageMemory;
+    vk::UniqueImageView mImageView;
+    // what's in mImage, uploaded again where glyphs are added
+    std::vector<uint8_t> mPixels;
 
     std::unordered_map<FontGidKey, FontGidData, FontGidHasher> mGidCache;
     std::unordered_map<FontContentsKey, FontContentsData, FontContentsHasher> mContentsCache;
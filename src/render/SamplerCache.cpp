@@ -0,0 +1,67 @@
+#include "SamplerCache.h"
+#include "Render.h"
+#include <algorithm>
+#include <stdio.h>
+
+// see RenderText.cpp
+template <typename T>
+static inline void hash_combine(std::size_t& seed, const T& v)
+{
+    std::hash<T> hasher;
+    seed ^= hasher(v) + 0x9e3779b9 + (seed<<6) + (seed>>2);
+}
+
+size_t SamplerCache::KeyHasher::operator()(const Key& key) const noexcept
+{
+    size_t h = 0;
+    hash_combine(h, static_cast<uint32_t>(key.filter));
+    hash_combine(h, static_cast<uint32_t>(key.mipmapMode));
+    hash_combine(h, static_cast<uint32_t>(key.addressMode));
+    hash_combine(h, key.maxAnisotropy);
+    hash_combine(h, key.minLod);
+    hash_combine(h, key.maxLod);
+    return h;
+}
+
+SamplerCache::SamplerCache(const Render& render)
+    : mRender(render)
+{
+    // Window only picks devices with samplerAnisotropy
+    const auto properties = mRender.window().physicalDevice().getProperties();
+    mMaxAnisotropy = properties.limits.maxSamplerAnisotropy;
+}
+
+vk::Sampler SamplerCache::get(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto it = mSamplers.find(key);
+    if (it != mSamplers.end())
+        return *it->second;
+
+    vk::SamplerCreateInfo samplerCreateInfo({}, key.filter, key.filter, key.mipmapMode, key.addressMode, key.addressMode, key.addressMode);
+    samplerCreateInfo.anisotropyEnable = key.maxAnisotropy > 1.f ? VK_TRUE : VK_FALSE;
+    samplerCreateInfo.maxAnisotropy = std::min(std::max(key.maxAnisotropy, 1.f), mMaxAnisotropy);
+    samplerCreateInfo.borderColor = vk::BorderColor::eIntOpaqueBlack;
+    samplerCreateInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerCreateInfo.compareEnable = VK_FALSE;
+    samplerCreateInfo.compareOp = vk::CompareOp::eAlways;
+    samplerCreateInfo.mipLodBias = 0.f;
+    samplerCreateInfo.minLod = key.minLod;
+    samplerCreateInfo.maxLod = key.maxLod;
+    vk::UniqueSampler sampler = mRender.window().device()->createSamplerUnique(samplerCreateInfo);
+    if (!sampler) {
+        printf("failed to create sampler\n");
+        return {};
+    }
+
+    const vk::Sampler result = *sampler;
+    mSamplers.emplace(key, std::move(sampler));
+    return result;
+}
+
+size_t SamplerCache::count() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSamplers.size();
+}
@@ -0,0 +1,57 @@
+#ifndef SAMPLERCACHE_H
+#define SAMPLERCACHE_H
+
+#include <vulkan/vulkan.hpp>
+#include <unordered_map>
+#include <mutex>
+
+class Render;
+
+// Samplers by what they sample with, shared by every drawable that samples
+// the same way. Drivers allow as few as 4000 samplers (see
+// RenderLimits::MaxSamplers) so one per drawable caps how many images and
+// texts a scene can have, and creating them isn't free either.
+//
+// Samplers live as long as the cache, Render destroys it after the
+// drawables. get() can be called from any thread.
+class SamplerCache
+{
+public:
+    SamplerCache(const Render& render);
+
+    SamplerCache(const SamplerCache&) = delete;
+    SamplerCache& operator=(const SamplerCache&) = delete;
+
+    struct Key
+    {
+        vk::Filter filter { vk::Filter::eLinear };
+        vk::SamplerMipmapMode mipmapMode { vk::SamplerMipmapMode::eLinear };
+        vk::SamplerAddressMode addressMode { vk::SamplerAddressMode::eRepeat };
+        // 0 for no anisotropic filtering, clamped to what the device allows
+        float maxAnisotropy { 16.f };
+        float minLod { 0.f }, maxLod { 0.f };
+
+        bool operator==(const Key& other) const
+        {
+            return filter == other.filter && mipmapMode == other.mipmapMode && addressMode == other.addressMode
+                && maxAnisotropy == other.maxAnisotropy && minLod == other.minLod && maxLod == other.maxLod;
+        }
+    };
+
+    // null if the sampler can't be created
+    vk::Sampler get(const Key& key = Key());
+    size_t count() const;
+
+private:
+    struct KeyHasher
+    {
+        size_t operator()(const Key& key) const noexcept;
+    };
+
+    const Render& mRender;
+    float mMaxAnisotropy { 1.f };
+    std::unordered_map<Key, vk::UniqueSampler, KeyHasher> mSamplers;
+    mutable std::mutex mMutex;
+};
+
+#endif // SAMPLERCACHE_H
@@ -0,0 +1,121 @@
+#include "ShaderCache.h"
+#include <JobSystem.h>
+#include <vulkan/vulkan.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+// anything that changes what a source compiles to goes in the key
+static const shaderc_optimization_level OptimizationLevel = shaderc_optimization_level_performance;
+static const char* Options = "O=performance;version=1";
+
+static const char* stageName(ShaderCache::Stage stage)
+{
+    return stage == ShaderCache::Vertex ? "vert" : "frag";
+}
+
+static uint64_t hashData(uint64_t hash, const void* data, size_t size)
+{
+    // fnv-1a
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+static bool isSpirv(const Buffer& buffer)
+{
+    return buffer.size() >= 4 && buffer.size() % 4 == 0 && *reinterpret_cast<const uint32_t*>(buffer.data()) == 0x07230203;
+}
+
+ShaderCache::ShaderCache(const std::string& sourceDir, const std::string& cacheDir, uint32_t apiVersion)
+    : mSourceDir(sourceDir), mCacheDir(cacheDir)
+    , mEnvironment(apiVersion >= VK_API_VERSION_1_1 ? shaderc_env_version_vulkan_1_1 : shaderc_env_version_vulkan_1_0)
+{
+    mkdir(mCacheDir.c_str(), 0755);
+}
+
+Buffer ShaderCache::get(const std::string& name, Stage stage)
+{
+    const std::string fullName = name + "." + stageName(stage);
+    const Buffer source = Buffer::readFile(mSourceDir + "/" + fullName);
+    if (source.empty()) {
+        Buffer precompiled = Buffer::readFile("./" + name + "-" + stageName(stage) + ".spv");
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (isSpirv(precompiled)) {
+            printf("no source for shader '%s', using the precompiled one\n", fullName.c_str());
+            ++mStats.precompiled;
+            return precompiled;
+        }
+        printf("no source or SPIR-V for shader '%s'\n", fullName.c_str());
+        ++mStats.failed;
+        return Buffer();
+    }
+
+    uint32_t spirvVersion = 0, spirvRevision = 0;
+    shaderc_get_spv_version(&spirvVersion, &spirvRevision);
+    uint64_t hash = 14695981039346656037ull;
+    hash = hashData(hash, source.data(), source.size());
+    hash = hashData(hash, &stage, sizeof(stage));
+    hash = hashData(hash, Options, strlen(Options));
+    hash = hashData(hash, &mEnvironment, sizeof(mEnvironment));
+    hash = hashData(hash, &spirvVersion, sizeof(spirvVersion));
+    hash = hashData(hash, &spirvRevision, sizeof(spirvRevision));
+
+    char key[17];
+    snprintf(key, sizeof(key), "%016llx", static_cast<unsigned long long>(hash));
+    const std::string cachePath = mCacheDir + "/" + name + "-" + stageName(stage) + "-" + key + ".spv";
+
+    Buffer cached = Buffer::readFile(cachePath);
+    if (isSpirv(cached)) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        ++mStats.cached;
+        return cached;
+    }
+
+    shaderc::CompileOptions options;
+    options.SetOptimizationLevel(OptimizationLevel);
+    options.SetTargetEnvironment(shaderc_target_env_vulkan, mEnvironment);
+    const shaderc::SpvCompilationResult result = mCompiler.CompileGlslToSpv(reinterpret_cast<const char*>(source.data()), source.size(),
+                                                                           stage == Vertex ? shaderc_glsl_vertex_shader : shaderc_glsl_fragment_shader,
+                                                                           fullName.c_str(), "main", options);
+    if (result.GetCompilationStatus() != shaderc_compilation_status_success) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        printf("failed to compile shader '%s':\n%s", fullName.c_str(), result.GetErrorMessage().c_str());
+        ++mStats.failed;
+        return Buffer();
+    }
+
+    Buffer spirv(reinterpret_cast<const uint8_t*>(result.cbegin()), (result.cend() - result.cbegin()) * sizeof(uint32_t));
+    // another run racing this one writes the same thing
+    const std::string temporary = cachePath + ".tmp";
+    if (!spirv.writeFile(temporary) || rename(temporary.c_str(), cachePath.c_str()) != 0) {
+        printf("failed to cache shader '%s'\n", fullName.c_str());
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    ++mStats.compiled;
+    return spirv;
+}
+
+void ShaderCache::load(const std::vector<std::string>& names, JobSystem& jobs)
+{
+    mStats = Stats();
+    std::vector<Buffer> loaded(names.size() * 2);
+    jobs.run(loaded.size(), [this, &names, &loaded](size_t i) {
+        loaded[i] = get(names[i / 2], i % 2 ? Fragment : Vertex);
+    });
+    for (size_t i = 0; i < loaded.size(); ++i) {
+        mLoaded[names[i / 2] + "-" + stageName(i % 2 ? Fragment : Vertex)] = std::move(loaded[i]);
+    }
+}
+
+Buffer ShaderCache::spirv(const std::string& name, Stage stage)
+{
+    const auto it = mLoaded.find(name + "-" + stageName(stage));
+    if (it == mLoaded.end())
+        return get(name, stage);
+    if (it->second.empty())
+        return Buffer();
+    // pipelines take their shaders by value, what's loaded stays for the next one
+    return Buffer(it->second.data(), it->second.size());
+}
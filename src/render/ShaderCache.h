@@ -0,0 +1,61 @@
+#ifndef SHADERCACHE_H
+#define SHADERCACHE_H
+
+#include <Buffer.h>
+#include <shaderc/shaderc.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+class JobSystem;
+
+// Compiles the glsl in sourceDir (name.vert, name.frag) to SPIR-V with
+// shaderc when pipelines are made, rather than relying on .spv files that
+// were compiled by hand and may be out of date.
+//
+// What's compiled is written to cacheDir, named after a hash of the source,
+// the stage and the compile options, so an unchanged shader is read back
+// rather than compiled again and an edited one never matches its old
+// SPIR-V. Old files are left behind.
+//
+// When the source can't be read the precompiled ./name-stage.spv is used
+// as before, so a build without the shader sources around still runs.
+class ShaderCache
+{
+public:
+    // compiles for apiVersion, SPIR-V 1.3 for Vulkan 1.1 won't load on a 1.0 device
+    ShaderCache(const std::string& sourceDir, const std::string& cacheDir, uint32_t apiVersion);
+
+    ShaderCache(const ShaderCache&) = delete;
+    ShaderCache& operator=(const ShaderCache&) = delete;
+
+    enum Stage { Vertex, Fragment };
+
+    // compiles or loads both stages of every one of names in parallel, see spirv()
+    void load(const std::vector<std::string>& names, JobSystem& jobs);
+    // of a shader load() was given, or loaded on the spot. empty if it couldn't be had
+    Buffer spirv(const std::string& name, Stage stage);
+
+    // of the last load()
+    struct Stats
+    {
+        size_t compiled { 0 }, cached { 0 }, precompiled { 0 }, failed { 0 };
+    };
+    const Stats& stats() const { return mStats; }
+
+private:
+    Buffer get(const std::string& name, Stage stage);
+
+private:
+    std::string mSourceDir, mCacheDir;
+    shaderc_env_version mEnvironment;
+    // can be used from several threads at once
+    shaderc::Compiler mCompiler;
+    // by name-stage
+    std::unordered_map<std::string, Buffer> mLoaded;
+    std::mutex mMutex;
+    Stats mStats;
+};
+
+#endif // SHADERCACHE_H
@@ -0,0 +1,89 @@
+#include "TextureTable.h"
+#include "Render.h"
+#include "RenderLimits.h"
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+
+TextureTable::TextureTable(const Render& render)
+    : mRender(render)
+{
+    const auto& window = mRender.window();
+    if (!window.descriptorIndexing())
+        return;
+
+    // combined image samplers count as both samplers and sampled images
+    const auto properties = window.physicalDevice().getProperties2<vk::PhysicalDeviceProperties2, vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+    const auto& indexing = properties.get<vk::PhysicalDeviceDescriptorIndexingPropertiesEXT>();
+    mCapacity = std::min({ RenderLimits::MaxTextures,
+                           indexing.maxPerStageDescriptorUpdateAfterBindSamplers, indexing.maxPerStageDescriptorUpdateAfterBindSampledImages,
+                           indexing.maxDescriptorSetUpdateAfterBindSamplers, indexing.maxDescriptorSetUpdateAfterBindSampledImages });
+    if (mCapacity == 0)
+        return;
+
+    const auto& device = window.device();
+    mLayout = makeLayout(device, mCapacity);
+    if (!mLayout) {
+        printf("failed to create texture table layout\n");
+        return;
+    }
+
+    vk::DescriptorPoolSize poolSize(vk::DescriptorType::eCombinedImageSampler, mCapacity);
+    vk::DescriptorPoolCreateInfo poolInfo(vk::DescriptorPoolCreateFlagBits::eUpdateAfterBindEXT, 1, 1, &poolSize);
+    mPool = device->createDescriptorPoolUnique(poolInfo);
+    if (!mPool) {
+        printf("failed to create texture table pool\n");
+        return;
+    }
+
+    vk::DescriptorSetAllocateInfo allocInfo(*mPool, 1, &*mLayout);
+    const auto sets = device->allocateDescriptorSets(allocInfo);
+    if (sets.empty() || !sets[0]) {
+        printf("failed to allocate texture table\n");
+        return;
+    }
+    mSet = sets[0];
+
+    // handed out from the front first
+    for (uint32_t i = mCapacity; i > 0; --i) {
+        mFree.push_back(i - 1);
+    }
+}
+
+vk::UniqueDescriptorSetLayout TextureTable::makeLayout(const vk::UniqueDevice& device, uint32_t capacity)
+{
+    // slots are written while frames in flight draw from the others
+    const vk::DescriptorBindingFlagsEXT bindingFlags = vk::DescriptorBindingFlagBitsEXT::ePartiallyBound | vk::DescriptorBindingFlagBitsEXT::eUpdateAfterBind
+        | vk::DescriptorBindingFlagBitsEXT::eUpdateUnusedWhilePending;
+    vk::DescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsInfo(1, &bindingFlags);
+    vk::DescriptorSetLayoutBinding binding(0, vk::DescriptorType::eCombinedImageSampler, capacity, vk::ShaderStageFlagBits::eFragment);
+    vk::DescriptorSetLayoutCreateInfo layoutInfo(vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPoolEXT, 1, &binding);
+    layoutInfo.setPNext(&bindingFlagsInfo);
+    return device->createDescriptorSetLayoutUnique(layoutInfo);
+}
+
+uint32_t TextureTable::add(vk::ImageView imageView, vk::Sampler sampler)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFree.empty())
+        return Invalid;
+    const uint32_t index = mFree.back();
+    mFree.pop_back();
+    ++mUsed;
+
+    vk::DescriptorImageInfo imageInfo(sampler, imageView, vk::ImageLayout::eShaderReadOnlyOptimal);
+    vk::WriteDescriptorSet write(mSet, 0, index, 1, vk::DescriptorType::eCombinedImageSampler, &imageInfo, {});
+    mRender.window().device()->updateDescriptorSets({ write }, {});
+    return index;
+}
+
+void TextureTable::remove(uint32_t index)
+{
+    if (index == Invalid)
+        return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    assert(mUsed > 0);
+    // the slot keeps pointing at the old view until it's reused, nothing reads it until then
+    mFree.push_back(index);
+    --mUsed;
+}
@@ -0,0 +1,61 @@
+#ifndef TEXTURETABLE_H
+#define TEXTURETABLE_H
+
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+
+class Render;
+
+// The textures of image drawables in one descriptor set, an array of
+// combined image samplers that the imagebatch shaders index with a texture
+// index per instance. A run of consecutive images is then one pipeline
+// bind, one descriptor set bind and one instanced draw rather than one of
+// each per image.
+//
+// Needs descriptor indexing (see Window::descriptorIndexing()): the array
+// is indexed non-uniformly, slots not in use are never written and slots
+// are written while frames that have the set bound are in flight. Without
+// it isValid() is false and image drawables have a descriptor set each, as
+// they do when the table is full.
+//
+// Slots are reused as soon as they're freed. Render only destroys a
+// drawable, which frees its slot, once no frame in flight can draw it.
+// add() and remove() can be called from any thread.
+class TextureTable
+{
+public:
+    TextureTable(const Render& render);
+
+    TextureTable(const TextureTable&) = delete;
+    TextureTable& operator=(const TextureTable&) = delete;
+
+    static constexpr uint32_t Invalid = 0xffffffff;
+
+    bool isValid() const { return static_cast<bool>(mSet); }
+    uint32_t capacity() const { return mCapacity; }
+    size_t count() const { return mUsed; }
+    vk::DescriptorSet set() const { return mSet; }
+
+    // the index of the texture in the array, Invalid when the table is full
+    uint32_t add(vk::ImageView imageView, vk::Sampler sampler);
+    void remove(uint32_t index);
+
+    // pipelines make their own, identically defined layouts are compatible
+    static vk::UniqueDescriptorSetLayout makeLayout(const vk::UniqueDevice& device, uint32_t capacity);
+
+private:
+    const Render& mRender;
+    uint32_t mCapacity { 0 };
+    vk::UniqueDescriptorSetLayout mLayout;
+    vk::UniqueDescriptorPool mPool;
+    // lives as long as the pool
+    vk::DescriptorSet mSet;
+    std::vector<uint32_t> mFree;
+    size_t mUsed { 0 };
+    // of mFree and the writes to mSet, which need to be externally synchronized
+    std::mutex mMutex;
+};
+
+#endif // TEXTURETABLE_H
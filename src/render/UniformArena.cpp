@@ -0,0 +1,119 @@
+#include "UniformArena.h"
+#include "Render.h"
+#include "RenderLimits.h"
+#include <algorithm>
+#include <assert.h>
+#include <stdio.h>
+
+static inline vk::DeviceSize alignUp(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+UniformArena::UniformArena(const Render& render, uint32_t regions)
+    : mRender(render), mRegions(std::max<uint32_t>(regions, 1))
+{
+    const auto properties = mRender.window().physicalDevice().getProperties();
+    // dynamic offsets need to be multiples of this, which makes it the slot size in practice. flushes
+    // of non-coherent memory need nonCoherentAtomSize, a slot is flushed on its own
+    const vk::DeviceSize alignment = std::max<vk::DeviceSize>({ properties.limits.minUniformBufferOffsetAlignment,
+                                                                 properties.limits.nonCoherentAtomSize, 1 });
+    mSlotSize = alignUp(RenderLimits::MaxUniformSize, alignment);
+    mRegionSize = mSlotSize * RenderLimits::UniformSlotsPerPage;
+    mDirty.resize(mRegions);
+}
+
+bool UniformArena::addPage()
+{
+    const auto& device = mRender.window().device();
+
+    Page page;
+    vk::BufferCreateInfo bufferInfo({}, mRegionSize * mRegions, vk::BufferUsageFlagBits::eUniformBuffer, vk::SharingMode::eExclusive);
+    page.buffer = device->createBufferUnique(bufferInfo);
+    if (!page.buffer) {
+        printf("failed to create uniform page\n");
+        return false;
+    }
+
+    if (!mProperties) {
+        const vk::MemoryRequirements memRequirements = device->getBufferMemoryRequirements(*page.buffer);
+        const vk::MemoryPropertyFlags coherent = vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent;
+        if (mRender.findMemoryType(memRequirements.memoryTypeBits, coherent) != Invalid) {
+            mProperties = coherent;
+        } else {
+            mProperties = vk::MemoryPropertyFlagBits::eHostVisible;
+            mCoherent = false;
+        }
+    }
+
+    // stays mapped, the allocator maps host visible blocks once
+    page.memory = mRender.allocator().allocate(*page.buffer, mProperties);
+    if (!page.memory) {
+        printf("failed to allocate uniform page\n");
+        return false;
+    }
+    page.mapped = page.memory.mapped();
+
+    // handed out from the front of the page first
+    const uint32_t index = mPages.size();
+    for (uint32_t i = RenderLimits::UniformSlotsPerPage; i > 0; --i) {
+        mFree.push_back({ index, static_cast<uint32_t>((i - 1) * mSlotSize) });
+    }
+    mPages.push_back(std::move(page));
+    return true;
+}
+
+UniformArena::Slot UniformArena::allocate()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mFree.empty() && !addPage())
+        return {};
+    const Slot slot = mFree.back();
+    mFree.pop_back();
+    ++mUsed;
+    return slot;
+}
+
+void UniformArena::free(const Slot& slot)
+{
+    if (!slot.isValid())
+        return;
+    std::lock_guard<std::mutex> lock(mMutex);
+    assert(mUsed > 0);
+    mFree.push_back(slot);
+    --mUsed;
+}
+
+vk::Buffer UniformArena::buffer(uint32_t page) const
+{
+    // pages can be added by another thread
+    std::lock_guard<std::mutex> lock(mMutex);
+    return *mPages[page].buffer;
+}
+
+void UniformArena::flush(uint32_t region)
+{
+    auto& dirty = mDirty[region];
+    if (dirty.empty())
+        return;
+
+    // neighbouring slots go out as one range
+    std::sort(dirty.begin(), dirty.end(), [](const vk::MappedMemoryRange& a, const vk::MappedMemoryRange& b) {
+        if (a.memory != b.memory)
+            return a.memory < b.memory;
+        return a.offset < b.offset;
+    });
+    size_t merged = 0;
+    for (size_t i = 1; i < dirty.size(); ++i) {
+        auto& last = dirty[merged];
+        if (dirty[i].memory == last.memory && dirty[i].offset <= last.offset + last.size) {
+            last.size = std::max(last.size, dirty[i].offset + dirty[i].size - last.offset);
+        } else {
+            dirty[++merged] = dirty[i];
+        }
+    }
+    dirty.resize(merged + 1);
+
+    mRender.window().device()->flushMappedMemoryRanges(dirty);
+    dirty.clear();
+}
@@ -0,0 +1,99 @@
+#ifndef UNIFORMARENA_H
+#define UNIFORMARENA_H
+
+#include "MemoryAllocator.h"
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <mutex>
+
+class Render;
+
+// Uniform data of all drawables, in fixed size slots of a few large buffers
+// rather than a buffer and an allocation per drawable and swapchain image.
+// Every page is one buffer with a region per swapchain image, descriptor
+// sets point at the start of the page as eUniformBufferDynamic and the
+// dynamic offset picks the region and the slot.
+//
+// Pages stay mapped for their lifetime and write() copies straight into
+// them. Coherent memory is preferred, when the device has none the slots
+// written to a region are flushed together by flush() before the frame
+// that uses them is submitted.
+//
+// Slots are reused as soon as they're freed. Render only destroys a
+// drawable, which frees its slot, once no frame in flight can draw it, and
+// a region is only written for a swapchain image no frame in flight uses.
+//
+// allocate(), free() and buffer() can be called from any thread, drawables
+// are made on worker threads. write() and flush() only from the one that
+// renders while no drawables are being made.
+class UniformArena
+{
+public:
+    UniformArena(const Render& render, uint32_t regions);
+
+    UniformArena(const UniformArena&) = delete;
+    UniformArena& operator=(const UniformArena&) = delete;
+
+    struct Slot
+    {
+        uint32_t page { Invalid };
+        uint32_t offset { 0 };
+
+        bool isValid() const { return page != Invalid; }
+    };
+    static constexpr uint32_t Invalid = 0xffffffff;
+
+    Slot allocate();
+    void free(const Slot& slot);
+
+    // what descriptor sets for slots of page use
+    vk::Buffer buffer(uint32_t page) const;
+    vk::DeviceSize slotSize() const { return mSlotSize; }
+
+    uint32_t dynamicOffset(const Slot& slot, uint32_t region) const
+    {
+        return static_cast<uint32_t>(region * mRegionSize) + slot.offset;
+    }
+    void write(const Slot& slot, uint32_t region, const void* data, size_t size)
+    {
+        const vk::DeviceSize offset = region * mRegionSize + slot.offset;
+        memcpy(mPages[slot.page].mapped + offset, data, size);
+        if (!mCoherent) {
+            const auto& memory = mPages[slot.page].memory;
+            mDirty[region].push_back(vk::MappedMemoryRange(memory.memory(), memory.offset() + offset, mSlotSize));
+        }
+    }
+    // no-op for coherent memory
+    void flush(uint32_t region);
+
+    size_t pageCount() const { return mPages.size(); }
+    size_t slotCount() const { return mUsed; }
+
+private:
+    bool addPage();
+
+private:
+    struct Page
+    {
+        vk::UniqueBuffer buffer;
+        MemoryAllocator::Allocation memory;
+        uint8_t* mapped { nullptr };
+    };
+
+    const Render& mRender;
+    uint32_t mRegions;
+    vk::DeviceSize mSlotSize { 0 }, mRegionSize { 0 };
+    std::vector<Page> mPages;
+    std::vector<Slot> mFree;
+    size_t mUsed { 0 };
+    vk::MemoryPropertyFlags mProperties;
+    bool mCoherent { true };
+    // per region, written since the last flush
+    std::vector<std::vector<vk::MappedMemoryRange> > mDirty;
+    // of mPages and mFree
+    mutable std::mutex mMutex;
+};
+
+#endif // UNIFORMARENA_H
@@ -0,0 +1,342 @@
+#include "UploadQueue.h"
+#include "Render.h"
+#include "RenderLimits.h"
+#include <algorithm>
+#include <unordered_set>
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+static inline vk::DeviceSize alignUp(vk::DeviceSize size, vk::DeviceSize alignment)
+{
+    return (size + alignment - 1) / alignment * alignment;
+}
+
+UploadQueue::UploadQueue(const Render& render)
+    : mRender(render)
+{
+    const auto& window = mRender.window();
+    const auto& device = window.device();
+    mFamilies[0] = window.graphicsFamily();
+    mFamilies[1] = window.transferFamily();
+    mDedicated = mFamilies[0] != mFamilies[1];
+
+    // command buffers are freed one by one as their batches finish
+    vk::CommandPoolCreateInfo graphicsPoolInfo({}, mFamilies[0]);
+    mGraphicsPool = device->createCommandPoolUnique(graphicsPoolInfo);
+    if (mDedicated) {
+        vk::CommandPoolCreateInfo transferPoolInfo({}, mFamilies[1]);
+        mTransferPool = device->createCommandPoolUnique(transferPoolInfo);
+    }
+    if (!mGraphicsPool || (mDedicated && !mTransferPool)) {
+        printf("failed to create upload command pools\n");
+        return;
+    }
+
+    // copies need offsets that are a multiple of the texel size and 4, some devices go faster with more
+    const auto properties = window.physicalDevice().getProperties();
+    mAlignment = std::max<vk::DeviceSize>(mAlignment, properties.limits.optimalBufferCopyOffsetAlignment);
+
+    mCapacity = RenderLimits::StagingRingSize;
+    mRing = makeStaging(mCapacity);
+    if (!mRing.buffer) {
+        printf("failed to allocate staging ring\n");
+        mCapacity = 0;
+        return;
+    }
+    mMapped = mRing.memory.mapped();
+}
+
+UploadQueue::~UploadQueue()
+{
+    // Render waited for the device to go idle, nothing is in flight
+}
+
+UploadQueue::Staging UploadQueue::makeStaging(vk::DeviceSize size) const
+{
+    const auto& device = mRender.window().device();
+
+    Staging staging;
+    vk::BufferCreateInfo bufferInfo({}, size, vk::BufferUsageFlagBits::eTransferSrc, vk::SharingMode::eExclusive);
+    if (mDedicated) {
+        bufferInfo.sharingMode = vk::SharingMode::eConcurrent;
+        bufferInfo.queueFamilyIndexCount = 2;
+        bufferInfo.pQueueFamilyIndices = mFamilies;
+    }
+    staging.buffer = device->createBufferUnique(bufferInfo);
+    if (!staging.buffer)
+        return {};
+    staging.memory = mRender.allocator().allocate(*staging.buffer, vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
+    if (!staging.memory)
+        return {};
+    return staging;
+}
+
+void UploadQueue::share(vk::ImageCreateInfo& imageInfo) const
+{
+    if (!mDedicated)
+        return;
+    imageInfo.sharingMode = vk::SharingMode::eConcurrent;
+    imageInfo.queueFamilyIndexCount = 2;
+    imageInfo.pQueueFamilyIndices = mFamilies;
+}
+
+bool UploadQueue::reserve(vk::DeviceSize size, vk::DeviceSize& offset)
+{
+    size = alignUp(size, mAlignment);
+    if (size > mCapacity)
+        return false;
+
+    for (;;) {
+        release();
+        const bool empty = mQueued.empty() && std::all_of(mBatches.begin(), mBatches.end(), [](const Batch& batch) {
+            return batch.done;
+        });
+        if (empty) {
+            mHead = mTail = 0;
+        }
+
+        // in use is [mTail, mHead) or, once wrapped, [mTail, end) and [0, mHead)
+        if (empty || mHead > mTail) {
+            if (mHead + size <= mCapacity) {
+                offset = mHead;
+                mHead += size;
+                return true;
+            }
+            if (size < mTail) {
+                offset = 0;
+                mHead = size;
+                return true;
+            }
+        } else if (mHead + size < mTail) {
+            offset = mHead;
+            mHead += size;
+            return true;
+        }
+
+        // full, what's queued goes out and the oldest batch is waited for
+        submitQueued();
+        const auto oldest = std::find_if(mBatches.begin(), mBatches.end(), [](const Batch& batch) {
+            return !batch.done;
+        });
+        if (oldest == mBatches.end())
+            return false;
+        mRender.window().device()->waitForFences({ *oldest->fence }, VK_TRUE, UINT64_MAX);
+    }
+}
+
+bool UploadQueue::upload(vk::Image image, vk::ImageLayout oldLayout, int32_t x, int32_t y, uint32_t width, uint32_t height,
+                         const uint8_t* data, uint32_t rowLength, uint32_t texelSize)
+{
+    if (!mMapped || !width || !height)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    const vk::DeviceSize rowSize = width * texelSize;
+    const vk::DeviceSize size = rowSize * height;
+    vk::Buffer buffer = *mRing.buffer;
+    uint8_t* dst = nullptr;
+    vk::DeviceSize offset = 0;
+    if (reserve(size, offset)) {
+        dst = mMapped + offset;
+    } else {
+        Staging staging = makeStaging(size);
+        if (!staging.buffer) {
+            printf("failed to allocate staging buffer for upload\n");
+            return false;
+        }
+        buffer = *staging.buffer;
+        dst = staging.memory.mapped();
+        mQueuedStaging.push_back(std::move(staging));
+        ++mStats.dedicatedStaging;
+    }
+
+    // tightly packed in staging
+    const vk::DeviceSize stride = rowLength * texelSize;
+    if (stride == rowSize) {
+        memcpy(dst, data, size);
+    } else {
+        for (uint32_t row = 0; row < height; ++row) {
+            memcpy(dst + row * rowSize, data + row * stride, rowSize);
+        }
+    }
+
+    vk::BufferImageCopy region(offset, 0, 0, { vk::ImageAspectFlagBits::eColor, 0, 0, 1 }, { x, y, 0 }, { width, height, 1 });
+    mQueued.push_back({ image, oldLayout, buffer, region });
+    if (oldLayout != vk::ImageLayout::eUndefined) {
+        mQueuedInUse = true;
+    }
+    ++mStats.uploads;
+    mStats.bytes += size;
+    return true;
+}
+
+void UploadQueue::submit()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    submitQueued();
+}
+
+void UploadQueue::submitQueued()
+{
+    if (mQueued.empty())
+        return;
+
+    const auto& window = mRender.window();
+    const auto& device = window.device();
+
+    // images frames may be drawing are uploaded to behind those frames
+    const bool transfer = mDedicated && !mQueuedInUse;
+    vk::CommandBufferAllocateInfo allocInfo(transfer ? *mTransferPool : *mGraphicsPool, vk::CommandBufferLevel::ePrimary, 1);
+    auto commandBuffers = device->allocateCommandBuffersUnique(allocInfo);
+    if (commandBuffers.empty() || !commandBuffers[0]) {
+        printf("failed to allocate upload command buffer\n");
+        return;
+    }
+
+    Batch batch;
+    batch.commandBuffer = std::move(commandBuffers[0]);
+    const vk::CommandBuffer commandBuffer = *batch.commandBuffer;
+    commandBuffer.begin(vk::CommandBufferBeginInfo(vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+
+    // every image once, the first upload to it has the layout it's in
+    const vk::ImageSubresourceRange range(vk::ImageAspectFlagBits::eColor, 0, 1, 0, 1);
+    std::vector<vk::ImageMemoryBarrier> before, after;
+    std::unordered_set<VkImage> images;
+    for (const auto& copy : mQueued) {
+        if (!images.insert(static_cast<VkImage>(copy.image)).second)
+            continue;
+        const vk::AccessFlags srcAccess = copy.oldLayout != vk::ImageLayout::eUndefined ? vk::AccessFlagBits::eShaderRead : vk::AccessFlags();
+        before.emplace_back(srcAccess, vk::AccessFlagBits::eTransferWrite, copy.oldLayout, vk::ImageLayout::eTransferDstOptimal,
+                            VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, copy.image, range);
+        // the semaphore makes the writes visible to the graphics queue
+        const vk::AccessFlags dstAccess = transfer ? vk::AccessFlags() : vk::AccessFlagBits::eShaderRead;
+        after.emplace_back(vk::AccessFlagBits::eTransferWrite, dstAccess, vk::ImageLayout::eTransferDstOptimal, vk::ImageLayout::eShaderReadOnlyOptimal,
+                           VK_QUEUE_FAMILY_IGNORED, VK_QUEUE_FAMILY_IGNORED, copy.image, range);
+    }
+
+    commandBuffer.pipelineBarrier(transfer ? vk::PipelineStageFlagBits::eTopOfPipe : vk::PipelineStageFlagBits::eFragmentShader,
+                                  vk::PipelineStageFlagBits::eTransfer, {}, {}, {}, before);
+    images.clear();
+    for (const auto& copy : mQueued) {
+        if (!images.insert(static_cast<VkImage>(copy.image)).second) {
+            // uploaded to twice, the second copy may overwrite what the first wrote
+            const vk::MemoryBarrier barrier(vk::AccessFlagBits::eTransferWrite, vk::AccessFlagBits::eTransferWrite);
+            commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer, vk::PipelineStageFlagBits::eTransfer, {}, { barrier }, {}, {});
+            images.clear();
+            images.insert(static_cast<VkImage>(copy.image));
+        }
+        commandBuffer.copyBufferToImage(copy.buffer, copy.image, vk::ImageLayout::eTransferDstOptimal, { copy.region });
+    }
+    commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+                                  transfer ? vk::PipelineStageFlagBits::eBottomOfPipe : vk::PipelineStageFlagBits::eFragmentShader,
+                                  {}, {}, {}, after);
+    commandBuffer.end();
+
+    vk::SubmitInfo submitInfo(0, nullptr, nullptr, 1, &commandBuffer);
+    std::vector<vk::Semaphore> waits;
+    std::vector<vk::PipelineStageFlags> waitStages;
+    if (transfer) {
+        batch.semaphore = device->createSemaphoreUnique(vk::SemaphoreCreateInfo());
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &*batch.semaphore;
+    } else {
+        // earlier uploads to the same images may still be going on the transfer queue. done by the
+        // time the frame after the last one rendered is
+        consumeWaits(mFrame + 1, vk::PipelineStageFlagBits::eTransfer, waits, waitStages);
+        submitInfo.waitSemaphoreCount = waits.size();
+        submitInfo.pWaitSemaphores = waits.data();
+        submitInfo.pWaitDstStageMask = waitStages.data();
+    }
+    batch.fence = device->createFenceUnique(vk::FenceCreateInfo());
+    if (!batch.fence || (transfer && !batch.semaphore)) {
+        printf("failed to create upload sync objects\n");
+        return;
+    }
+
+    try {
+        (transfer ? window.transferQueue() : window.graphicsQueue()).submit({ submitInfo }, *batch.fence);
+    } catch (const vk::Error& error) {
+        printf("failed to submit uploads\n");
+        return;
+    }
+
+    batch.ringEnd = mHead;
+    batch.staging = std::move(mQueuedStaging);
+    mQueuedStaging.clear();
+    mBatches.push_back(std::move(batch));
+    mQueued.clear();
+    mQueuedInUse = false;
+    ++mStats.submits;
+    if (transfer) {
+        ++mStats.transferSubmits;
+    }
+}
+
+void UploadQueue::release()
+{
+    const auto& device = mRender.window().device();
+
+    // in order, ring space is given back from the tail
+    for (auto& batch : mBatches) {
+        if (batch.done)
+            continue;
+        if (device->getFenceStatus(*batch.fence) != vk::Result::eSuccess)
+            break;
+        batch.done = true;
+        mTail = batch.ringEnd;
+        batch.staging.clear();
+        batch.commandBuffer.reset();
+    }
+
+    // a semaphore can go once the frame that waited on it is done
+    while (!mBatches.empty()) {
+        const auto& batch = mBatches.front();
+        if (!batch.done)
+            break;
+        if (batch.semaphore && (batch.waitFrame == NotWaited || batch.waitFrame + Window::MaxFramesInFlight > mFrame))
+            break;
+        mBatches.pop_front();
+    }
+}
+
+void UploadQueue::consumeWaits(uint64_t frame, vk::PipelineStageFlags stage, std::vector<vk::Semaphore>& semaphores,
+                               std::vector<vk::PipelineStageFlags>& stages)
+{
+    for (auto& batch : mBatches) {
+        if (!batch.semaphore || batch.waitFrame != NotWaited)
+            continue;
+        batch.waitFrame = frame;
+        semaphores.push_back(*batch.semaphore);
+        stages.push_back(stage);
+    }
+}
+
+void UploadQueue::takeWaits(uint64_t frame, std::vector<vk::Semaphore>& semaphores, std::vector<vk::PipelineStageFlags>& stages)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    // only fragment shaders read images
+    consumeWaits(frame, vk::PipelineStageFlagBits::eFragmentShader, semaphores, stages);
+}
+
+void UploadQueue::collect(uint64_t frame)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    // Window waited for the frame MaxFramesInFlight before this one
+    mFrame = frame;
+    release();
+}
+
+UploadQueue::Stats UploadQueue::stats() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void UploadQueue::printStats() const
+{
+    const Stats s = stats();
+    printf("uploads: %zu (%.1f MB) in %zu submits, %zu on the transfer queue, %zu too large for the staging ring\n",
+           s.uploads, s.bytes / (1024. * 1024.), s.submits, s.transferSubmits, s.dedicatedStaging);
+}
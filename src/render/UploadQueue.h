@@ -0,0 +1,137 @@
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+#include "MemoryAllocator.h"
+#include <vulkan/vulkan.hpp>
+#include <cstdint>
+#include <vector>
+#include <deque>
+#include <mutex>
+
+class Render;
+
+// Uploads of image contents, batched so that everything queued between two
+// submit() calls is one command buffer and one submit rather than a command
+// buffer, a submit and a wait for the queue to go idle per layout
+// transition and copy. upload() copies the texels into a persistent,
+// mapped staging ring right away and queues the copy, submit() records the
+// copies of the batch between one barrier that takes every image to
+// eTransferDstOptimal and one that takes them to eShaderReadOnlyOptimal.
+//
+// Nothing waits for a batch to finish. Batches that only upload to new
+// images go on the device's dedicated transfer queue when it has one, the
+// images are made with concurrent sharing (see share()) so no ownership
+// transfer is needed and the frame that first draws them waits on the
+// semaphore of the batch, see takeWaits(). A batch that uploads to an image
+// frames in flight may be drawing, such as the glyph atlas, goes on the
+// graphics queue behind those frames instead.
+//
+// The ring space of a batch is reused once its fence is signaled. When the
+// ring is full upload() submits what's queued and waits for the oldest
+// batch, an upload larger than the whole ring gets a staging buffer of its
+// own.
+//
+// upload(), share() and submit() can be called from any thread, drawables
+// are made on worker threads. takeWaits() and collect() are for the thread
+// that renders.
+class UploadQueue
+{
+public:
+    UploadQueue(const Render& render);
+    ~UploadQueue();
+
+    UploadQueue(const UploadQueue&) = delete;
+    UploadQueue& operator=(const UploadQueue&) = delete;
+
+    bool isValid() const { return mMapped != nullptr; }
+
+    // images that are uploaded to need to be made with this, it shares them between the
+    // transfer and graphics queue families if those are different
+    void share(vk::ImageCreateInfo& imageInfo) const;
+
+    // queues width x height texels at x, y of image from data, which has rowLength texels of
+    // texelSize bytes per row. oldLayout is eUndefined for an image that's never been uploaded to
+    // and eShaderReadOnlyOptimal otherwise, which is what the image is in once the batch is done
+    bool upload(vk::Image image, vk::ImageLayout oldLayout, int32_t x, int32_t y, uint32_t width, uint32_t height,
+                const uint8_t* data, uint32_t rowLength, uint32_t texelSize);
+
+    // submits what's queued, if anything
+    void submit();
+    // the semaphores of transfer queue batches nothing waited on yet, frame is the number of
+    // the frame that waits on them
+    void takeWaits(uint64_t frame, std::vector<vk::Semaphore>& semaphores, std::vector<vk::PipelineStageFlags>& stages);
+    // gives back what finished batches had, frame is the number of the frame about to be rendered
+    void collect(uint64_t frame);
+
+    struct Stats
+    {
+        size_t uploads { 0 }, submits { 0 }, transferSubmits { 0 }, dedicatedStaging { 0 };
+        vk::DeviceSize bytes { 0 };
+    };
+    Stats stats() const;
+    void printStats() const;
+
+private:
+    struct Staging
+    {
+        vk::UniqueBuffer buffer;
+        MemoryAllocator::Allocation memory;
+    };
+
+    struct Copy
+    {
+        vk::Image image;
+        vk::ImageLayout oldLayout;
+        // the ring or a staging buffer of its own
+        vk::Buffer buffer;
+        vk::BufferImageCopy region;
+    };
+
+    struct Batch
+    {
+        vk::UniqueCommandBuffer commandBuffer;
+        vk::UniqueFence fence;
+        // transfer queue batches only
+        vk::UniqueSemaphore semaphore;
+        // the frame that waits on the semaphore
+        uint64_t waitFrame { NotWaited };
+        // where the ring space of the batch ends
+        vk::DeviceSize ringEnd { 0 };
+        std::vector<Staging> staging;
+        // the fence is signaled, ring space and staging are given back
+        bool done { false };
+    };
+    static constexpr uint64_t NotWaited = UINT64_MAX;
+
+    Staging makeStaging(vk::DeviceSize size) const;
+    // room in the ring, waits for batches to finish if need be. false if size is more than the ring
+    bool reserve(vk::DeviceSize size, vk::DeviceSize& offset);
+    void submitQueued();
+    void release();
+    void consumeWaits(uint64_t frame, vk::PipelineStageFlags stage, std::vector<vk::Semaphore>& semaphores,
+                      std::vector<vk::PipelineStageFlags>& stages);
+
+private:
+    const Render& mRender;
+    bool mDedicated { false };
+    uint32_t mFamilies[2];
+    vk::UniqueCommandPool mGraphicsPool, mTransferPool;
+
+    Staging mRing;
+    uint8_t* mMapped { nullptr };
+    vk::DeviceSize mCapacity { 0 }, mAlignment { 16 };
+    // the next upload goes at mHead, mTail is where the oldest batch not done starts
+    vk::DeviceSize mHead { 0 }, mTail { 0 };
+
+    std::vector<Copy> mQueued;
+    std::vector<Staging> mQueuedStaging;
+    // something queued uploads to an image that may be in use
+    bool mQueuedInUse { false };
+    // in the order they were submitted
+    std::deque<Batch> mBatches;
+    uint64_t mFrame { 0 };
+    Stats mStats;
+    mutable std::mutex mMutex;
+};
+
+#endif // UPLOADQUEUE_H
@@ -0,0 +1,288 @@
+#include "Animator.h"
+#include <algorithm>
+#include <cmath>
+
+static inline float ease(Animator::Easing easing, float t)
+{
+    switch (easing) {
+    case Animator::Linear:
+        break;
+    case Animator::EaseIn:
+        return t * t;
+    case Animator::EaseOut:
+        return t * (2.f - t);
+    case Animator::EaseInOut:
+        return t < 0.5f ? 2.f * t * t : -1.f + (4.f - 2.f * t) * t;
+    case Animator::Step:
+        return 0.f;
+    }
+    return t;
+}
+
+Animator::Id Animator::animate(const std::shared_ptr<Scene::Item>& item, Property property, const std::vector<Keyframe>& keyframes, double start, bool loop)
+{
+    if (!item || keyframes.empty())
+        return Invalid;
+
+    // one animation per item and property, the new one wins
+    const auto existing = mSlots.find(item.get());
+    if (existing != mSlots.end()) {
+        for (size_t i = 0; i < mIds.size(); ++i) {
+            if (mSlot[i] == existing->second && mProperty[i] == property) {
+                remove(i);
+                break;
+            }
+        }
+    }
+
+    uint32_t slot;
+    const auto it = mSlots.find(item.get());
+    if (it != mSlots.end()) {
+        slot = it->second;
+    } else {
+        if (!mFreeSlots.empty()) {
+            slot = mFreeSlots.back();
+            mFreeSlots.pop_back();
+            mItems[slot] = item;
+            mItemFlags[slot] = 0;
+            mItemAnimations[slot] = 0;
+        } else {
+            slot = mItems.size();
+            mItems.push_back(item);
+            mItemFlags.push_back(0);
+            mItemAnimations.push_back(0);
+        }
+        mSlots[item.get()] = slot;
+    }
+    ++mItemAnimations[slot];
+
+    const Id id = mNextId++;
+    mIds.push_back(id);
+    mSlot.push_back(slot);
+    mProperty.push_back(property);
+    mStart.push_back(start);
+    mDuration.push_back(keyframes.back().time);
+    mFirstKey.push_back(mKeyTime.size());
+    mKeyCount.push_back(keyframes.size());
+    mLoop.push_back(loop && keyframes.back().time > 0.f);
+    mFinished.push_back(false);
+    // fading in an item with no background color shouldn't give it a black one
+    uint8_t targets = 0;
+    if (item->color.isValid())
+        targets |= OpacityColor;
+    if (!item->text.contents.empty())
+        targets |= OpacityText;
+    mTargets.push_back(targets);
+
+    for (const auto& keyframe : keyframes) {
+        mKeyTime.push_back(keyframe.time);
+        mKeyValue.push_back(keyframe.value);
+        mKeyEasing.push_back(keyframe.easing);
+    }
+    return id;
+}
+
+void Animator::remove(size_t index)
+{
+    const uint32_t slot = mSlot[index];
+    if (--mItemAnimations[slot] == 0) {
+        mSlots.erase(mItems[slot].get());
+        mItems[slot].reset();
+        mFreeSlots.push_back(slot);
+    }
+    mDeadKeys += mKeyCount[index];
+
+    // order doesn't matter, the last one takes its place
+    const size_t last = mIds.size() - 1;
+    mIds[index] = mIds[last];
+    mSlot[index] = mSlot[last];
+    mProperty[index] = mProperty[last];
+    mStart[index] = mStart[last];
+    mDuration[index] = mDuration[last];
+    mFirstKey[index] = mFirstKey[last];
+    mKeyCount[index] = mKeyCount[last];
+    mLoop[index] = mLoop[last];
+    mFinished[index] = mFinished[last];
+    mTargets[index] = mTargets[last];
+    mIds.pop_back();
+    mSlot.pop_back();
+    mProperty.pop_back();
+    mStart.pop_back();
+    mDuration.pop_back();
+    mFirstKey.pop_back();
+    mKeyCount.pop_back();
+    mLoop.pop_back();
+    mFinished.pop_back();
+    mTargets.pop_back();
+
+    if (mDeadKeys > mKeyTime.size() / 2) {
+        compactKeyframes();
+    }
+}
+
+void Animator::compactKeyframes()
+{
+    std::vector<float> times;
+    std::vector<std::array<float, 4> > values;
+    std::vector<Easing> easings;
+    times.reserve(mKeyTime.size() - mDeadKeys);
+    values.reserve(mKeyTime.size() - mDeadKeys);
+    easings.reserve(mKeyTime.size() - mDeadKeys);
+    for (size_t i = 0; i < mIds.size(); ++i) {
+        const uint32_t first = mFirstKey[i];
+        mFirstKey[i] = times.size();
+        times.insert(times.end(), mKeyTime.begin() + first, mKeyTime.begin() + first + mKeyCount[i]);
+        values.insert(values.end(), mKeyValue.begin() + first, mKeyValue.begin() + first + mKeyCount[i]);
+        easings.insert(easings.end(), mKeyEasing.begin() + first, mKeyEasing.begin() + first + mKeyCount[i]);
+    }
+    mKeyTime = std::move(times);
+    mKeyValue = std::move(values);
+    mKeyEasing = std::move(easings);
+    mDeadKeys = 0;
+}
+
+void Animator::stop(Id id)
+{
+    const auto it = std::find(mIds.begin(), mIds.end(), id);
+    if (it != mIds.end()) {
+        remove(it - mIds.begin());
+    }
+}
+
+void Animator::stop(const Scene::Item* item)
+{
+    const auto it = mSlots.find(item);
+    if (it == mSlots.end())
+        return;
+    const uint32_t slot = it->second;
+    for (size_t i = mIds.size(); i > 0; --i) {
+        if (mSlot[i - 1] == slot) {
+            remove(i - 1);
+        }
+    }
+}
+
+void Animator::clear()
+{
+    mIds.clear();
+    mSlot.clear();
+    mProperty.clear();
+    mStart.clear();
+    mDuration.clear();
+    mFirstKey.clear();
+    mKeyCount.clear();
+    mLoop.clear();
+    mFinished.clear();
+    mTargets.clear();
+    mKeyTime.clear();
+    mKeyValue.clear();
+    mKeyEasing.clear();
+    mDeadKeys = 0;
+    mItems.clear();
+    mItemFlags.clear();
+    mItemAnimations.clear();
+    mFreeSlots.clear();
+    mSlots.clear();
+}
+
+void Animator::update(double time, std::vector<Scene::Change>& changes)
+{
+    if (mIds.empty())
+        return;
+
+    std::fill(mItemFlags.begin(), mItemFlags.end(), 0);
+
+    bool finished = false;
+    const size_t count = mIds.size();
+    for (size_t i = 0; i < count; ++i) {
+        float t = static_cast<float>(time - mStart[i]);
+        const uint32_t first = mFirstKey[i];
+        const uint32_t keys = mKeyCount[i];
+        if (t < mKeyTime[first])
+            continue;
+        if (t >= mDuration[i]) {
+            if (mLoop[i]) {
+                // the start of later cycles holds the first keyframe rather than the item's own value
+                t = std::max(std::fmod(t, mDuration[i]), mKeyTime[first]);
+            } else {
+                t = mDuration[i];
+                mFinished[i] = true;
+                finished = true;
+            }
+        }
+
+        // keyframe counts are small, a scan beats anything smarter
+        uint32_t key = first;
+        while (key + 1 < first + keys && mKeyTime[key + 1] <= t)
+            ++key;
+
+        std::array<float, 4> value = mKeyValue[key];
+        if (key + 1 < first + keys) {
+            const float span = mKeyTime[key + 1] - mKeyTime[key];
+            const float progress = ease(mKeyEasing[key], span > 0.f ? (t - mKeyTime[key]) / span : 1.f);
+            const auto& next = mKeyValue[key + 1];
+            for (int c = 0; c < 4; ++c) {
+                value[c] += (next[c] - value[c]) * progress;
+            }
+        }
+
+        const uint32_t slot = mSlot[i];
+        Scene::Item& item = *mItems[slot];
+        switch (mProperty[i]) {
+        case Geometry:
+            item.geometry = { value[0], value[1], value[2], value[3] };
+            mItemFlags[slot] |= Scene::Change::Geometry;
+            break;
+        case Color:
+            item.color = { value[0], value[1], value[2], value[3] };
+            mItemFlags[slot] |= Scene::Change::Color;
+            break;
+        case Opacity:
+            if (mTargets[i] & OpacityColor) {
+                item.color.a = value[0];
+                mItemFlags[slot] |= Scene::Change::Color;
+            }
+            if (mTargets[i] & OpacityText) {
+                item.text.color.a = value[0];
+                mItemFlags[slot] |= Scene::Change::TextColor;
+            }
+            break;
+        }
+    }
+
+    for (size_t slot = 0; slot < mItems.size(); ++slot) {
+        if (mItemFlags[slot]) {
+            changes.push_back({ mItems[slot], mItemFlags[slot], {} });
+        }
+    }
+
+    if (finished) {
+        for (size_t i = mIds.size(); i > 0; --i) {
+            if (mFinished[i - 1]) {
+                remove(i - 1);
+            }
+        }
+    }
+}
+
+void Animator::applyChanges(const std::vector<Scene::Change>& changes)
+{
+    if (mIds.empty())
+        return;
+
+    // removed items take their descendants with them
+    std::vector<const Scene::Item*> stack;
+    for (const auto& change : changes) {
+        for (const auto& removed : change.removed) {
+            stack.push_back(removed.get());
+        }
+    }
+    while (!stack.empty()) {
+        const Scene::Item* item = stack.back();
+        stack.pop_back();
+        stop(item);
+        for (const auto& child : item->children) {
+            stack.push_back(child.get());
+        }
+    }
+}
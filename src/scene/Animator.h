@@ -0,0 +1,92 @@
+#ifndef ANIMATOR_H
+#define ANIMATOR_H
+
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include "Scene.h"
+
+// Keyframed animations of item geometry, background color and opacity.
+// Animations are stored as parallel arrays and their keyframes in shared
+// flat arrays, update() evaluates all of them in one loop, writes the
+// results into the items and appends one change per animated item for
+// Render::applyChanges. That writes the drawables' data in place, the draw
+// list is only collected and culled again when what moves is opaque, goes in
+// or out of the window or under an opaque item, or when a background becomes
+// opaque or stops being so. Nothing is allocated per frame once the changes
+// vector has grown to size.
+class Animator
+{
+public:
+    enum Property : uint8_t {
+        Geometry, // x, y, width, height
+        Color, // background color, r, g, b, a
+        Opacity // alpha of the background and text colors the item had when the animation started, first value only
+    };
+
+    // easing of the segment that starts at a keyframe
+    enum Easing : uint8_t { Linear, EaseIn, EaseOut, EaseInOut, Step };
+
+    struct Keyframe
+    {
+        float time; // seconds from the start of the animation
+        std::array<float, 4> value;
+        Easing easing;
+    };
+
+    typedef uint32_t Id;
+    static constexpr Id Invalid = 0;
+
+    // keyframes need to be sorted by time. before the first keyframe the
+    // item keeps its value, looping animations start over after the last one
+    Id animate(const std::shared_ptr<Scene::Item>& item, Property property, const std::vector<Keyframe>& keyframes, double start, bool loop = false);
+    void stop(Id id);
+    void stop(const Scene::Item* item);
+    void clear();
+
+    size_t size() const { return mIds.size(); }
+    bool empty() const { return mIds.empty(); }
+
+    // time is in seconds on the same clock as start, finished animations
+    // leave the item at their last keyframe and are removed
+    void update(double time, std::vector<Scene::Change>& changes);
+
+    // stops the animations of items that patches removed
+    void applyChanges(const std::vector<Scene::Change>& changes);
+
+private:
+    void remove(size_t index);
+    void compactKeyframes();
+
+    // per animation
+    std::vector<Id> mIds;
+    std::vector<uint32_t> mSlot; // into the per item arrays
+    std::vector<Property> mProperty;
+    std::vector<double> mStart;
+    std::vector<float> mDuration;
+    std::vector<uint32_t> mFirstKey, mKeyCount;
+    std::vector<uint8_t> mLoop;
+    std::vector<uint8_t> mFinished;
+    std::vector<uint8_t> mTargets; // OpacityColor | OpacityText
+
+    enum { OpacityColor = 0x1, OpacityText = 0x2 };
+
+    // keyframes of all animations
+    std::vector<float> mKeyTime;
+    std::vector<std::array<float, 4> > mKeyValue;
+    std::vector<Easing> mKeyEasing;
+    size_t mDeadKeys { 0 };
+
+    // per animated item
+    std::vector<std::shared_ptr<Scene::Item> > mItems;
+    std::vector<uint32_t> mItemFlags;
+    std::vector<uint32_t> mItemAnimations;
+    std::vector<uint32_t> mFreeSlots;
+    std::unordered_map<const Scene::Item*, uint32_t> mSlots;
+
+    Id mNextId { 1 };
+};
+
+#endif // ANIMATOR_H
@@ -0,0 +1,273 @@
+#include "FlatScene.h"
+#include "SceneBinary.h"
+#include "Decoder.h"
+#include <stdio.h>
+
+struct FlatCounts
+{
+    size_t items { 0 };
+    size_t texts { 0 };
+    size_t images { 0 };
+    size_t strings { 0 };
+};
+
+static void countItem(const Scene::Item& item, FlatCounts& counts)
+{
+    ++counts.items;
+    if (!item.text.contents.empty()) {
+        ++counts.texts;
+        counts.strings += item.text.contents.size() + 1;
+    }
+    if (!item.childrenSrc.empty()) {
+        counts.strings += item.childrenSrc.size() + 1;
+    }
+    for (const auto* image : { &item.image, &item.backgroundImage }) {
+        if (image->image || !image->src.empty()) {
+            ++counts.images;
+            counts.strings += image->src.size() + 1;
+        }
+    }
+    for (const auto& child : item.children) {
+        countItem(*child, counts);
+    }
+}
+
+void FlatScene::reserve(size_t items)
+{
+    geometry.reserve(items);
+    color.reserve(items);
+    text.reserve(items);
+    image.reserve(items);
+    backgroundImage.reserve(items);
+    parent.reserve(items);
+    firstChild.reserve(items);
+    nextSibling.reserve(items);
+    childrenSrc.reserve(items);
+}
+
+uint32_t FlatScene::addItem(uint32_t parentIndex, uint32_t& previousSibling)
+{
+    const uint32_t index = geometry.size();
+    geometry.push_back(Rect());
+    color.push_back(Color());
+    text.push_back(None);
+    image.push_back(None);
+    backgroundImage.push_back(None);
+    parent.push_back(parentIndex);
+    firstChild.push_back(None);
+    nextSibling.push_back(None);
+    childrenSrc.push_back(None);
+
+    if (previousSibling != None) {
+        nextSibling[previousSibling] = index;
+    } else if (parentIndex != None) {
+        firstChild[parentIndex] = index;
+    }
+    previousSibling = index;
+    return index;
+}
+
+uint32_t FlatScene::addString(const char* str, size_t len)
+{
+    const uint32_t offset = strings.size();
+    strings.insert(strings.end(), str, str + len);
+    strings.push_back('\0');
+    return offset;
+}
+
+uint32_t FlatScene::addString(const std::string& str)
+{
+    return addString(str.c_str(), str.size());
+}
+
+Text FlatScene::textAt(uint32_t item) const
+{
+    Text out;
+    if (text[item] == None)
+        return out;
+    const auto& ref = texts[text[item]];
+    out.contents = string(ref.contents);
+    out.color = ref.color;
+    out.size = ref.size;
+    out.bold = ref.bold;
+    out.italic = ref.italic;
+    return out;
+}
+
+static inline Scene::ImageData toImageData(const FlatScene& scene, uint32_t index)
+{
+    Scene::ImageData out;
+    if (index == FlatScene::None)
+        return out;
+    const auto& ref = scene.images[index];
+    out.sourceRect = ref.sourceRect;
+    out.src = scene.string(ref.src);
+    out.image = ref.image;
+    return out;
+}
+
+Scene::ImageData FlatScene::imageAt(uint32_t item) const
+{
+    return toImageData(*this, image[item]);
+}
+
+Scene::ImageData FlatScene::backgroundImageAt(uint32_t item) const
+{
+    return toImageData(*this, backgroundImage[item]);
+}
+
+FlatScene FlatScene::fromScene(const Scene& scene)
+{
+    FlatScene flat;
+    if (!scene.root)
+        return flat;
+    // every item gets its own slot, including those that come from a template
+    if (scene.hasInstances())
+        return fromScene(scene.expanded());
+
+    FlatCounts counts;
+    countItem(*scene.root, counts);
+    flat.reserve(counts.items);
+    flat.texts.reserve(counts.texts);
+    flat.images.reserve(counts.images);
+    flat.strings.reserve(counts.strings);
+
+    // pre-order, iterative so that deep scenes don't blow the stack
+    struct Entry
+    {
+        const Scene::Item* item;
+        uint32_t parent;
+    };
+    std::vector<Entry> stack;
+    std::vector<uint32_t> lastChild(counts.items, None);
+    uint32_t rootSibling = None;
+    stack.push_back({ scene.root.get(), None });
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        const auto& item = *entry.item;
+        const uint32_t index = flat.addItem(entry.parent, entry.parent == None ? rootSibling : lastChild[entry.parent]);
+        flat.geometry[index] = item.geometry;
+        flat.color[index] = item.color;
+        if (!item.text.contents.empty()) {
+            const auto& t = item.text;
+            flat.text[index] = flat.texts.size();
+            flat.texts.push_back({ flat.addString(t.contents), t.color, t.size, t.bold, t.italic });
+        }
+        if (!item.childrenSrc.empty()) {
+            flat.childrenSrc[index] = flat.addString(item.childrenSrc);
+        }
+        if (item.image.image || !item.image.src.empty()) {
+            flat.image[index] = flat.images.size();
+            flat.images.push_back({ item.image.sourceRect, flat.addString(item.image.src), item.image.image });
+        }
+        if (item.backgroundImage.image || !item.backgroundImage.src.empty()) {
+            flat.backgroundImage[index] = flat.images.size();
+            flat.images.push_back({ item.backgroundImage.sourceRect, flat.addString(item.backgroundImage.src), item.backgroundImage.image });
+        }
+
+        for (auto it = item.children.rbegin(); it != item.children.rend(); ++it) {
+            stack.push_back({ it->get(), index });
+        }
+    }
+    return flat;
+}
+
+FlatScene FlatScene::fromBinary(const uint8_t* data, size_t size, bool decodeImages)
+{
+    FlatScene flat;
+    const auto header = SceneBinary::validate(data, size);
+    if (!header || !header->itemCount)
+        return flat;
+
+    const auto itemRecords = SceneBinary::items(data, header);
+    const auto imageRecords = SceneBinary::images(data, header);
+
+    flat.reserve(header->itemCount);
+    flat.texts.reserve(header->itemCount);
+    flat.images.reserve(header->imageCount);
+    // the string table is used as is, offsets stay the same
+    const char* strings = SceneBinary::string(data, header, 0);
+    if (strings) {
+        flat.strings.assign(strings, strings + header->stringsSize);
+    }
+
+    Decoder decoder(Decoder::Format_Auto);
+    std::vector<uint32_t> imageIndex(header->imageCount, None);
+    auto image = [&](uint32_t record, uint32_t& out) -> bool {
+        if (record == SceneBinary::None)
+            return true;
+        if (record >= header->imageCount || imageRecords[record].src >= header->stringsSize)
+            return false;
+        if (imageIndex[record] == None) {
+            const auto& r = imageRecords[record];
+            imageIndex[record] = flat.images.size();
+            flat.images.push_back({ SceneBinary::rect(r.sourceRect), r.src,
+                                    decodeImages ? decoder.decode(flat.string(r.src)) : std::shared_ptr<Image>() });
+        }
+        out = imageIndex[record];
+        return true;
+    };
+
+    // the file is breadth first, convert to pre-order
+    struct Entry
+    {
+        uint32_t record;
+        uint32_t parent;
+    };
+    std::vector<Entry> stack;
+    std::vector<uint32_t> lastChild(header->itemCount, None);
+    std::vector<bool> seen(header->itemCount, false);
+    uint32_t rootSibling = None;
+    stack.push_back({ 0, None });
+    while (!stack.empty()) {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        const auto& record = itemRecords[entry.record];
+        if (seen[entry.record] || !SceneBinary::validChildren(header, record, entry.record)) {
+            printf("corrupt binary scene, invalid children\n");
+            return FlatScene();
+        }
+        seen[entry.record] = true;
+
+        const uint32_t index = flat.addItem(entry.parent, entry.parent == None ? rootSibling : lastChild[entry.parent]);
+        flat.geometry[index] = SceneBinary::rect(record.geometry);
+        flat.color[index] = SceneBinary::color(record.color);
+        if (record.textContents != SceneBinary::None) {
+            if (record.textContents >= header->stringsSize) {
+                printf("corrupt binary scene, invalid string\n");
+                return FlatScene();
+            }
+            flat.text[index] = flat.texts.size();
+            flat.texts.push_back({ record.textContents, SceneBinary::color(record.textColor), record.textSize,
+                                   (record.textFlags & SceneBinary::TextBold) != 0, (record.textFlags & SceneBinary::TextItalic) != 0 });
+        }
+        if (record.childrenSrc != SceneBinary::None) {
+            if (record.childrenSrc >= header->stringsSize) {
+                printf("corrupt binary scene, invalid string\n");
+                return FlatScene();
+            }
+            flat.childrenSrc[index] = record.childrenSrc;
+        }
+        if (!image(record.image, flat.image[index]) || !image(record.backgroundImage, flat.backgroundImage[index])) {
+            printf("corrupt binary scene, invalid image\n");
+            return FlatScene();
+        }
+
+        for (uint32_t c = record.childCount; c > 0; --c) {
+            stack.push_back({ record.firstChild + c - 1, index });
+        }
+    }
+    return flat;
+}
+
+FlatScene FlatScene::fromBinary(const std::string& path, bool decodeImages)
+{
+    FlatScene flat;
+    SceneBinary::mapFile(path, [&flat, decodeImages](const uint8_t* data, size_t size) {
+        flat = fromBinary(data, size, decodeImages);
+    });
+    return flat;
+}
@@ -0,0 +1,80 @@
+#ifndef FLATSCENE_H
+#define FLATSCENE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "Scene.h"
+
+// Structure of arrays version of Scene. Items are stored in pre-order (which
+// is also painter's order) and every per item property lives in its own
+// contiguous array, indexed by item. The tree is expressed through parent,
+// firstChild and nextSibling indices. Text contents and image srcs live in a
+// shared string table so building a FlatScene does a fixed number of
+// allocations regardless of the number of items.
+//
+// A read only snapshot for walking a scene in bulk, Render works on a Scene
+// since patches, templates and the spatial index need the item tree.
+class FlatScene
+{
+public:
+    static constexpr uint32_t None = 0xffffffff;
+
+    struct TextRef
+    {
+        uint32_t contents; // offset into strings
+        Color color;
+        uint32_t size;
+        bool bold, italic;
+    };
+
+    struct ImageRef
+    {
+        Rect sourceRect;
+        uint32_t src; // offset into strings
+        std::shared_ptr<Image> image;
+    };
+
+    // per item
+    std::vector<Rect> geometry;
+    std::vector<Color> color;
+    std::vector<uint32_t> text; // index into texts or None
+    std::vector<uint32_t> image; // index into images or None
+    std::vector<uint32_t> backgroundImage; // index into images or None
+    std::vector<uint32_t> parent, firstChild, nextSibling;
+    std::vector<uint32_t> childrenSrc; // offset into strings or None, not loaded by FlatScene
+
+    std::vector<TextRef> texts;
+    std::vector<ImageRef> images;
+    std::vector<char> strings;
+
+    size_t size() const { return geometry.size(); }
+    bool empty() const { return geometry.empty(); }
+
+    const char* string(uint32_t offset) const { return strings.data() + offset; }
+
+    // materialize the referenced text or image in the form Scene uses
+    Text textAt(uint32_t item) const;
+    Scene::ImageData imageAt(uint32_t item) const;
+    Scene::ImageData backgroundImageAt(uint32_t item) const;
+
+    template<typename Func>
+    void forEachChild(uint32_t item, Func&& func) const
+    {
+        for (uint32_t child = firstChild[item]; child != None; child = nextSibling[child])
+            func(child);
+    }
+
+    static FlatScene fromScene(const Scene& scene);
+    static FlatScene fromBinary(const std::string& path, bool decodeImages = true);
+    static FlatScene fromBinary(const uint8_t* data, size_t size, bool decodeImages = true);
+
+private:
+    void reserve(size_t items);
+    uint32_t addItem(uint32_t parentIndex, uint32_t& previousSibling);
+    uint32_t addString(const std::string& str);
+    uint32_t addString(const char* str, size_t len);
+};
+
+#endif // FLATSCENE_H
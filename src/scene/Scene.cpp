@@ -1,137 +1,545 @@
 #include "Scene.h"
+#include "SceneBuilder.h"
 #include "Fetch.h"
 #include "Decoder.h"
-#include <nlohmann/json.hpp>
+#include "SceneBinary.h"
+#include <algorithm>
 #include <assert.h>
 
-using json = nlohmann::json;
+bool SceneBuilder::finish()
+{
+    if (!mStarted || !mStack.empty())
+        return false;
+    // mInherit is in the order the nulls came in, an item's own x can come after its children's
+    std::stable_sort(mInherit.begin(), mInherit.end(), [](const Inherit& a, const Inherit& b) {
+        return a.depth < b.depth;
+    });
+    for (const auto& inherit : mInherit) {
+        if (inherit.x) {
+            inherit.item->geometry.x = inherit.parent->geometry.x;
+        } else {
+            inherit.item->geometry.y = inherit.parent->geometry.y;
+        }
+    }
+    mInherit.clear();
+
+    for (const auto& tmpl : mTemplateRoots) {
+        addTemplate(tmpl.first, tmpl.second);
+    }
+    mTemplateRoots.clear();
+    for (auto& pending : mInstances) {
+        instantiate(pending);
+    }
+    mInstances.clear();
+    mInstanceIndex.clear();
+    return true;
+}
 
-static inline void buildRect(Rect& rect, const json& obj)
+SceneBuilder::PendingInstance& SceneBuilder::pendingInstance(Scene::Item* item)
 {
-    for (auto& [key, value] : obj.items()) {
-        if (key == "x" && value.is_number()) {
-            rect.x = value.get<int32_t>();
-        } else if (key == "y" && value.is_number()) {
-            rect.y = value.get<int32_t>();
-        } else if (key == "width" && value.is_number()) {
-            rect.width = value.get<uint32_t>();
-        } else if (key == "height" && value.is_number()) {
-            rect.height = value.get<uint32_t>();
+    const auto it = mInstanceIndex.find(item);
+    if (it != mInstanceIndex.end())
+        return mInstances[it->second];
+    mInstanceIndex[item] = mInstances.size();
+    mInstances.push_back({ item, std::string(), {} });
+    return mInstances.back();
+}
+
+void SceneBuilder::addTemplate(const std::string& name, const std::shared_ptr<Scene::Item>& root)
+{
+    auto tmpl = std::make_shared<Scene::Template>();
+    tmpl->name = name;
+    tmpl->root = root;
+
+    // move the template to the origin, instances put it where they are
+    const float x = root->geometry.x, y = root->geometry.y;
+    root->geometry.x = root->geometry.y = 0.f;
+    float x0 = 0.f, y0 = 0.f, x1 = 0.f, y1 = 0.f;
+    bool bounded = false;
+    std::vector<Scene::Item*> stack;
+    for (auto it = root->children.rbegin(); it != root->children.rend(); ++it) {
+        stack.push_back(it->get());
+    }
+    while (!stack.empty()) {
+        Scene::Item* item = stack.back();
+        stack.pop_back();
+
+        auto& geometry = item->geometry;
+        geometry.x -= x;
+        geometry.y -= y;
+        if (geometry.isValid()) {
+            if (!bounded) {
+                bounded = true;
+                x0 = geometry.x;
+                y0 = geometry.y;
+                x1 = geometry.x + geometry.width;
+                y1 = geometry.y + geometry.height;
+            } else {
+                x0 = std::min(x0, geometry.x);
+                y0 = std::min(y0, geometry.y);
+                x1 = std::max(x1, geometry.x + geometry.width);
+                y1 = std::max(y1, geometry.y + geometry.height);
+            }
+            tmpl->bounds = { x0, y0, x1 - x0, y1 - y0 };
+        }
+        if (!item->childrenSrc.empty()) {
+            printf("childrenSrc isn't supported in template '%s'\n", name.c_str());
+            item->childrenSrc.clear();
+        }
+        if (!item->name.empty()) {
+            tmpl->names.emplace(item->name, tmpl->items.size());
+        }
+        tmpl->items.push_back(item);
+
+        for (auto it = item->children.rbegin(); it != item->children.rend(); ++it) {
+            stack.push_back(it->get());
         }
     }
+
+    // instances that already exist keep the definition they were made with
+    (*mTemplates)[name] = std::move(tmpl);
 }
 
-static inline void buildColor(Color& rect, const json& obj)
+void SceneBuilder::instantiate(PendingInstance& pending)
 {
-    for (auto& [key, value] : obj.items()) {
-        if (key == "r" && value.is_number()) {
-            rect.r = value.get<uint32_t>() / 255.f;
-        } else if (key == "g" && value.is_number()) {
-            rect.g = value.get<uint32_t>() / 255.f;
-        } else if (key == "b" && value.is_number()) {
-            rect.b = value.get<uint32_t>() / 255.f;
-        } else if (key == "a" && value.is_number()) {
-            rect.a = value.get<uint32_t>() / 255.f;
+    if (pending.tmpl.empty()) {
+        printf("overrides without a template\n");
+        return;
+    }
+    const auto it = mTemplates->find(pending.tmpl);
+    if (it == mTemplates->end()) {
+        printf("unknown template '%s'\n", pending.tmpl.c_str());
+        return;
+    }
+    const auto& tmpl = it->second;
+
+    // whatever the instance doesn't set itself comes from the template's root
+    auto& item = *pending.item;
+    const auto& root = *tmpl->root;
+    if (item.geometry.width == 0.f)
+        item.geometry.width = root.geometry.width;
+    if (item.geometry.height == 0.f)
+        item.geometry.height = root.geometry.height;
+    if (!item.color.isValid())
+        item.color = root.color;
+    if (item.text.contents.empty())
+        item.text = root.text;
+    if (item.image.src.empty())
+        item.image = root.image;
+    if (item.backgroundImage.src.empty())
+        item.backgroundImage = root.backgroundImage;
+
+    auto instance = std::make_shared<Scene::Instance>();
+    instance->tmpl = tmpl;
+    for (auto& pendingOverride : pending.overrides) {
+        const auto name = tmpl->names.find(pendingOverride.name);
+        if (name == tmpl->names.end()) {
+            printf("template '%s' has no item named '%s'\n", tmpl->name.c_str(), pendingOverride.name.c_str());
+            continue;
+        }
+        Scene::Instance::Override override { name->second, pendingOverride.hasText, pendingOverride.hasSrc, std::move(pendingOverride.text), Scene::ImageData() };
+        if (override.hasImage) {
+            override.image.sourceRect = tmpl->items[name->second]->image.sourceRect;
+            override.image.src = std::move(pendingOverride.src);
+            if (mDecoder && !override.image.src.empty()) {
+                override.image.image = mDecoder->decode(override.image.src);
+            }
+        }
+        // the last one for an item wins
+        auto existing = std::find_if(instance->overrides.begin(), instance->overrides.end(), [&override](const auto& o) {
+            return o.item == override.item;
+        });
+        if (existing != instance->overrides.end()) {
+            *existing = std::move(override);
+        } else {
+            instance->overrides.push_back(std::move(override));
         }
     }
+    std::sort(instance->overrides.begin(), instance->overrides.end(), [](const auto& a, const auto& b) {
+        return a.item < b.item;
+    });
+    item.instance = std::move(instance);
 }
 
-static inline void buildImage(Scene::ImageData& image, const json& obj, Decoder& decoder)
+bool SceneBuilder::null()
 {
-    for (auto& [key, value] : obj.items()) {
-        if (key == "sourceRect" && value.is_object()) {
-            buildRect(image.sourceRect, value);
-        } else if (key == "src" && value.is_string()) {
-            image.image = decoder.decode(value.get<std::string>());
+    if (mStack.empty())
+        return false;
+    const auto& frame = mStack.back();
+    if (frame.type == Frame::Item && frame.parent) {
+        if (mKey == "x") {
+            mInherit.push_back({ frame.item, frame.parent, true, mStack.size() });
+        } else if (mKey == "y") {
+            mInherit.push_back({ frame.item, frame.parent, false, mStack.size() });
         }
     }
+    return true;
 }
 
-static inline void buildText(Scene::Item& item, const json& obj)
+bool SceneBuilder::boolean(bool val)
 {
-    for (auto& [key, value] : obj.items()) {
-        if (key == "color" && value.is_object()) {
-            buildColor(item.text.color, value);
-        } else if (key == "contents" && value.is_string()) {
-            item.text.contents = value.get<std::string>();
-        } else if (key == "size" && value.is_number()) {
-            item.text.size = value.get<uint32_t>();
-        } else if (key == "weight" && value.is_string()) {
-            item.text.bold = value.get<std::string>() == "bold";
-        } else if (key == "style" && value.is_string()) {
-            item.text.italic = value.get<std::string>() == "italic";
+    if (mStack.empty())
+        return false;
+    if (mStack.back().type == Frame::Image && mKey == "background") {
+        mImage.background = val;
+    }
+    return true;
+}
+
+bool SceneBuilder::number(double val)
+{
+    if (mStack.empty())
+        return false;
+    const auto& frame = mStack.back();
+    switch (frame.type) {
+    case Frame::Item:
+        if (mKey == "x") {
+            frame.item->geometry.x = static_cast<int32_t>(val);
+        } else if (mKey == "y") {
+            frame.item->geometry.y = static_cast<int32_t>(val);
+        } else if (mKey == "width") {
+            frame.item->geometry.width = static_cast<uint32_t>(static_cast<int64_t>(val));
+        } else if (mKey == "height") {
+            frame.item->geometry.height = static_cast<uint32_t>(static_cast<int64_t>(val));
+        }
+        break;
+    case Frame::Rect:
+        if (mKey == "x") {
+            frame.rect->x = static_cast<int32_t>(val);
+        } else if (mKey == "y") {
+            frame.rect->y = static_cast<int32_t>(val);
+        } else if (mKey == "width") {
+            frame.rect->width = static_cast<uint32_t>(static_cast<int64_t>(val));
+        } else if (mKey == "height") {
+            frame.rect->height = static_cast<uint32_t>(static_cast<int64_t>(val));
+        }
+        break;
+    case Frame::Color: {
+        const float component = static_cast<uint32_t>(static_cast<int64_t>(val)) / 255.f;
+        if (mKey == "r") {
+            frame.color->r = component;
+        } else if (mKey == "g") {
+            frame.color->g = component;
+        } else if (mKey == "b") {
+            frame.color->b = component;
+        } else if (mKey == "a") {
+            frame.color->a = component;
+        }
+        break; }
+    case Frame::Text:
+        if (mKey == "size") {
+            frame.item->text.size = static_cast<uint32_t>(static_cast<int64_t>(val));
         }
+        break;
+    default:
+        break;
     }
+    return true;
 }
 
-static void build(Scene::Item& item, const json& obj, Decoder& decoder, Scene::Item* parent)
+bool SceneBuilder::string(string_t& val)
 {
-    for (auto& [key, value] : obj.items()) {
-        if (key == "x") {
-            if (value.is_number()) {
-                item.geometry.x = value.get<int32_t>();
-            } else if (value.is_null() && parent) {
-                item.geometry.x = parent->geometry.x;
+    if (mStack.empty())
+        return false;
+    const auto& frame = mStack.back();
+    switch (frame.type) {
+    case Frame::Item:
+        if (mKey == "childrenSrc") {
+            frame.item->childrenSrc = std::move(val);
+        } else if (mKey == "name") {
+            frame.item->name = std::move(val);
+        } else if (mKey == "template" && mTemplates) {
+            if (mTemplateDepth > 0) {
+                printf("templates can't contain instances\n");
+            } else {
+                pendingInstance(frame.item).tmpl = std::move(val);
             }
-        } else if (key == "y") {
-            if (value.is_number()) {
-                item.geometry.y = value.get<int32_t>();
-            } else if (value.is_null() && parent) {
-                item.geometry.y = parent->geometry.y;
-            }
-        } else if (key == "width" && value.is_number()) {
-            item.geometry.width = value.get<uint32_t>();
-        } else if (key == "height" && value.is_number()) {
-            item.geometry.height = value.get<uint32_t>();
-        } else if (key == "backgroundColor" && value.is_object()) {
-            buildColor(item.color, value);
-        } else if (key == "images" && value.is_array()) {
-            for (const auto& img : value) {
-                const auto isbg = img.value("background", false);
-                if (isbg) {
-                    buildImage(item.backgroundImage, img, decoder);
-                } else {
-                    buildImage(item.image, img, decoder);
-                }
-            }
-        } else if (key == "text" && value.is_object()) {
-            buildText(item, value);
         }
+        break;
+    case Frame::Override:
+        if (mKey == "text") {
+            mOverride.text = std::move(val);
+            mOverride.hasText = true;
+        } else if (mKey == "src") {
+            mOverride.src = std::move(val);
+            mOverride.hasSrc = true;
+        }
+        break;
+    case Frame::Text:
+        if (mKey == "contents") {
+            frame.item->text.contents = std::move(val);
+        } else if (mKey == "weight") {
+            frame.item->text.bold = val == "bold";
+        } else if (mKey == "style") {
+            frame.item->text.italic = val == "italic";
+        }
+        break;
+    case Frame::Image:
+        if (mKey == "src") {
+            mImage.src = std::move(val);
+        }
+        break;
+    default:
+        break;
     }
+    return true;
+}
+
+bool SceneBuilder::start_object(std::size_t)
+{
+    if (mStack.empty()) {
+        // the root needs to be an object
+        if (mStarted)
+            return false;
+        mStarted = true;
+        push(Frame::Item, &mRoot, mParent);
+        return true;
+    }
+
+    const auto& frame = mStack.back();
+    switch (frame.type) {
+    case Frame::Item:
+        if (mKey == "backgroundColor") {
+            push(Frame::Color, frame.item, nullptr, &frame.item->color);
+        } else if (mKey == "text") {
+            push(Frame::Text, frame.item);
+        } else if (mKey == "templates" && frame.item == &mRoot && !mParent && mTemplates) {
+            push(Frame::Templates, frame.item);
+            ++mTemplateDepth;
+        } else if (mKey == "overrides" && mTemplates && mTemplateDepth == 0) {
+            push(Frame::Overrides, frame.item);
+        } else {
+            push(Frame::Skip, frame.item);
+        }
+        break;
+    case Frame::Templates: {
+        // keyed by name, templates aren't part of the tree
+        auto root = std::make_shared<Scene::Item>();
+        mTemplateRoots.push_back(std::make_pair(mKey, root));
+        push(Frame::Item, root.get());
+        break; }
+    case Frame::Overrides:
+        mOverride = PendingOverride { mKey, std::string(), std::string(), false, false };
+        push(Frame::Override, frame.item);
+        break;
+    case Frame::Children: {
+        auto parent = frame.item;
+        parent->children.push_back(std::make_shared<Scene::Item>());
+        push(Frame::Item, parent->children.back().get(), parent);
+        break; }
+    case Frame::Images:
+        mImage = PendingImage { ::Rect(), std::string(), false, false };
+        push(Frame::Image, frame.item);
+        break;
+    case Frame::Image:
+        if (mKey == "sourceRect") {
+            push(Frame::Rect, frame.item, nullptr, nullptr, &mImage.sourceRect);
+            mImage.hasSourceRect = true;
+        } else {
+            push(Frame::Skip, frame.item);
+        }
+        break;
+    case Frame::Text:
+        if (mKey == "color") {
+            push(Frame::Color, frame.item, nullptr, &frame.item->text.color);
+        } else {
+            push(Frame::Skip, frame.item);
+        }
+        break;
+    default:
+        push(Frame::Skip, frame.item);
+        break;
+    }
+    mKey.clear();
+    return true;
+}
+
+bool SceneBuilder::key(string_t& val)
+{
+    mKey = std::move(val);
+    return true;
+}
 
-    try {
-        const auto children = obj.at("children");
-        if (children.is_array()) {
-            item.children.reserve(children.size());
-            for (auto& child : children) {
-                assert(child.is_object());
-                item.children.push_back(std::make_shared<Scene::Item>());
-                build(*item.children.back().get(), child, decoder, &item);
+bool SceneBuilder::end_object()
+{
+    assert(!mStack.empty());
+    const auto frame = mStack.back();
+    mStack.pop_back();
+    if (frame.type == Frame::Override) {
+        pendingInstance(frame.item).overrides.push_back(std::move(mOverride));
+    } else if (frame.type == Frame::Templates) {
+        --mTemplateDepth;
+    } else if (frame.type == Frame::Image) {
+        auto& image = mImage.background ? frame.item->backgroundImage : frame.item->image;
+        if (mImage.hasSourceRect) {
+            image.sourceRect = mImage.sourceRect;
+        }
+        if (!mImage.src.empty()) {
+            if (mDecoder) {
+                image.image = mDecoder->decode(mImage.src);
             }
+            image.src = std::move(mImage.src);
         }
-    } catch (const nlohmann::json::out_of_range& err) {
     }
+    mKey.clear();
+    return true;
 }
 
-Scene Scene::sceneFromJSON(const std::string& path)
+bool SceneBuilder::start_array(std::size_t)
 {
-    const Buffer jsondata = Fetch::fetch(path);
+    if (mStack.empty())
+        return false;
+    const auto& frame = mStack.back();
+    if (frame.type == Frame::Item && mKey == "children") {
+        push(Frame::Children, frame.item);
+    } else if (frame.type == Frame::Item && mKey == "images") {
+        push(Frame::Images, frame.item);
+    } else {
+        push(Frame::Skip, frame.item);
+    }
+    mKey.clear();
+    return true;
+}
 
-    try {
-        auto data = json::parse(jsondata.data(), jsondata.data() + jsondata.size());
-        if (!data.is_object()) {
-            return Scene();
+bool SceneBuilder::end_array()
+{
+    assert(!mStack.empty());
+    mStack.pop_back();
+    mKey.clear();
+    return true;
+}
+
+bool SceneBuilder::parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&)
+{
+    return false;
+}
+
+const Scene::Instance::Override* Scene::Instance::find(uint32_t item) const
+{
+    const auto it = std::lower_bound(overrides.begin(), overrides.end(), item, [](const Override& o, uint32_t i) {
+        return o.item < i;
+    });
+    return it != overrides.end() && it->item == item ? &*it : nullptr;
+}
+
+static std::shared_ptr<Scene::Item> copyTemplateItem(const Scene::Instance& instance, const Scene::Item& item, float x, float y, uint32_t& index)
+{
+    auto copy = std::make_shared<Scene::Item>(item);
+    copy->children.clear();
+    copy->geometry.x += x;
+    copy->geometry.y += y;
+    if (const auto* override = instance.find(index++)) {
+        if (override->hasText)
+            copy->text.contents = override->text;
+        if (override->hasImage)
+            copy->image = override->image;
+    }
+    for (const auto& child : item.children) {
+        copy->children.push_back(copyTemplateItem(instance, *child, x, y, index));
+    }
+    return copy;
+}
+
+std::vector<std::shared_ptr<Scene::Item> > Scene::Instance::expand(float x, float y) const
+{
+    std::vector<std::shared_ptr<Item> > items;
+    uint32_t index = 0;
+    for (const auto& child : tmpl->root->children) {
+        items.push_back(copyTemplateItem(*this, *child, x, y, index));
+    }
+    return items;
+}
+
+bool Scene::hasInstances() const
+{
+    if (!root)
+        return false;
+    std::vector<const Item*> stack;
+    stack.push_back(root.get());
+    while (!stack.empty()) {
+        const Item* item = stack.back();
+        stack.pop_back();
+        if (item->instance)
+            return true;
+        for (const auto& child : item->children) {
+            stack.push_back(child.get());
         }
+    }
+    return false;
+}
 
-        Scene scene;
-        scene.root = std::make_shared<Scene::Item>();
+static std::shared_ptr<Scene::Item> expandItem(const Scene::Item& item)
+{
+    auto copy = std::make_shared<Scene::Item>(item);
+    copy->children.clear();
+    copy->instance.reset();
+    if (item.instance) {
+        copy->children = item.instance->expand(item.geometry.x, item.geometry.y);
+    }
+    for (const auto& child : item.children) {
+        copy->children.push_back(expandItem(*child));
+    }
+    return copy;
+}
 
-        Decoder decoder(Decoder::Format_Auto);
-        build(*scene.root.get(), data, decoder, nullptr);
-        return scene;
-    } catch (const json::parse_error& error) {
+Scene Scene::expanded() const
+{
+    Scene scene;
+    if (root) {
+        scene.root = expandItem(*root);
+    }
+    return scene;
+}
+
+Scene Scene::sceneFromJSON(const std::string& path, bool decodeImages)
+{
+    const Buffer jsondata = Fetch::fetch(path);
+    if (jsondata.empty()) {
+        printf("unable to fetch scene '%s'\n", path.c_str());
+        return Scene();
+    }
+    return sceneFromJSON(jsondata.data(), jsondata.size(), decodeImages);
+}
+
+Scene Scene::sceneFromJSON(const uint8_t* data, size_t size, bool decodeImages)
+{
+    Scene scene;
+    scene.root = std::make_shared<Scene::Item>();
+
+    Decoder decoder(Decoder::Format_Auto);
+    SceneBuilder builder(*scene.root.get(), decodeImages ? &decoder : nullptr, nullptr, &scene.templates);
+    if (!json::sax_parse(data, data + size, &builder) || !builder.finish()) {
         printf("json parse error\n");
+        return Scene();
+    }
+    return scene;
+}
+
+Scene Scene::sceneFromFile(const std::string& path, bool decodeImages)
+{
+    if (path.find("://") == std::string::npos) {
+        // local files, only peek at the header here so binary scenes can be mapped
+        uint8_t header[SceneBinary::MagicSize];
+        FILE* f = fopen(path.c_str(), "r");
+        if (!f) {
+            printf("unable to open scene '%s'\n", path.c_str());
+            return Scene();
+        }
+        const size_t read = fread(header, 1, sizeof(header), f);
+        fclose(f);
+        if (SceneBinary::isBinary(header, read)) {
+            return sceneFromBinary(path, decodeImages);
+        }
+        return sceneFromJSON(path, decodeImages);
     }
 
-    return Scene();
+    const Buffer data = Fetch::fetch(path);
+    if (data.empty()) {
+        printf("unable to fetch scene '%s'\n", path.c_str());
+        return Scene();
+    }
+    if (SceneBinary::isBinary(data.data(), data.size())) {
+        return sceneFromBinary(data.data(), data.size(), decodeImages);
+    }
+    return sceneFromJSON(data.data(), data.size(), decodeImages);
 }
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 #include "Color.h"
 #include "Image.h"
 #include "Text.h"
@@ -16,9 +18,12 @@ public:
     {
     public:
         Rect sourceRect;
+        std::string src;
         std::shared_ptr<Image> image;
     };
 
+    class Instance;
+
     class Item
     {
     public:
@@ -28,11 +33,104 @@ public:
 
         ImageData image, backgroundImage;
         std::vector<std::shared_ptr<Item> > children;
+        // scene whose root's children become the children of this item once
+        // loaded, see SceneLoader. geometry is the bounds of that subtree
+        std::string childrenSrc;
+        // what instances refer to items inside of a template by
+        std::string name;
+        // set on instances of a template, the template's children are drawn
+        // before children, offset by the position of geometry
+        std::shared_ptr<const Instance> instance;
+    };
+
+    // Subtree defined once under "templates" and shared by all of its
+    // instances. Instances copy the properties of root they don't set
+    // themselves, root's descendants are never copied.
+    class Template
+    {
+    public:
+        std::string name;
+        // at 0, 0 and everything under it relative to that
+        std::shared_ptr<Item> root;
+        // root's descendants in pre-order, overrides refer to them by index
+        std::vector<const Item*> items;
+        std::unordered_map<std::string, uint32_t> names;
+        // of items, relative to root
+        Rect bounds;
+    };
+
+    class Instance
+    {
+    public:
+        struct Override
+        {
+            uint32_t item; // index in Template::items
+            bool hasText, hasImage;
+            std::string text;
+            ImageData image;
+        };
+
+        std::shared_ptr<const Template> tmpl;
+        // sorted by item
+        std::vector<Override> overrides;
+
+        const Override* find(uint32_t item) const;
+        // the template's children as standalone items placed at x, y
+        std::vector<std::shared_ptr<Item> > expand(float x, float y) const;
     };
 
+    typedef std::unordered_map<std::string, std::shared_ptr<Template> > Templates;
+
     std::shared_ptr<Item> root;
+    Templates templates;
+
+    bool hasInstances() const;
+    // deep copy with every instance replaced by a copy of its template, for
+    // consumers that don't know about templates
+    Scene expanded() const;
+
+    static Scene sceneFromJSON(const std::string& path, bool decodeImages = true);
+    static Scene sceneFromJSON(const uint8_t* data, size_t size, bool decodeImages = true);
+    static Scene sceneFromBinary(const std::string& path, bool decodeImages = true);
+    static Scene sceneFromBinary(const uint8_t* data, size_t size, bool decodeImages = true);
+    // picks the binary or json loader based on the contents of the file
+    static Scene sceneFromFile(const std::string& path, bool decodeImages = true);
+
+    bool writeBinary(const std::string& path) const;
+
+    // what a patch did to an item
+    struct Change
+    {
+        enum Flag {
+            Geometry = 0x1,
+            Color = 0x2,
+            TextColor = 0x4,
+            Text = 0x8, // contents, size or style, the text needs a new layout
+            Image = 0x10,
+            Children = 0x20, // children were added or removed, or childrenSrc changed
+            Instance = 0x40 // template or overrides changed
+        };
+
+        std::shared_ptr<Item> item;
+        uint32_t flags { 0 };
+        // items taken out of item's children, kept alive until the change is consumed
+        std::vector<std::shared_ptr<Item> > removed;
+    };
+
+    // Applies a JSON Patch (RFC 6902, an array of operations) or a JSON merge
+    // patch (RFC 7396, an object) to the scene. Paths use the same layout as
+    // the json scene files. Items are updated in place so that unchanged
+    // items keep their identity, and whatever changed is appended to
+    // changes. Operations are applied in order, if one of them fails the
+    // ones before it stay applied and false is returned.
+    bool applyPatch(const uint8_t* data, size_t size, std::vector<Change>& changes, bool decodeImages = true);
+    bool applyPatch(const std::string& patch, std::vector<Change>& changes, bool decodeImages = true);
 
-    static Scene sceneFromJSON(const std::string& path);
+    // Brings the scene to the state of fresh, typically the same file loaded
+    // again without decoding images, through the same in place update as
+    // applyPatch. Images are only decoded for srcs that weren't in the scene
+    // before or that are in staleImages, unchanged templates are kept.
+    bool reload(Scene&& fresh, std::vector<Change>& changes, const std::unordered_set<std::string>& staleImages = {}, bool decodeImages = true);
 };
 
 #endif // SCENE_H
@@ -0,0 +1,238 @@
+#include "Scene.h"
+#include "SceneBinary.h"
+#include "Decoder.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <unordered_map>
+
+constexpr char SceneBinary::Magic[SceneBinary::MagicSize];
+
+static inline bool validSection(size_t size, uint32_t offset, uint64_t bytes)
+{
+    return (offset % 4) == 0 && offset >= sizeof(SceneBinary::Header) && offset + bytes <= size;
+}
+
+const SceneBinary::Header* SceneBinary::validate(const uint8_t* data, size_t size)
+{
+    if (size < sizeof(Header) || !isBinary(data, size)) {
+        printf("not a binary scene\n");
+        return nullptr;
+    }
+
+    const auto header = reinterpret_cast<const Header*>(data);
+    if (header->version != Version || header->byteOrder != ByteOrder) {
+        printf("unsupported binary scene version %u\n", header->version);
+        return nullptr;
+    }
+    if (!validSection(size, header->itemsOffset, static_cast<uint64_t>(header->itemCount) * sizeof(ItemRecord))
+        || !validSection(size, header->imagesOffset, static_cast<uint64_t>(header->imageCount) * sizeof(ImageRecord))
+        || !validSection(size, header->stringsOffset, header->stringsSize)
+        || (header->stringsSize > 0 && data[header->stringsOffset + header->stringsSize - 1] != '\0')) {
+        printf("corrupt binary scene\n");
+        return nullptr;
+    }
+    return header;
+}
+
+bool SceneBinary::mapFile(const std::string& path, const std::function<void(const uint8_t* data, size_t size)>& func)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        printf("unable to open binary scene '%s'\n", path.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        printf("unable to stat binary scene '%s'\n", path.c_str());
+        return false;
+    }
+    void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        printf("unable to map binary scene '%s'\n", path.c_str());
+        return false;
+    }
+
+    func(static_cast<const uint8_t*>(data), st.st_size);
+    munmap(data, st.st_size);
+    return true;
+}
+
+Scene Scene::sceneFromBinary(const uint8_t* data, size_t size, bool decodeImages)
+{
+    const auto header = SceneBinary::validate(data, size);
+    if (!header || !header->itemCount) {
+        return Scene();
+    }
+
+    const auto itemRecords = SceneBinary::items(data, header);
+    const auto imageRecords = SceneBinary::images(data, header);
+
+    Decoder decoder(Decoder::Format_Auto);
+    auto image = [&](uint32_t index, ImageData& out) -> bool {
+        if (index == SceneBinary::None)
+            return true;
+        if (index >= header->imageCount)
+            return false;
+        const auto& record = imageRecords[index];
+        const char* src = SceneBinary::string(data, header, record.src);
+        if (!src)
+            return false;
+        out.sourceRect = SceneBinary::rect(record.sourceRect);
+        out.src = src;
+        if (decodeImages) {
+            out.image = decoder.decode(out.src);
+        }
+        return true;
+    };
+
+    // all items live in one allocation, the tree holds aliasing pointers into it
+    auto items = std::make_shared<std::vector<Item> >(header->itemCount);
+    auto itemPointer = [&items](uint32_t index) -> std::shared_ptr<Item> {
+        return std::shared_ptr<Item>(items, &(*items)[index]);
+    };
+
+    for (uint32_t i = 0; i < header->itemCount; ++i) {
+        const auto& record = itemRecords[i];
+        auto& item = (*items)[i];
+
+        item.geometry = SceneBinary::rect(record.geometry);
+        item.color = SceneBinary::color(record.color);
+        item.text.color = SceneBinary::color(record.textColor);
+        item.text.size = record.textSize;
+        item.text.bold = (record.textFlags & SceneBinary::TextBold) != 0;
+        item.text.italic = (record.textFlags & SceneBinary::TextItalic) != 0;
+        if (record.textContents != SceneBinary::None) {
+            const char* contents = SceneBinary::string(data, header, record.textContents);
+            if (!contents) {
+                printf("corrupt binary scene, invalid string\n");
+                return Scene();
+            }
+            item.text.contents = contents;
+        }
+
+        if (record.childrenSrc != SceneBinary::None) {
+            const char* src = SceneBinary::string(data, header, record.childrenSrc);
+            if (!src) {
+                printf("corrupt binary scene, invalid string\n");
+                return Scene();
+            }
+            item.childrenSrc = src;
+        }
+
+        if (!image(record.image, item.image) || !image(record.backgroundImage, item.backgroundImage)) {
+            printf("corrupt binary scene, invalid image\n");
+            return Scene();
+        }
+
+        if (!SceneBinary::validChildren(header, record, i)) {
+            printf("corrupt binary scene, invalid children\n");
+            return Scene();
+        }
+        item.children.reserve(record.childCount);
+        for (uint32_t c = 0; c < record.childCount; ++c) {
+            item.children.push_back(itemPointer(record.firstChild + c));
+        }
+    }
+
+    Scene scene;
+    scene.root = itemPointer(0);
+    return scene;
+}
+
+Scene Scene::sceneFromBinary(const std::string& path, bool decodeImages)
+{
+    Scene scene;
+    SceneBinary::mapFile(path, [&scene, decodeImages](const uint8_t* data, size_t size) {
+        scene = sceneFromBinary(data, size, decodeImages);
+    });
+    return scene;
+}
+
+bool Scene::writeBinary(const std::string& path) const
+{
+    if (!root) {
+        return false;
+    }
+    // the format has no templates, instances are written out in full
+    if (hasInstances()) {
+        return expanded().writeBinary(path);
+    }
+
+    std::vector<SceneBinary::ItemRecord> itemRecords;
+    std::vector<SceneBinary::ImageRecord> imageRecords;
+    std::vector<char> strings;
+    std::unordered_map<std::string, uint32_t> stringOffsets;
+
+    auto string = [&](const std::string& str) -> uint32_t {
+        const auto it = stringOffsets.find(str);
+        if (it != stringOffsets.end())
+            return it->second;
+        const uint32_t offset = strings.size();
+        strings.insert(strings.end(), str.begin(), str.end());
+        strings.push_back('\0');
+        stringOffsets[str] = offset;
+        return offset;
+    };
+
+    auto image = [&](const ImageData& data) -> uint32_t {
+        if (data.src.empty())
+            return SceneBinary::None;
+        const auto& r = data.sourceRect;
+        imageRecords.push_back({ { r.x, r.y, r.width, r.height }, string(data.src) });
+        return imageRecords.size() - 1;
+    };
+
+    // breadth first so that siblings end up next to each other
+    std::vector<const Item*> order;
+    order.push_back(root.get());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const Item* item = order[i];
+
+        SceneBinary::ItemRecord record;
+        const auto& g = item->geometry;
+        const auto& c = item->color;
+        const auto& t = item->text.color;
+        record.geometry[0] = g.x; record.geometry[1] = g.y; record.geometry[2] = g.width; record.geometry[3] = g.height;
+        record.color[0] = c.r; record.color[1] = c.g; record.color[2] = c.b; record.color[3] = c.a;
+        record.textColor[0] = t.r; record.textColor[1] = t.g; record.textColor[2] = t.b; record.textColor[3] = t.a;
+        record.textContents = item->text.contents.empty() ? SceneBinary::None : string(item->text.contents);
+        record.textSize = item->text.size;
+        record.textFlags = (item->text.bold ? SceneBinary::TextBold : 0) | (item->text.italic ? SceneBinary::TextItalic : 0);
+        record.image = image(item->image);
+        record.backgroundImage = image(item->backgroundImage);
+        record.firstChild = item->children.empty() ? SceneBinary::None : order.size();
+        record.childCount = item->children.size();
+        record.childrenSrc = item->childrenSrc.empty() ? SceneBinary::None : string(item->childrenSrc);
+        itemRecords.push_back(record);
+
+        for (const auto& child : item->children) {
+            order.push_back(child.get());
+        }
+    }
+
+    while (strings.size() % 4)
+        strings.push_back('\0');
+
+    SceneBinary::Header header;
+    memcpy(header.magic, SceneBinary::Magic, SceneBinary::MagicSize);
+    header.version = SceneBinary::Version;
+    header.byteOrder = SceneBinary::ByteOrder;
+    header.itemCount = itemRecords.size();
+    header.imageCount = imageRecords.size();
+    header.stringsSize = strings.size();
+    header.itemsOffset = sizeof(header);
+    header.imagesOffset = header.itemsOffset + itemRecords.size() * sizeof(SceneBinary::ItemRecord);
+    header.stringsOffset = header.imagesOffset + imageRecords.size() * sizeof(SceneBinary::ImageRecord);
+
+    Buffer out;
+    out.append(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    out.append(reinterpret_cast<const uint8_t*>(itemRecords.data()), itemRecords.size() * sizeof(SceneBinary::ItemRecord));
+    out.append(reinterpret_cast<const uint8_t*>(imageRecords.data()), imageRecords.size() * sizeof(SceneBinary::ImageRecord));
+    out.append(reinterpret_cast<const uint8_t*>(strings.data()), strings.size());
+    return out.writeFile(path);
+}
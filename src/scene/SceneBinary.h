@@ -0,0 +1,103 @@
+#ifndef SCENEBINARY_H
+#define SCENEBINARY_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <functional>
+#include "Color.h"
+#include "Rect.h"
+
+// Compact binary scene format, written by Scene::writeBinary and loaded by
+// Scene::sceneFromBinary. The file is a header followed by three sections:
+//
+//   items    ItemRecord[itemCount], breadth first so that the children of
+//            every item are stored contiguously at [firstChild, firstChild + childCount)
+//   images   ImageRecord[imageCount], asset references from the items
+//   strings  string table, nul terminated utf-8 strings referenced by offset
+//
+// Everything is stored little endian and 4 byte aligned so the sections can be
+// used directly from a mapping of the file.
+struct SceneBinary
+{
+    enum { MagicSize = 4 };
+    static constexpr char Magic[MagicSize] = { 'V', 'K', 'S', 'C' };
+    static constexpr uint32_t Version = 2;
+    static constexpr uint32_t ByteOrder = 0x01020304;
+    static constexpr uint32_t None = 0xffffffff;
+
+    enum TextFlags {
+        TextBold = 0x1,
+        TextItalic = 0x2
+    };
+
+    struct Header
+    {
+        char magic[MagicSize];
+        uint32_t version;
+        uint32_t byteOrder;
+        uint32_t itemCount;
+        uint32_t imageCount;
+        uint32_t stringsSize;
+        uint32_t itemsOffset;
+        uint32_t imagesOffset;
+        uint32_t stringsOffset;
+    };
+
+    struct ItemRecord
+    {
+        float geometry[4];
+        float color[4];
+        float textColor[4];
+        uint32_t textContents; // string offset or None
+        uint32_t textSize;
+        uint32_t textFlags;
+        uint32_t image; // image index or None
+        uint32_t backgroundImage; // image index or None
+        uint32_t firstChild;
+        uint32_t childCount;
+        uint32_t childrenSrc; // string offset or None
+    };
+
+    struct ImageRecord
+    {
+        float sourceRect[4];
+        uint32_t src; // string offset
+    };
+
+    static bool isBinary(const uint8_t* data, size_t size)
+    {
+        return size >= MagicSize && memcmp(data, Magic, MagicSize) == 0;
+    }
+
+    // returns the header if data holds a valid binary scene, nullptr otherwise
+    static const Header* validate(const uint8_t* data, size_t size);
+    // maps path read only and calls func with the contents
+    static bool mapFile(const std::string& path, const std::function<void(const uint8_t* data, size_t size)>& func);
+
+    static const ItemRecord* items(const uint8_t* data, const Header* header)
+    {
+        return reinterpret_cast<const ItemRecord*>(data + header->itemsOffset);
+    }
+    static const ImageRecord* images(const uint8_t* data, const Header* header)
+    {
+        return reinterpret_cast<const ImageRecord*>(data + header->imagesOffset);
+    }
+    static const char* string(const uint8_t* data, const Header* header, uint32_t offset)
+    {
+        if (offset >= header->stringsSize)
+            return nullptr;
+        return reinterpret_cast<const char*>(data + header->stringsOffset + offset);
+    }
+    // children come after their parent which also rules out cycles
+    static bool validChildren(const Header* header, const ItemRecord& record, uint32_t index)
+    {
+        return !record.childCount || (record.firstChild > index && static_cast<uint64_t>(record.firstChild) + record.childCount <= header->itemCount);
+    }
+
+    static Rect rect(const float* r) { return { r[0], r[1], r[2], r[3] }; }
+    static Color color(const float* c) { return { c[0], c[1], c[2], c[3] }; }
+};
+
+#endif // SCENEBINARY_H
@@ -0,0 +1,116 @@
+#ifndef SCENEBUILDER_H
+#define SCENEBUILDER_H
+
+#include "Scene.h"
+#include <nlohmann/json.hpp>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class Decoder;
+
+using json = nlohmann::json;
+
+// Builds Scene::Items directly from SAX events, there's no intermediate DOM.
+// Each open object/array in the input has a frame on mStack that says what
+// the keys and values inside of it are applied to.
+class SceneBuilder : public nlohmann::json_sax<json>
+{
+public:
+    // decoder may be null in which case images are only referenced by src,
+    // parent is what "x": null and "y": null on root resolve against.
+    // templates defined on a root without parent are added to templates and
+    // instances are resolved against them, without templates "template" is ignored
+    SceneBuilder(Scene::Item& root, Decoder* decoder, Scene::Item* parent = nullptr, Scene::Templates* templates = nullptr)
+        : mRoot(root), mDecoder(decoder), mParent(parent), mTemplates(templates)
+    {
+    }
+
+    bool finish();
+
+    bool null() override;
+    bool boolean(bool val) override;
+    bool number_integer(number_integer_t val) override { return number(static_cast<double>(val)); }
+    bool number_unsigned(number_unsigned_t val) override { return number(static_cast<double>(val)); }
+    bool number_float(number_float_t val, const string_t&) override { return number(val); }
+    bool string(string_t& val) override;
+    bool binary(binary_t&) override { return true; }
+    bool start_object(std::size_t) override;
+    bool key(string_t& val) override;
+    bool end_object() override;
+    bool start_array(std::size_t) override;
+    bool end_array() override;
+    bool parse_error(std::size_t, const std::string&, const nlohmann::detail::exception&) override;
+
+private:
+    bool number(double val);
+
+    struct Frame
+    {
+        enum Type { Item, Children, Images, Image, Text, Color, Rect, Templates, Overrides, Override, Skip } type;
+        Scene::Item* item;
+        Scene::Item* parent;
+        ::Color* color;
+        ::Rect* rect;
+    };
+
+    void push(Frame::Type type, Scene::Item* item, Scene::Item* parent = nullptr, ::Color* color = nullptr, ::Rect* rect = nullptr)
+    {
+        mStack.push_back({ type, item, parent, color, rect });
+    }
+
+    // "x": null and "y": null take the value of the parent, resolved
+    // once the whole tree is known since the parent's keys may come after
+    // its children in the input.
+    struct Inherit
+    {
+        Scene::Item* item;
+        Scene::Item* parent;
+        bool x;
+        // of item in the tree, parents are resolved first
+        size_t depth;
+    };
+
+    struct PendingImage
+    {
+        ::Rect sourceRect;
+        std::string src;
+        bool hasSourceRect;
+        bool background;
+    };
+
+    // instances are resolved once all templates are known
+    struct PendingOverride
+    {
+        std::string name, text, src;
+        bool hasText, hasSrc;
+    };
+
+    struct PendingInstance
+    {
+        Scene::Item* item;
+        std::string tmpl;
+        std::vector<PendingOverride> overrides;
+    };
+
+    PendingInstance& pendingInstance(Scene::Item* item);
+    void addTemplate(const std::string& name, const std::shared_ptr<Scene::Item>& root);
+    void instantiate(PendingInstance& pending);
+
+    Scene::Item& mRoot;
+    Decoder* mDecoder;
+    Scene::Item* mParent;
+    Scene::Templates* mTemplates;
+    std::vector<Frame> mStack;
+    std::vector<Inherit> mInherit;
+    PendingImage mImage;
+    std::vector<std::pair<std::string, std::shared_ptr<Scene::Item> > > mTemplateRoots;
+    std::vector<PendingInstance> mInstances;
+    std::unordered_map<Scene::Item*, size_t> mInstanceIndex;
+    PendingOverride mOverride;
+    int mTemplateDepth { 0 };
+    std::string mKey;
+    bool mStarted { false };
+};
+
+#endif // SCENEBUILDER_H
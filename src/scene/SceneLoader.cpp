@@ -0,0 +1,267 @@
+#include "SceneLoader.h"
+#include <algorithm>
+#include <stdio.h>
+
+static size_t itemBytes(const Scene::Item& item)
+{
+    size_t bytes = sizeof(Scene::Item) + item.text.contents.size() + item.childrenSrc.size();
+    for (const auto image : { &item.image, &item.backgroundImage }) {
+        bytes += image->src.size();
+        if (image->image) {
+            bytes += sizeof(Image) + image->image->data.size();
+        }
+    }
+    if (item.instance) {
+        // the template itself is shared
+        for (const auto& override : item.instance->overrides) {
+            bytes += sizeof(override) + override.text.size() + override.image.src.size();
+            if (override.image.image) {
+                bytes += sizeof(Image) + override.image.image->data.size();
+            }
+        }
+    }
+    for (const auto& child : item.children) {
+        bytes += itemBytes(*child);
+    }
+    return bytes;
+}
+
+SceneLoader::SceneLoader(Scene& scene, bool decodeImages)
+    : mScene(scene), mDecodeImages(decodeImages)
+{
+    if (mScene.root) {
+        track(mScene.root);
+    }
+    mThread = std::thread(&SceneLoader::run, this);
+}
+
+SceneLoader::~SceneLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+    }
+    mCondition.notify_one();
+    mThread.join();
+}
+
+void SceneLoader::run()
+{
+    for (;;) {
+        Request request;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCondition.wait(lock, [this]() { return mStopped || !mRequests.empty(); });
+            if (mStopped)
+                return;
+            request = std::move(mRequests.front());
+            mRequests.pop_front();
+        }
+
+        Result result { request.item, request.generation, Scene::sceneFromFile(request.src, mDecodeImages), 0 };
+        if (!result.scene.root) {
+            printf("unable to load children from '%s'\n", request.src.c_str());
+        } else {
+            result.bytes = itemBytes(*result.scene.root);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mResults.push_back(std::move(result));
+        }
+        if (mLoaded) {
+            mLoaded();
+        }
+    }
+}
+
+void SceneLoader::track(const std::shared_ptr<Scene::Item>& item)
+{
+    if (!item->childrenSrc.empty()) {
+        auto it = mSubtrees.find(item.get());
+        if (it == mSubtrees.end()) {
+            // children that came with the item, rather than from the src, stay until it's loaded
+            mSubtrees[item.get()] = { Subtree::Unloaded, item, item->childrenSrc, 0, 0, ++mGeneration };
+        } else if (it->second.src != item->childrenSrc) {
+            // the patch that changed the src also dropped the children
+            mUsage -= it->second.bytes;
+            it->second = { Subtree::Unloaded, item, item->childrenSrc, 0, 0, ++mGeneration };
+        }
+    } else {
+        const auto it = mSubtrees.find(item.get());
+        if (it != mSubtrees.end()) {
+            mUsage -= it->second.bytes;
+            mSubtrees.erase(it);
+        }
+    }
+    for (const auto& child : item->children) {
+        track(child);
+    }
+}
+
+void SceneLoader::forget(const Scene::Item& item)
+{
+    const auto it = mSubtrees.find(&item);
+    if (it != mSubtrees.end()) {
+        mUsage -= it->second.bytes;
+        mSubtrees.erase(it);
+    }
+    for (const auto& child : item.children) {
+        forget(*child);
+    }
+}
+
+void SceneLoader::request(Subtree& subtree)
+{
+    if (subtree.state != Subtree::Unloaded)
+        return;
+    subtree.state = Subtree::Loading;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mRequests.push_back({ subtree.item.get(), subtree.generation, subtree.src });
+    }
+    mCondition.notify_one();
+}
+
+void SceneLoader::preload(const Scene::Item* item)
+{
+    const auto it = mSubtrees.find(item);
+    if (it != mSubtrees.end()) {
+        request(it->second);
+    }
+}
+
+void SceneLoader::attach(Result& result, std::vector<Scene::Change>& changes)
+{
+    const auto it = mSubtrees.find(result.item);
+    if (it == mSubtrees.end() || it->second.generation != result.generation || it->second.state != Subtree::Loading)
+        return;
+    auto& subtree = it->second;
+    if (!result.scene.root) {
+        // not retried until the src changes
+        subtree.state = Subtree::Loaded;
+        return;
+    }
+
+    auto& item = subtree.item;
+    for (const auto& child : item->children) {
+        forget(*child);
+    }
+    changes.push_back({ item, Scene::Change::Children, std::move(item->children) });
+    item->children = std::move(result.scene.root->children);
+    // so that patches can make instances of templates from loaded subtrees
+    for (const auto& tmpl : result.scene.templates) {
+        mScene.templates.emplace(tmpl.first, tmpl.second);
+    }
+    subtree.state = Subtree::Loaded;
+    subtree.bytes = result.bytes;
+    subtree.lastVisible = mFrame;
+    mUsage += result.bytes;
+
+    // loaded subtrees can have childrenSrc of their own
+    for (const auto& child : item->children) {
+        track(child);
+    }
+}
+
+void SceneLoader::unload(Subtree& subtree, std::vector<Scene::Change>& changes)
+{
+    if (subtree.state == Subtree::Unloaded)
+        return;
+    auto item = subtree.item;
+    for (const auto& child : item->children) {
+        forget(*child);
+    }
+    changes.push_back({ item, Scene::Change::Children, std::move(item->children) });
+    item->children.clear();
+    mUsage -= subtree.bytes;
+    subtree.bytes = 0;
+    subtree.state = Subtree::Unloaded;
+    // a load that's still in flight is dropped when it completes
+    subtree.generation = ++mGeneration;
+}
+
+void SceneLoader::unload(const Scene::Item* item, std::vector<Scene::Change>& changes)
+{
+    const auto it = mSubtrees.find(item);
+    if (it != mSubtrees.end()) {
+        unload(it->second, changes);
+    }
+}
+
+void SceneLoader::reload(const std::vector<std::string>& srcs, std::vector<Scene::Change>& changes)
+{
+    std::vector<const Scene::Item*> items;
+    for (const auto& subtree : mSubtrees) {
+        if (std::find(srcs.begin(), srcs.end(), subtree.second.src) != srcs.end()) {
+            items.push_back(subtree.first);
+        }
+    }
+    // unloading one subtree can take others inside of it with it
+    for (const auto* item : items) {
+        unload(item, changes);
+    }
+}
+
+void SceneLoader::trim(std::vector<Scene::Change>& changes)
+{
+    if (!mBudget || mUsage <= mBudget)
+        return;
+
+    // least recently visible first, never what's visible right now
+    std::vector<std::pair<uint64_t, const Scene::Item*> > loaded;
+    for (const auto& subtree : mSubtrees) {
+        if (subtree.second.state == Subtree::Loaded && subtree.second.bytes > 0 && subtree.second.lastVisible < mFrame) {
+            loaded.push_back(std::make_pair(subtree.second.lastVisible, subtree.first));
+        }
+    }
+    std::sort(loaded.begin(), loaded.end());
+    for (const auto& candidate : loaded) {
+        if (mUsage <= mBudget)
+            break;
+        // unloading an outer subtree also takes the ones inside of it
+        const auto it = mSubtrees.find(candidate.second);
+        if (it != mSubtrees.end()) {
+            unload(it->second, changes);
+        }
+    }
+}
+
+void SceneLoader::update(const SpatialIndex& index, const Rect& viewport, std::vector<Scene::Change>& changes)
+{
+    ++mFrame;
+
+    std::vector<Result> results;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::swap(results, mResults);
+    }
+    for (auto& result : results) {
+        attach(result, changes);
+    }
+
+    index.query(viewport, mVisible);
+    for (const auto* item : mVisible) {
+        const auto it = mSubtrees.find(item);
+        if (it == mSubtrees.end())
+            continue;
+        it->second.lastVisible = mFrame;
+        request(it->second);
+    }
+
+    trim(changes);
+}
+
+void SceneLoader::applyChanges(const std::vector<Scene::Change>& changes)
+{
+    for (const auto& change : changes) {
+        for (const auto& removed : change.removed) {
+            forget(*removed);
+        }
+    }
+    for (const auto& change : changes) {
+        if (change.flags & Scene::Change::Children) {
+            track(change.item);
+        }
+    }
+}
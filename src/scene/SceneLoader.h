@@ -0,0 +1,104 @@
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include "Scene.h"
+#include "SpatialIndex.h"
+
+// Loads the children of items with a childrenSrc when they become visible or
+// when asked to with preload(). Fetching, parsing and image decoding happen
+// on a worker thread, the results are attached to the scene from update()
+// which also unloads the least recently visible subtrees when the memory
+// used by loaded subtrees goes over the budget. The changes update() and
+// unload() produce are meant for Render::applyChanges.
+//
+// All functions need to be called from the thread that owns the scene.
+class SceneLoader
+{
+public:
+    SceneLoader(Scene& scene, bool decodeImages = true);
+    ~SceneLoader();
+
+    // requests the subtrees that intersect viewport and attaches the ones that finished loading
+    void update(const SpatialIndex& index, const Rect& viewport, std::vector<Scene::Change>& changes);
+
+    void preload(const Scene::Item* item);
+    void unload(const Scene::Item* item, std::vector<Scene::Change>& changes);
+    // unloads the subtrees loaded from any of srcs, they're loaded again once visible
+    void reload(const std::vector<std::string>& srcs, std::vector<Scene::Change>& changes);
+
+    // bytes of scene data (items, strings, decoded images) in loaded subtrees, 0 means no limit
+    void setMemoryBudget(size_t bytes) { mBudget = bytes; }
+    size_t memoryBudget() const { return mBudget; }
+    size_t memoryUsage() const { return mUsage; }
+
+    // keeps track of items that come or go through Scene::applyPatch
+    void applyChanges(const std::vector<Scene::Change>& changes);
+
+    // called on the worker thread whenever a subtree finished loading, for waking up a
+    // loop that waits for events. set it before the first update()
+    void setLoadedCallback(std::function<void()>&& callback) { mLoaded = std::move(callback); }
+
+private:
+    struct Subtree
+    {
+        enum State { Unloaded, Loading, Loaded } state;
+        std::shared_ptr<Scene::Item> item;
+        std::string src;
+        size_t bytes;
+        uint64_t lastVisible;
+        uint64_t generation; // results for older generations are dropped
+    };
+
+    struct Request
+    {
+        const Scene::Item* item;
+        uint64_t generation;
+        std::string src;
+    };
+
+    struct Result
+    {
+        const Scene::Item* item;
+        uint64_t generation;
+        Scene scene;
+        size_t bytes;
+    };
+
+    void track(const std::shared_ptr<Scene::Item>& item);
+    void forget(const Scene::Item& item);
+    void request(Subtree& subtree);
+    void attach(Result& result, std::vector<Scene::Change>& changes);
+    void unload(Subtree& subtree, std::vector<Scene::Change>& changes);
+    void trim(std::vector<Scene::Change>& changes);
+    void run();
+
+private:
+    Scene& mScene;
+    bool mDecodeImages;
+    std::unordered_map<const Scene::Item*, Subtree> mSubtrees;
+    std::vector<const Scene::Item*> mVisible;
+    uint64_t mFrame { 0 };
+    uint64_t mGeneration { 0 };
+    size_t mBudget { 0 };
+    size_t mUsage { 0 };
+
+    std::function<void()> mLoaded;
+    std::thread mThread;
+    std::mutex mMutex;
+    std::condition_variable mCondition;
+    std::deque<Request> mRequests;
+    std::vector<Result> mResults;
+    bool mStopped { false };
+};
+
+#endif // SCENELOADER_H
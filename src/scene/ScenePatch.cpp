@@ -0,0 +1,791 @@
+#include "Scene.h"
+#include "SceneBuilder.h"
+#include "Decoder.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cmath>
+#include <stdio.h>
+
+static inline bool sameRect(const Rect& a, const Rect& b)
+{
+    return a.x == b.x && a.y == b.y && a.width == b.width && a.height == b.height;
+}
+
+static inline bool sameColor(const Color& a, const Color& b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static json colorToJSON(const Color& color)
+{
+    auto component = [](float c) { return static_cast<int>(std::lround(c * 255.f)); };
+    return { { "r", component(color.r) }, { "g", component(color.g) }, { "b", component(color.b) }, { "a", component(color.a) } };
+}
+
+static json rectToJSON(const Rect& rect)
+{
+    return { { "x", rect.x }, { "y", rect.y }, { "width", rect.width }, { "height", rect.height } };
+}
+
+// the json form of an item, laid out like the scene files
+static json itemToJSON(const Scene::Item& item, bool withChildren)
+{
+    json out = rectToJSON(item.geometry);
+    out["backgroundColor"] = colorToJSON(item.color);
+
+    const auto& text = item.text;
+    out["text"] = { { "contents", text.contents }, { "size", text.size }, { "color", colorToJSON(text.color) },
+                    { "weight", text.bold ? "bold" : "normal" }, { "style", text.italic ? "italic" : "normal" } };
+
+    json images = json::array();
+    auto image = [&images](const Scene::ImageData& data, bool background) {
+        if (data.src.empty())
+            return;
+        images.push_back({ { "src", data.src }, { "sourceRect", rectToJSON(data.sourceRect) }, { "background", background } });
+    };
+    image(item.image, false);
+    image(item.backgroundImage, true);
+    out["images"] = std::move(images);
+    if (!item.childrenSrc.empty()) {
+        out["childrenSrc"] = item.childrenSrc;
+    }
+    if (!item.name.empty()) {
+        out["name"] = item.name;
+    }
+    if (item.instance) {
+        const auto& tmpl = *item.instance->tmpl;
+        out["template"] = tmpl.name;
+        json overrides = json::object();
+        for (const auto& override : item.instance->overrides) {
+            json value = json::object();
+            if (override.hasText)
+                value["text"] = override.text;
+            if (override.hasImage)
+                value["src"] = override.image.src;
+            overrides[tmpl.items[override.item]->name] = std::move(value);
+        }
+        out["overrides"] = std::move(overrides);
+    }
+
+    if (withChildren) {
+        json children = json::array();
+        for (const auto& child : item.children) {
+            children.push_back(itemToJSON(*child, true));
+        }
+        out["children"] = std::move(children);
+    }
+    return out;
+}
+
+// SceneBuilder works on SAX events so values are replayed through it,
+// instances are resolved against the templates of the scene
+static bool buildItem(const json& value, Scene::Item& item, Scene::Item* parent, Scene::Templates& templates)
+{
+    if (!value.is_object())
+        return false;
+    const std::string data = value.dump();
+    SceneBuilder builder(item, nullptr, parent, &templates);
+    return json::sax_parse(data.begin(), data.end(), &builder) && builder.finish();
+}
+
+static inline bool sameOverrides(const Scene::Instance& a, const Scene::Instance& b)
+{
+    if (a.overrides.size() != b.overrides.size())
+        return false;
+    for (size_t i = 0; i < a.overrides.size(); ++i) {
+        const auto& oa = a.overrides[i];
+        const auto& ob = b.overrides[i];
+        if (oa.item != ob.item || oa.hasText != ob.hasText || oa.hasImage != ob.hasImage || oa.text != ob.text
+            || oa.image.src != ob.image.src || !sameRect(oa.image.sourceRect, ob.image.sourceRect))
+            return false;
+    }
+    return true;
+}
+
+static bool splitPointer(const std::string& path, std::vector<std::string>& tokens)
+{
+    if (path.empty())
+        return true;
+    if (path[0] != '/')
+        return false;
+    std::string token;
+    for (size_t i = 1; i <= path.size(); ++i) {
+        if (i == path.size() || path[i] == '/') {
+            tokens.push_back(std::move(token));
+            token.clear();
+        } else if (path[i] == '~') {
+            if (i + 1 == path.size() || (path[i + 1] != '0' && path[i + 1] != '1'))
+                return false;
+            token.push_back(path[++i] == '0' ? '~' : '/');
+        } else {
+            token.push_back(path[i]);
+        }
+    }
+    return true;
+}
+
+static bool parseIndex(const std::string& token, size_t& index)
+{
+    if (token.empty() || token.size() > 9 || (token.size() > 1 && token[0] == '0'))
+        return false;
+    index = 0;
+    for (char c : token) {
+        if (c < '0' || c > '9')
+            return false;
+        index = index * 10 + (c - '0');
+    }
+    return true;
+}
+
+class ScenePatcher
+{
+public:
+    ScenePatcher(Scene& scene, std::vector<Scene::Change>& changes, Decoder* decoder)
+        : mScene(scene), mChanges(changes), mDecoder(decoder)
+    {
+    }
+
+    bool apply(const json& patch);
+    // brings the scene to the state of fresh, images in stale are decoded again
+    bool reload(Scene& fresh, const std::unordered_set<std::string>& stale);
+
+private:
+    // what a path points at
+    struct Location
+    {
+        enum Type {
+            Root,
+            Child, // item->children[index], index may be one past the end for add
+            Children, // the children array of item
+            Property // property inside of item
+        } type;
+        std::shared_ptr<Scene::Item> item;
+        Scene::Item* parent;
+        size_t index;
+        std::string property;
+    };
+
+    bool resolve(const std::string& path, Location& location) const;
+    bool get(const Location& location, json& value) const;
+    bool add(const Location& location, const json& value);
+    bool replace(const Location& location, const json& value);
+    bool remove(const Location& location);
+    bool patchProperty(const char* op, const Location& location, const json* value);
+
+    bool applyOperation(const json& operation);
+    bool applyMergePatch(const json& patch);
+
+    void reconcile(const std::shared_ptr<Scene::Item>& item, Scene::Item& fresh, bool withChildren);
+    void reconcileChildren(const std::shared_ptr<Scene::Item>& item, std::vector<std::shared_ptr<Scene::Item> >& fresh);
+    bool reconcileImage(Scene::ImageData& image, Scene::ImageData& fresh);
+    void refreshStale(const std::shared_ptr<Scene::Item>& item);
+
+    std::shared_ptr<Image> decode(const std::string& src);
+    void decodeItem(Scene::Item& item);
+    std::shared_ptr<const Scene::Instance> decodeInstance(const Scene::Instance& instance, const Scene::Instance* previous);
+    bool isStale(const std::string& src) const { return mStale && mStale->count(src); }
+    bool isStale(const Scene::Instance& instance) const;
+    bool usesStale(const Scene::Item& item) const;
+    void collectImages(const Scene::Item& item);
+
+    Scene::Change& change(const std::shared_ptr<Scene::Item>& item);
+
+private:
+    Scene& mScene;
+    std::vector<Scene::Change>& mChanges;
+    std::unordered_map<const Scene::Item*, size_t> mChangeIndex;
+    Decoder* mDecoder;
+    // decoded images by src, only filled for reloads
+    std::unordered_map<std::string, std::shared_ptr<Image> > mImages;
+    const std::unordered_set<std::string>* mStale { nullptr };
+};
+
+std::shared_ptr<Image> ScenePatcher::decode(const std::string& src)
+{
+    if (src.empty() || !mDecoder)
+        return {};
+    const auto it = mImages.find(src);
+    if (it != mImages.end())
+        return it->second;
+    auto image = mDecoder->decode(src);
+    mImages[src] = image;
+    return image;
+}
+
+// override images that were already decoded for previous are taken from there
+std::shared_ptr<const Scene::Instance> ScenePatcher::decodeInstance(const Scene::Instance& instance, const Scene::Instance* previous)
+{
+    auto decoded = std::make_shared<Scene::Instance>(instance);
+    for (auto& override : decoded->overrides) {
+        if (!override.hasImage || override.image.src.empty() || override.image.image)
+            continue;
+        const auto* old = previous ? previous->find(override.item) : nullptr;
+        if (old && old->hasImage && old->image.src == override.image.src && !isStale(override.image.src)) {
+            override.image.image = old->image.image;
+        } else {
+            override.image.image = decode(override.image.src);
+        }
+    }
+    return decoded;
+}
+
+void ScenePatcher::decodeItem(Scene::Item& item)
+{
+    if (!mDecoder)
+        return;
+    for (auto image : { &item.image, &item.backgroundImage }) {
+        if (!image->src.empty() && !image->image) {
+            image->image = decode(image->src);
+        }
+    }
+    if (item.instance) {
+        item.instance = decodeInstance(*item.instance, nullptr);
+    }
+    for (const auto& child : item.children) {
+        decodeItem(*child);
+    }
+}
+
+bool ScenePatcher::isStale(const Scene::Instance& instance) const
+{
+    for (const auto& override : instance.overrides) {
+        if (override.hasImage && isStale(override.image.src))
+            return true;
+    }
+    return false;
+}
+
+bool ScenePatcher::usesStale(const Scene::Item& item) const
+{
+    if (isStale(item.image.src) || isStale(item.backgroundImage.src))
+        return true;
+    for (const auto& child : item.children) {
+        if (usesStale(*child))
+            return true;
+    }
+    return false;
+}
+
+void ScenePatcher::collectImages(const Scene::Item& item)
+{
+    auto collect = [this](const Scene::ImageData& image) {
+        if (image.image && !isStale(image.src)) {
+            mImages.emplace(image.src, image.image);
+        }
+    };
+    collect(item.image);
+    collect(item.backgroundImage);
+    if (item.instance) {
+        for (const auto& override : item.instance->overrides) {
+            collect(override.image);
+        }
+    }
+    for (const auto& child : item.children) {
+        collectImages(*child);
+    }
+}
+
+Scene::Change& ScenePatcher::change(const std::shared_ptr<Scene::Item>& item)
+{
+    // one change per item, flags accumulate over the operations in the patch
+    const auto it = mChangeIndex.find(item.get());
+    if (it != mChangeIndex.end())
+        return mChanges[it->second];
+    mChangeIndex[item.get()] = mChanges.size();
+    mChanges.push_back({ item, 0, {} });
+    return mChanges.back();
+}
+
+bool ScenePatcher::resolve(const std::string& path, Location& location) const
+{
+    std::vector<std::string> tokens;
+    if (!splitPointer(path, tokens))
+        return false;
+
+    std::shared_ptr<Scene::Item> item = mScene.root;
+    Scene::Item* parent = nullptr;
+    size_t i = 0;
+    while (i < tokens.size() && tokens[i] == "children") {
+        if (i + 1 == tokens.size()) {
+            location = { Location::Children, item, parent, 0, std::string() };
+            return true;
+        }
+        size_t index;
+        if (tokens[i + 1] == "-") {
+            index = item->children.size();
+        } else if (!parseIndex(tokens[i + 1], index)) {
+            return false;
+        }
+        if (i + 2 == tokens.size()) {
+            location = { Location::Child, item, parent, index, std::string() };
+            return true;
+        }
+        if (index >= item->children.size())
+            return false;
+        parent = item.get();
+        item = item->children[index];
+        i += 2;
+    }
+
+    if (i == tokens.size()) {
+        location = { Location::Root, item, parent, 0, std::string() };
+        return true;
+    }
+
+    // the rest is a pointer into the item's own properties
+    std::string property;
+    for (; i < tokens.size(); ++i) {
+        property.push_back('/');
+        for (char c : tokens[i]) {
+            if (c == '~') {
+                property += "~0";
+            } else if (c == '/') {
+                property += "~1";
+            } else {
+                property.push_back(c);
+            }
+        }
+    }
+    location = { Location::Property, item, parent, 0, std::move(property) };
+    return true;
+}
+
+bool ScenePatcher::get(const Location& location, json& value) const
+{
+    switch (location.type) {
+    case Location::Root:
+        value = itemToJSON(*location.item, true);
+        return true;
+    case Location::Child:
+        if (location.index >= location.item->children.size())
+            return false;
+        value = itemToJSON(*location.item->children[location.index], true);
+        return true;
+    case Location::Children:
+        value = json::array();
+        for (const auto& child : location.item->children) {
+            value.push_back(itemToJSON(*child, true));
+        }
+        return true;
+    case Location::Property: {
+        const json item = itemToJSON(*location.item, false);
+        const json::json_pointer pointer(location.property);
+        if (!item.contains(pointer))
+            return false;
+        value = item.at(pointer);
+        return true; }
+    }
+    return false;
+}
+
+bool ScenePatcher::add(const Location& location, const json& value)
+{
+    switch (location.type) {
+    case Location::Root:
+    case Location::Children:
+        // adding an existing member replaces it
+        return replace(location, value);
+    case Location::Child: {
+        auto& children = location.item->children;
+        if (location.index > children.size())
+            return false;
+        auto item = std::make_shared<Scene::Item>();
+        if (!buildItem(value, *item, location.item.get(), mScene.templates))
+            return false;
+        decodeItem(*item);
+        children.insert(children.begin() + location.index, std::move(item));
+        change(location.item).flags |= Scene::Change::Children;
+        return true; }
+    case Location::Property:
+        return patchProperty("add", location, &value);
+    }
+    return false;
+}
+
+bool ScenePatcher::replace(const Location& location, const json& value)
+{
+    switch (location.type) {
+    case Location::Root: {
+        Scene::Item fresh;
+        if (!buildItem(value, fresh, nullptr, mScene.templates))
+            return false;
+        reconcile(location.item, fresh, true);
+        return true; }
+    case Location::Child: {
+        if (location.index >= location.item->children.size())
+            return false;
+        Scene::Item fresh;
+        if (!buildItem(value, fresh, location.item.get(), mScene.templates))
+            return false;
+        reconcile(location.item->children[location.index], fresh, true);
+        return true; }
+    case Location::Children: {
+        if (!value.is_array())
+            return false;
+        std::vector<std::shared_ptr<Scene::Item> > fresh;
+        fresh.reserve(value.size());
+        for (const auto& child : value) {
+            fresh.push_back(std::make_shared<Scene::Item>());
+            if (!buildItem(child, *fresh.back(), location.item.get(), mScene.templates))
+                return false;
+        }
+        reconcileChildren(location.item, fresh);
+        return true; }
+    case Location::Property:
+        return patchProperty("replace", location, &value);
+    }
+    return false;
+}
+
+bool ScenePatcher::remove(const Location& location)
+{
+    switch (location.type) {
+    case Location::Root:
+        return false;
+    case Location::Child: {
+        auto& children = location.item->children;
+        if (location.index >= children.size())
+            return false;
+        auto& itemChange = change(location.item);
+        itemChange.flags |= Scene::Change::Children;
+        itemChange.removed.push_back(children[location.index]);
+        children.erase(children.begin() + location.index);
+        return true; }
+    case Location::Children: {
+        std::vector<std::shared_ptr<Scene::Item> > none;
+        reconcileChildren(location.item, none);
+        return true; }
+    case Location::Property:
+        return patchProperty("remove", location, nullptr);
+    }
+    return false;
+}
+
+bool ScenePatcher::patchProperty(const char* op, const Location& location, const json* value)
+{
+    // patch the json form of the item and bring the differences back
+    json operation = { { "op", op }, { "path", location.property } };
+    if (value) {
+        operation["value"] = *value;
+    }
+    const json patched = itemToJSON(*location.item, false).patch(json::array({ operation }));
+
+    Scene::Item fresh;
+    if (!buildItem(patched, fresh, location.parent, mScene.templates))
+        return false;
+    reconcile(location.item, fresh, false);
+    return true;
+}
+
+bool ScenePatcher::reconcileImage(Scene::ImageData& image, Scene::ImageData& fresh)
+{
+    const bool stale = isStale(image.src);
+    if (image.src == fresh.src && sameRect(image.sourceRect, fresh.sourceRect) && !stale)
+        return false;
+    if (image.src != fresh.src || stale) {
+        image.src = std::move(fresh.src);
+        image.image = decode(image.src);
+    }
+    image.sourceRect = fresh.sourceRect;
+    return true;
+}
+
+void ScenePatcher::reconcile(const std::shared_ptr<Scene::Item>& item, Scene::Item& fresh, bool withChildren)
+{
+    uint32_t flags = 0;
+    if (!sameRect(item->geometry, fresh.geometry)) {
+        item->geometry = fresh.geometry;
+        flags |= Scene::Change::Geometry;
+    }
+    if (!sameColor(item->color, fresh.color)) {
+        item->color = fresh.color;
+        flags |= Scene::Change::Color;
+    }
+
+    auto& text = item->text;
+    if (text.contents != fresh.text.contents || text.size != fresh.text.size
+        || text.bold != fresh.text.bold || text.italic != fresh.text.italic) {
+        text.contents = std::move(fresh.text.contents);
+        text.size = fresh.text.size;
+        text.bold = fresh.text.bold;
+        text.italic = fresh.text.italic;
+        flags |= Scene::Change::Text;
+    }
+    if (!sameColor(text.color, fresh.text.color)) {
+        text.color = fresh.text.color;
+        flags |= Scene::Change::TextColor;
+    }
+
+    if (reconcileImage(item->image, fresh.image))
+        flags |= Scene::Change::Image;
+    if (reconcileImage(item->backgroundImage, fresh.backgroundImage))
+        flags |= Scene::Change::Image;
+
+    if (item->childrenSrc != fresh.childrenSrc) {
+        // whatever came from the old src goes, SceneLoader picks up the new one
+        item->childrenSrc = std::move(fresh.childrenSrc);
+        auto& itemChange = change(item);
+        itemChange.removed.insert(itemChange.removed.end(), item->children.begin(), item->children.end());
+        item->children.clear();
+        flags |= Scene::Change::Children;
+    }
+
+    item->name = std::move(fresh.name);
+    if (item->instance != fresh.instance) {
+        if (!item->instance || !fresh.instance || item->instance->tmpl != fresh.instance->tmpl
+            || !sameOverrides(*item->instance, *fresh.instance) || isStale(*item->instance)) {
+            item->instance = fresh.instance ? decodeInstance(*fresh.instance, item->instance.get()) : nullptr;
+            flags |= Scene::Change::Instance;
+        }
+    }
+
+    if (flags)
+        change(item).flags |= flags;
+
+    // children from childrenSrc belong to SceneLoader
+    if (withChildren && item->childrenSrc.empty()) {
+        reconcileChildren(item, fresh.children);
+    } else if (withChildren && mStale) {
+        for (const auto& child : item->children) {
+            refreshStale(child);
+        }
+    }
+}
+
+void ScenePatcher::refreshStale(const std::shared_ptr<Scene::Item>& item)
+{
+    // for what's not part of the new version of the scene
+    uint32_t flags = 0;
+    for (auto image : { &item->image, &item->backgroundImage }) {
+        if (isStale(image->src)) {
+            image->image = decode(image->src);
+            flags |= Scene::Change::Image;
+        }
+    }
+    if (item->instance && isStale(*item->instance)) {
+        auto instance = std::make_shared<Scene::Instance>(*item->instance);
+        for (auto& override : instance->overrides) {
+            if (override.hasImage && isStale(override.image.src)) {
+                override.image.image = decode(override.image.src);
+            }
+        }
+        item->instance = std::move(instance);
+        flags |= Scene::Change::Instance;
+    }
+    if (flags)
+        change(item).flags |= flags;
+    for (const auto& child : item->children) {
+        refreshStale(child);
+    }
+}
+
+void ScenePatcher::reconcileChildren(const std::shared_ptr<Scene::Item>& item, std::vector<std::shared_ptr<Scene::Item> >& fresh)
+{
+    // children are matched by position, the ones that exist on both sides are updated in place
+    auto& children = item->children;
+    const size_t common = std::min(children.size(), fresh.size());
+    for (size_t i = 0; i < common; ++i) {
+        reconcile(children[i], *fresh[i], true);
+    }
+    if (fresh.size() > common) {
+        for (size_t i = common; i < fresh.size(); ++i) {
+            decodeItem(*fresh[i]);
+            children.push_back(std::move(fresh[i]));
+        }
+        change(item).flags |= Scene::Change::Children;
+    } else if (children.size() > common) {
+        auto& itemChange = change(item);
+        itemChange.flags |= Scene::Change::Children;
+        itemChange.removed.insert(itemChange.removed.end(), children.begin() + common, children.end());
+        children.erase(children.begin() + common, children.end());
+    }
+}
+
+bool ScenePatcher::applyOperation(const json& operation)
+{
+    if (!operation.is_object())
+        return false;
+    const auto op = operation.find("op");
+    const auto path = operation.find("path");
+    if (op == operation.end() || !op->is_string() || path == operation.end() || !path->is_string())
+        return false;
+
+    const std::string& name = op->get_ref<const std::string&>();
+    Location location;
+    if (!resolve(path->get_ref<const std::string&>(), location)) {
+        printf("invalid patch path '%s'\n", path->get_ref<const std::string&>().c_str());
+        return false;
+    }
+
+    if (name == "remove")
+        return remove(location);
+
+    if (name == "move" || name == "copy") {
+        const auto from = operation.find("from");
+        Location fromLocation;
+        if (from == operation.end() || !from->is_string() || !resolve(from->get_ref<const std::string&>(), fromLocation))
+            return false;
+        if (name == "copy") {
+            json value;
+            return get(fromLocation, value) && add(location, value);
+        }
+
+        const std::string& fromPath = from->get_ref<const std::string&>();
+        const std::string& toPath = path->get_ref<const std::string&>();
+        if (toPath == fromPath)
+            return true;
+        if (toPath.compare(0, fromPath.size() + 1, fromPath + "/") == 0)
+            return false;
+
+        if (fromLocation.type == Location::Child && location.type == Location::Child) {
+            // moving an item keeps it, and its decoded images, as is
+            auto& fromChildren = fromLocation.item->children;
+            if (fromLocation.index >= fromChildren.size())
+                return false;
+            auto item = fromChildren[fromLocation.index];
+            if (!remove(fromLocation) || !resolve(toPath, location) || location.index > location.item->children.size())
+                return false;
+            // not removed as far as the changes go, what it has stays, animations included
+            auto& removed = change(fromLocation.item).removed;
+            removed.erase(std::find(removed.begin(), removed.end(), item));
+            location.item->children.insert(location.item->children.begin() + location.index, std::move(item));
+            change(location.item).flags |= Scene::Change::Children;
+            return true;
+        }
+
+        // the target path is evaluated after the value has been removed
+        json value;
+        return get(fromLocation, value) && remove(fromLocation) && resolve(toPath, location) && add(location, value);
+    }
+
+    const auto value = operation.find("value");
+    if (value == operation.end())
+        return false;
+    if (name == "add")
+        return add(location, *value);
+    if (name == "replace")
+        return replace(location, *value);
+    if (name == "test") {
+        json current;
+        return get(location, current) && current == *value;
+    }
+
+    printf("unknown patch operation '%s'\n", name.c_str());
+    return false;
+}
+
+bool ScenePatcher::applyMergePatch(const json& patch)
+{
+    // arrays are replaced as a whole by merge patches so the current
+    // children only matter if the patch doesn't touch them
+    const bool withChildren = patch.contains("children");
+    json item = itemToJSON(*mScene.root, false);
+    item.merge_patch(patch);
+
+    Scene::Item fresh;
+    if (!buildItem(item, fresh, nullptr, mScene.templates))
+        return false;
+    reconcile(mScene.root, fresh, withChildren);
+    return true;
+}
+
+bool ScenePatcher::apply(const json& patch)
+{
+    if (patch.is_object())
+        return applyMergePatch(patch);
+    if (!patch.is_array())
+        return false;
+    for (const auto& operation : patch) {
+        if (!applyOperation(operation)) {
+            printf("failed to apply patch operation %s\n", operation.dump().c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+static void remapInstances(Scene::Item& item, const std::unordered_map<const Scene::Template*, std::shared_ptr<Scene::Template> >& templates)
+{
+    if (item.instance) {
+        const auto it = templates.find(item.instance->tmpl.get());
+        if (it != templates.end()) {
+            auto instance = std::make_shared<Scene::Instance>(*item.instance);
+            instance->tmpl = it->second;
+            item.instance = std::move(instance);
+        }
+    }
+    for (const auto& child : item.children) {
+        remapInstances(*child, templates);
+    }
+}
+
+bool ScenePatcher::reload(Scene& fresh, const std::unordered_set<std::string>& stale)
+{
+    if (!fresh.root)
+        return false;
+    mStale = &stale;
+
+    // whatever is decoded already doesn't need to be decoded again, even if it moved
+    collectImages(*mScene.root);
+    for (const auto& tmpl : mScene.templates) {
+        collectImages(*tmpl.second->root);
+    }
+
+    // templates that didn't change keep their identity, and with it the drawables made for them
+    std::unordered_map<const Scene::Template*, std::shared_ptr<Scene::Template> > same;
+    Scene::Templates templates;
+    for (auto& tmpl : fresh.templates) {
+        const auto old = mScene.templates.find(tmpl.first);
+        if (old != mScene.templates.end() && !usesStale(*old->second->root)
+            && itemToJSON(*old->second->root, true) == itemToJSON(*tmpl.second->root, true)) {
+            same[tmpl.second.get()] = old->second;
+            templates[tmpl.first] = old->second;
+        } else {
+            decodeItem(*tmpl.second->root);
+            templates[tmpl.first] = tmpl.second;
+        }
+    }
+    remapInstances(*fresh.root, same);
+    // instances in subtrees from childrenSrc keep the templates they were made with
+    mScene.templates = std::move(templates);
+
+    reconcile(mScene.root, *fresh.root, true);
+    mStale = nullptr;
+    return true;
+}
+
+bool Scene::reload(Scene&& fresh, std::vector<Change>& changes, const std::unordered_set<std::string>& staleImages, bool decodeImages)
+{
+    if (!root)
+        return false;
+    Decoder decoder(Decoder::Format_Auto);
+    ScenePatcher patcher(*this, changes, decodeImages ? &decoder : nullptr);
+    return patcher.reload(fresh, staleImages);
+}
+
+bool Scene::applyPatch(const uint8_t* data, size_t size, std::vector<Change>& changes, bool decodeImages)
+{
+    if (!root)
+        return false;
+
+    const json patch = json::parse(data, data + size, nullptr, false);
+    if (patch.is_discarded()) {
+        printf("json patch parse error\n");
+        return false;
+    }
+
+    Decoder decoder(Decoder::Format_Auto);
+    ScenePatcher patcher(*this, changes, decodeImages ? &decoder : nullptr);
+    try {
+        return patcher.apply(patch);
+    } catch (const json::exception& e) {
+        printf("failed to apply patch, %s\n", e.what());
+    }
+    return false;
+}
+
+bool Scene::applyPatch(const std::string& patch, std::vector<Change>& changes, bool decodeImages)
+{
+    return applyPatch(reinterpret_cast<const uint8_t*>(patch.data()), patch.size(), changes, decodeImages);
+}
@@ -0,0 +1,157 @@
+#include "SceneWatcher.h"
+#include <chrono>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+SceneWatcher::SceneWatcher(const std::string& path)
+    : mPath(path)
+{
+    if (mPath.find("://") != std::string::npos) {
+        printf("only local scenes can be watched\n");
+        return;
+    }
+#ifdef __linux__
+    mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (mFd == -1) {
+        printf("unable to initialize inotify\n");
+        return;
+    }
+    watchFile(mPath, mScenes);
+#else
+    printf("watching scenes isn't supported on this platform\n");
+#endif
+}
+
+SceneWatcher::~SceneWatcher()
+{
+#ifdef __linux__
+    if (mFd != -1) {
+        close(mFd);
+    }
+#endif
+}
+
+void SceneWatcher::watchFile(const std::string& path, std::unordered_set<std::string>& kind)
+{
+#ifdef __linux__
+    if (path.empty() || path.find("://") != std::string::npos || !kind.insert(path).second)
+        return;
+
+    const auto slash = path.rfind('/');
+    const std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+    const std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    int wd;
+    const auto it = mDirectories.find(directory);
+    if (it != mDirectories.end()) {
+        wd = it->second;
+    } else {
+        // editors often write a new file and rename it over the old one
+        wd = inotify_add_watch(mFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+        if (wd == -1) {
+            printf("unable to watch '%s'\n", directory.c_str());
+            return;
+        }
+        mDirectories[directory] = wd;
+    }
+    mFiles[wd][name].push_back(path);
+#else
+    (void)path;
+    (void)kind;
+#endif
+}
+
+void SceneWatcher::watchItem(const Scene::Item& item)
+{
+    watchFile(item.image.src, mImages);
+    watchFile(item.backgroundImage.src, mImages);
+    watchFile(item.childrenSrc, mScenes);
+    if (item.instance) {
+        for (const auto& override : item.instance->overrides) {
+            if (override.hasImage) {
+                watchFile(override.image.src, mImages);
+            }
+        }
+    }
+    for (const auto& child : item.children) {
+        watchItem(*child);
+    }
+}
+
+void SceneWatcher::watch(const Scene& scene)
+{
+    if (mFd == -1)
+        return;
+    if (scene.root) {
+        watchItem(*scene.root);
+    }
+    for (const auto& tmpl : scene.templates) {
+        watchItem(*tmpl.second->root);
+    }
+}
+
+bool SceneWatcher::poll(Scene& scene, std::vector<Scene::Change>& changes, std::vector<std::string>& changedFiles)
+{
+#ifdef __linux__
+    if (mFd == -1)
+        return false;
+
+    std::unordered_set<std::string> changed;
+    alignas(struct inotify_event) char buffer[4096];
+    for (;;) {
+        const ssize_t size = read(mFd, buffer, sizeof(buffer));
+        if (size <= 0)
+            break;
+        for (const char* ptr = buffer; ptr < buffer + size;) {
+            const auto* event = reinterpret_cast<const struct inotify_event*>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+            if (!event->len)
+                continue;
+            const auto directory = mFiles.find(event->wd);
+            if (directory == mFiles.end())
+                continue;
+            const auto file = directory->second.find(event->name);
+            if (file == directory->second.end())
+                continue;
+            changed.insert(file->second.begin(), file->second.end());
+        }
+    }
+    if (changed.empty())
+        return false;
+    changedFiles.insert(changedFiles.end(), changed.begin(), changed.end());
+
+    // changed images are decoded again wherever they're used, the scene
+    // file is parsed again even if it didn't change since that's cheap
+    // without decoding and finds the items that use them
+    std::unordered_set<std::string> stale;
+    for (const auto& path : changed) {
+        if (mImages.count(path)) {
+            stale.insert(path);
+        }
+    }
+    if (stale.empty() && !changed.count(mPath))
+        return true;
+
+    const auto start = std::chrono::steady_clock::now();
+    Scene fresh = Scene::sceneFromFile(mPath, false);
+    if (!fresh.root) {
+        // most likely saved halfway, the next save reloads it
+        printf("unable to reload '%s', keeping the current scene\n", mPath.c_str());
+        return true;
+    }
+    const size_t before = changes.size();
+    scene.reload(std::move(fresh), changes, stale);
+    watch(scene);
+    const auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+    printf("reloaded '%s' in %.1fms, %zu items changed\n", mPath.c_str(), elapsed.count(), changes.size() - before);
+    return true;
+#else
+    (void)scene;
+    (void)changes;
+    (void)changedFiles;
+    return false;
+#endif
+}
@@ -0,0 +1,50 @@
+#ifndef SCENEWATCHER_H
+#define SCENEWATCHER_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "Scene.h"
+
+// Watches a local scene file and the local files it refers to (images and
+// childrenSrc scenes) with inotify. When any of them change poll() loads the
+// scene file again without decoding images and hands it to Scene::reload, so
+// only the images of changed files are decoded again and only the items
+// that differ end up in the changes for Render::applyChanges.
+//
+// Directories are watched rather than the files themselves so that editors
+// that save by replacing the file are picked up. Linux only, isValid() is
+// false elsewhere.
+class SceneWatcher
+{
+public:
+    SceneWatcher(const std::string& path);
+    ~SceneWatcher();
+
+    SceneWatcher(const SceneWatcher&) = delete;
+    SceneWatcher& operator=(const SceneWatcher&) = delete;
+
+    bool isValid() const { return mFd != -1; }
+
+    // picks up the files scene refers to, call again when subtrees are loaded
+    void watch(const Scene& scene);
+
+    // doesn't block. changedFiles gets every watched file that changed,
+    // childrenSrc scenes among them are for SceneLoader::reload
+    bool poll(Scene& scene, std::vector<Scene::Change>& changes, std::vector<std::string>& changedFiles);
+
+private:
+    void watchFile(const std::string& path, std::unordered_set<std::string>& kind);
+    void watchItem(const Scene::Item& item);
+
+private:
+    std::string mPath;
+    int mFd { -1 };
+    std::unordered_map<std::string, int> mDirectories;
+    // watch descriptor -> file name in that directory -> paths as written in the scene
+    std::unordered_map<int, std::unordered_map<std::string, std::vector<std::string> > > mFiles;
+    std::unordered_set<std::string> mImages, mScenes;
+};
+
+#endif // SCENEWATCHER_H
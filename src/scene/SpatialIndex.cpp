@@ -0,0 +1,337 @@
+#include "SpatialIndex.h"
+#include <algorithm>
+#include <cmath>
+
+SpatialIndex::SpatialIndex(float cellSize)
+    : mCellSize(cellSize)
+{
+}
+
+// instances cover whatever their template draws as well
+static Rect itemBounds(const Scene::Item& item)
+{
+    if (!item.instance || !item.instance->tmpl->bounds.isValid())
+        return item.geometry;
+    const auto& geometry = item.geometry;
+    const auto& bounds = item.instance->tmpl->bounds;
+    if (!geometry.isValid())
+        return { geometry.x + bounds.x, geometry.y + bounds.y, bounds.width, bounds.height };
+    const float x0 = std::min(geometry.x, geometry.x + bounds.x);
+    const float y0 = std::min(geometry.y, geometry.y + bounds.y);
+    const float x1 = std::max(geometry.x + geometry.width, geometry.x + bounds.x + bounds.width);
+    const float y1 = std::max(geometry.y + geometry.height, geometry.y + bounds.y + bounds.height);
+    return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+static void addDamage(Rect* damage, const Rect& rect)
+{
+    if (!damage || !rect.isValid())
+        return;
+    if (damage->isValid()) {
+        damage->unite(rect);
+    } else {
+        *damage = rect;
+    }
+}
+
+int32_t SpatialIndex::cell(float coord) const
+{
+    return static_cast<int32_t>(std::floor(coord / mCellSize));
+}
+
+void SpatialIndex::clear()
+{
+    mRoot = nullptr;
+    mEntries.clear();
+    mFreeEntries.clear();
+    mItems.clear();
+    mCells.clear();
+    mLarge.clear();
+}
+
+void SpatialIndex::build(const Scene& scene)
+{
+    clear();
+    mRoot = scene.root.get();
+    if (mRoot) {
+        renumber();
+    }
+}
+
+void SpatialIndex::link(uint32_t index)
+{
+    auto& entry = mEntries[index];
+    entry.x0 = entry.y0 = 0;
+    entry.x1 = entry.y1 = -1;
+    entry.large = false;
+    if (!entry.rect.isValid())
+        return;
+
+    const auto& rect = entry.rect;
+    entry.x0 = cell(rect.x);
+    entry.y0 = cell(rect.y);
+    entry.x1 = cell(rect.x + rect.width);
+    entry.y1 = cell(rect.y + rect.height);
+    const int64_t cells = (static_cast<int64_t>(entry.x1) - entry.x0 + 1) * (static_cast<int64_t>(entry.y1) - entry.y0 + 1);
+    if (cells > MaxCells) {
+        entry.large = true;
+        mLarge.push_back(index);
+        return;
+    }
+    for (int32_t y = entry.y0; y <= entry.y1; ++y) {
+        for (int32_t x = entry.x0; x <= entry.x1; ++x) {
+            mCells[cellKey(x, y)].push_back(index);
+        }
+    }
+}
+
+void SpatialIndex::unlink(uint32_t index)
+{
+    auto unlinkFrom = [index](std::vector<uint32_t>& entries) {
+        const auto it = std::find(entries.begin(), entries.end(), index);
+        if (it != entries.end()) {
+            *it = entries.back();
+            entries.pop_back();
+        }
+    };
+
+    auto& entry = mEntries[index];
+    if (entry.large) {
+        unlinkFrom(mLarge);
+    } else {
+        for (int32_t y = entry.y0; y <= entry.y1; ++y) {
+            for (int32_t x = entry.x0; x <= entry.x1; ++x) {
+                const auto it = mCells.find(cellKey(x, y));
+                if (it == mCells.end())
+                    continue;
+                unlinkFrom(it->second);
+                if (it->second.empty()) {
+                    mCells.erase(it);
+                }
+            }
+        }
+    }
+    entry.x0 = entry.y0 = 0;
+    entry.x1 = entry.y1 = -1;
+    entry.large = false;
+}
+
+void SpatialIndex::update(uint32_t index, Rect* damage)
+{
+    auto& entry = mEntries[index];
+    const Rect rect = itemBounds(*entry.item);
+    if (rect.x == entry.rect.x && rect.y == entry.rect.y && rect.width == entry.rect.width && rect.height == entry.rect.height)
+        return;
+    addDamage(damage, entry.rect);
+    unlink(index);
+    entry.rect = rect;
+    link(index);
+}
+
+void SpatialIndex::insertTree(const Scene::Item& item, Rect* damage)
+{
+    if (mItems.find(&item) == mItems.end()) {
+        uint32_t index;
+        if (!mFreeEntries.empty()) {
+            index = mFreeEntries.back();
+            mFreeEntries.pop_back();
+        } else {
+            index = mEntries.size();
+            mEntries.push_back(Entry());
+        }
+        mEntries[index] = { &item, itemBounds(item), 0, 0, 0, -1, -1, false, 0 };
+        mItems[&item] = index;
+        link(index);
+        addDamage(damage, mEntries[index].rect);
+    }
+    for (const auto& child : item.children) {
+        insertTree(*child, damage);
+    }
+}
+
+void SpatialIndex::removeTree(const Scene::Item& item, Rect* damage)
+{
+    const auto it = mItems.find(&item);
+    if (it != mItems.end()) {
+        addDamage(damage, mEntries[it->second].rect);
+        unlink(it->second);
+        mEntries[it->second].item = nullptr;
+        mFreeEntries.push_back(it->second);
+        mItems.erase(it);
+    }
+    for (const auto& child : item.children) {
+        removeTree(*child, damage);
+    }
+}
+
+void SpatialIndex::renumber(Rect* damage)
+{
+    // pre-order, same as the order things are painted in. new items are
+    // picked up on the way
+    uint32_t order = 0;
+    std::vector<const Scene::Item*> stack;
+    stack.push_back(mRoot);
+    while (!stack.empty()) {
+        const Scene::Item* item = stack.back();
+        stack.pop_back();
+
+        auto it = mItems.find(item);
+        if (it == mItems.end()) {
+            insertTree(*item, damage);
+            it = mItems.find(item);
+        }
+        mEntries[it->second].order = order++;
+
+        for (auto child = item->children.rbegin(); child != item->children.rend(); ++child) {
+            stack.push_back(child->get());
+        }
+    }
+}
+
+void SpatialIndex::applyChanges(const std::vector<Scene::Change>& changes, Rect* damage)
+{
+    if (!mRoot)
+        return;
+
+    bool structure = false;
+    for (const auto& change : changes) {
+        for (const auto& removed : change.removed) {
+            removeTree(*removed, damage);
+        }
+        if (change.flags & Scene::Change::Children)
+            structure = true;
+    }
+
+    for (const auto& change : changes) {
+        if (!(change.flags & ~Scene::Change::Children))
+            continue;
+        const auto it = mItems.find(change.item.get());
+        if (it == mItems.end())
+            continue;
+        if (change.flags & (Scene::Change::Geometry | Scene::Change::Instance)) {
+            update(it->second, damage);
+        }
+        // where it is now, for changes that don't move it as well
+        addDamage(damage, mEntries[it->second].rect);
+    }
+
+    // added items need to go in and everything after them moves in painter's order
+    if (structure) {
+        renumber(damage);
+    }
+}
+
+template<typename Func>
+void SpatialIndex::visit(const Rect& rect, Func&& func) const
+{
+    // entries spanning several cells are only visited once per query
+    if (++mStamp == 0) {
+        for (const auto& entry : mEntries) {
+            entry.stamp = 0;
+        }
+        mStamp = 1;
+    }
+    auto visitEntry = [this, &func](uint32_t index) {
+        const auto& entry = mEntries[index];
+        if (entry.stamp == mStamp)
+            return;
+        entry.stamp = mStamp;
+        func(entry);
+    };
+
+    const int32_t x0 = cell(rect.x), y0 = cell(rect.y);
+    const int32_t x1 = cell(rect.x + rect.width), y1 = cell(rect.y + rect.height);
+    if ((static_cast<int64_t>(x1) - x0 + 1) * (static_cast<int64_t>(y1) - y0 + 1) > static_cast<int64_t>(mCells.size())) {
+        // the query covers more cells than there are populated ones
+        for (const auto& populated : mCells) {
+            const int32_t x = static_cast<int32_t>(populated.first >> 32);
+            const int32_t y = static_cast<int32_t>(populated.first & 0xffffffff);
+            if (x < x0 || x > x1 || y < y0 || y > y1)
+                continue;
+            for (uint32_t index : populated.second) {
+                visitEntry(index);
+            }
+        }
+    } else {
+        for (int32_t y = y0; y <= y1; ++y) {
+            for (int32_t x = x0; x <= x1; ++x) {
+                const auto it = mCells.find(cellKey(x, y));
+                if (it == mCells.end())
+                    continue;
+                for (uint32_t index : it->second) {
+                    visitEntry(index);
+                }
+            }
+        }
+    }
+    for (uint32_t index : mLarge) {
+        visitEntry(index);
+    }
+}
+
+static inline bool intersects(const Rect& a, const Rect& b)
+{
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+static inline bool contains(const Rect& r, float x, float y)
+{
+    return x >= r.x && x < r.x + r.width && y >= r.y && y < r.y + r.height;
+}
+
+bool SpatialIndex::overlaps(const Scene::Item* item, const Rect& rect) const
+{
+    const auto it = mItems.find(item);
+    return it != mItems.end() && rect.isValid() && intersects(mEntries[it->second].rect, rect);
+}
+
+void SpatialIndex::query(const Rect& rect, std::vector<const Scene::Item*>& items) const
+{
+    items.clear();
+    if (!rect.isValid())
+        return;
+
+    std::vector<std::pair<uint32_t, const Scene::Item*> > found;
+    visit(rect, [&rect, &found](const Entry& entry) {
+        if (intersects(entry.rect, rect)) {
+            found.push_back(std::make_pair(entry.order, entry.item));
+        }
+    });
+    std::sort(found.begin(), found.end());
+
+    items.reserve(found.size());
+    for (const auto& f : found) {
+        items.push_back(f.second);
+    }
+}
+
+void SpatialIndex::hitTest(float x, float y, std::vector<const Scene::Item*>& items) const
+{
+    items.clear();
+
+    std::vector<std::pair<uint32_t, const Scene::Item*> > found;
+    visit(Rect { x, y, 0.f, 0.f }, [x, y, &found](const Entry& entry) {
+        if (contains(entry.rect, x, y)) {
+            found.push_back(std::make_pair(entry.order, entry.item));
+        }
+    });
+    std::sort(found.begin(), found.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+    items.reserve(found.size());
+    for (const auto& f : found) {
+        items.push_back(f.second);
+    }
+}
+
+const Scene::Item* SpatialIndex::itemAt(float x, float y) const
+{
+    const Scene::Item* top = nullptr;
+    uint32_t topOrder = 0;
+    visit(Rect { x, y, 0.f, 0.f }, [x, y, &top, &topOrder](const Entry& entry) {
+        if (contains(entry.rect, x, y) && (!top || entry.order > topOrder)) {
+            top = entry.item;
+            topOrder = entry.order;
+        }
+    });
+    return top;
+}
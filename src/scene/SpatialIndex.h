@@ -0,0 +1,82 @@
+#ifndef SPATIALINDEX_H
+#define SPATIALINDEX_H
+
+#include <cstdint>
+#include <vector>
+#include <unordered_map>
+#include "Scene.h"
+#include "Rect.h"
+
+// Uniform grid over the geometry of scene items. Every item with valid
+// geometry is stored in the cells it overlaps, items that would span more
+// than MaxCells cells are kept in a separate list that every query looks at.
+// Queries only visit the cells they overlap so their cost depends on how many
+// items are there, not on the size of the scene. Results are in painter's
+// order, the pre-order position of the item in the scene. Instances are
+// indexed as a whole, the items of their template aren't in the index.
+//
+// The index refers to the items of the scene it was built from, keep it up
+// to date with applyChanges when the scene is patched. Queries use a mutable
+// visit stamp and aren't thread safe.
+class SpatialIndex
+{
+public:
+    SpatialIndex(float cellSize = 128.f);
+
+    void build(const Scene& scene);
+    // damage, when given, is united with where whatever changed was and is now
+    void applyChanges(const std::vector<Scene::Change>& changes, Rect* damage = nullptr);
+    void clear();
+
+    bool empty() const { return mItems.empty(); }
+    size_t size() const { return mItems.size(); }
+
+    // items that intersect rect, in painter's order
+    void query(const Rect& rect, std::vector<const Scene::Item*>& items) const;
+    // items that contain the point, topmost first
+    void hitTest(float x, float y, std::vector<const Scene::Item*>& items) const;
+    const Scene::Item* itemAt(float x, float y) const;
+    // whether query(rect) finds item
+    bool overlaps(const Scene::Item* item, const Rect& rect) const;
+
+    enum { MaxCells = 64 };
+
+private:
+    struct Entry
+    {
+        const Scene::Item* item;
+        Rect rect;
+        uint32_t order;
+        int32_t x0, y0, x1, y1; // cell span, inclusive, x0 > x1 when not in any cell
+        bool large;
+        mutable uint32_t stamp;
+    };
+
+    void insertTree(const Scene::Item& item, Rect* damage);
+    void removeTree(const Scene::Item& item, Rect* damage);
+    void update(uint32_t entry, Rect* damage);
+    void link(uint32_t entry);
+    void unlink(uint32_t entry);
+    void renumber(Rect* damage = nullptr);
+
+    template<typename Func>
+    void visit(const Rect& rect, Func&& func) const;
+
+    static uint64_t cellKey(int32_t x, int32_t y)
+    {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+    }
+    int32_t cell(float coord) const;
+
+private:
+    float mCellSize;
+    const Scene::Item* mRoot { nullptr };
+    std::vector<Entry> mEntries;
+    std::vector<uint32_t> mFreeEntries;
+    std::unordered_map<const Scene::Item*, uint32_t> mItems;
+    std::unordered_map<uint64_t, std::vector<uint32_t> > mCells;
+    std::vector<uint32_t> mLarge;
+    mutable uint32_t mStamp { 0 };
+};
+
+#endif // SPATIALINDEX_H
@@ -1,12 +1,16 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(location = 0) out vec3 fragColor;
+// per instance, one rect of a batch of consecutive color drawables
+layout(location = 0) in vec4 inColor;
+layout(location = 1) in vec4 inGeometry;
 
-layout(binding = 0) uniform UniformBufferObject {
-    vec4 color;
-    vec4 geometry;
-} ubo;
+layout(location = 0) out vec4 fragColor;
+
+// position of the template instance being drawn, in clip space. zero otherwise
+layout(push_constant) uniform PushConstants {
+    vec2 offset;
+} pc;
 
 vec2 positions[4] = vec2[](
     vec2(-1.0, +1.0),
@@ -19,6 +23,6 @@ void main() {
     vec2 position = positions[gl_VertexIndex];
     int x = position.x == -1.0 ? 0 : 2;
     int y = position.y == +1.0 ? 1 : 3;
-    gl_Position = vec4(ubo.geometry[x], ubo.geometry[y], 0.0, 1.0);
-    fragColor = ubo.color.rgb;
+    gl_Position = vec4(inGeometry[x] + pc.offset.x, inGeometry[y] + pc.offset.y, 0.0, 1.0);
+    fragColor = inColor;
 }
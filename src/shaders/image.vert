@@ -7,6 +7,11 @@ layout(binding = 0) uniform UniformBufferObject {
     vec4 geometry;
 } ubo;
 
+// position of the template instance being drawn, in clip space. zero otherwise
+layout(push_constant) uniform PushConstants {
+    vec2 offset;
+} pc;
+
 vec4 positions[4] = vec4[](
     vec4(-1.0, +1.0,     0.0,  0.0),
     vec4(+1.0, +1.0,     1.0,  0.0),
@@ -19,7 +24,7 @@ void main() {
 
     int x = position.x == -1.0 ? 0 : 2;
     int y = position.y == +1.0 ? 1 : 3;
-    gl_Position = vec4(ubo.geometry[x], ubo.geometry[y], 0.0, 1.0);
+    gl_Position = vec4(ubo.geometry[x] + pc.offset.x, ubo.geometry[y] + pc.offset.y, 0.0, 1.0);
 
     fragTexCoord = vec2(position.z, position.w);
 }
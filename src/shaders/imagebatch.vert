@@ -0,0 +1,32 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// per instance, one image of a batch of consecutive image drawables
+layout(location = 0) in vec4 inGeometry;
+layout(location = 1) in uint inTexture;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out uint fragTexture;
+
+// position of the template instance being drawn, in clip space. zero otherwise
+layout(push_constant) uniform PushConstants {
+    vec2 offset;
+} pc;
+
+vec4 positions[4] = vec4[](
+    vec4(-1.0, +1.0,     0.0,  0.0),
+    vec4(+1.0, +1.0,     1.0,  0.0),
+    vec4(-1.0, -1.0,     0.0,  1.0),
+    vec4(+1.0, -1.0,     1.0,  1.0)
+);
+
+void main() {
+    vec4 position = positions[gl_VertexIndex];
+
+    int x = position.x == -1.0 ? 0 : 2;
+    int y = position.y == +1.0 ? 1 : 3;
+    gl_Position = vec4(inGeometry[x] + pc.offset.x, inGeometry[y] + pc.offset.y, 0.0, 1.0);
+
+    fragTexCoord = vec2(position.z, position.w);
+    fragTexture = inTexture;
+}
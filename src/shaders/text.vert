@@ -9,11 +9,16 @@ layout(binding = 0) uniform UniformBufferObject {
     mat4 projection;
 } ubo;
 
+// position of the template instance being drawn, in clip space. zero otherwise
+layout(push_constant) uniform PushConstants {
+    vec2 offset;
+} pc;
+
 layout(location = 0) in vec2 inDst;
 layout(location = 1) in vec2 inSrc;
 
 void main() {
-    gl_Position = ubo.projection * vec4(inDst.x, inDst.y, 0.0, 1.0);
+    gl_Position = ubo.projection * vec4(inDst.x, inDst.y, 0.0, 1.0) + vec4(pc.offset, 0.0, 0.0);
     fragTexCoord = inSrc;
     fragColor = ubo.color;
 }
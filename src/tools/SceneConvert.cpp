@@ -0,0 +1,33 @@
+#include <scene/Scene.h>
+#include <stdio.h>
+#include <string>
+
+// converts a json scene to the binary scene format, see scene/SceneBinary.h
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        printf("usage: %s <scene.json> <scene.vks>\n", argv[0]);
+        return 1;
+    }
+
+    // images are referenced by src in the binary scene, no need to decode them here
+    const Scene scene = Scene::sceneFromJSON(argv[1], false);
+    if (!scene.root) {
+        printf("unable to load scene '%s'\n", argv[1]);
+        return 1;
+    }
+
+    if (!scene.writeBinary(argv[2])) {
+        printf("unable to write binary scene '%s'\n", argv[2]);
+        return 1;
+    }
+
+    // verify that the result loads
+    const Scene binary = Scene::sceneFromBinary(std::string(argv[2]), false);
+    if (!binary.root) {
+        printf("unable to verify binary scene '%s'\n", argv[2]);
+        return 1;
+    }
+
+    return 0;
+}
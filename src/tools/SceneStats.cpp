@@ -0,0 +1,361 @@
+#include <scene/Scene.h>
+#include <render/RenderLimits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <algorithm>
+#include <unordered_set>
+
+// Estimates what a scene costs the current Render without a gpu: item
+// counts, glyphs, image memory and the vulkan objects its drawables need.
+// Exits with 2 when the scene goes over one of the limits, for content
+// pipelines that should reject such scenes.
+
+struct Stats
+{
+    size_t items { 0 }, colors { 0 }, images { 0 }, texts { 0 }, instances { 0 }, childrenSrc { 0 }, empty { 0 };
+    size_t templates { 0 }, templateItems { 0 };
+
+    size_t glyphs { 0 };
+    std::unordered_set<uint64_t> distinctGlyphs;
+
+    std::unordered_set<const Image*> decoded;
+    size_t decodedBytes { 0 };
+    std::unordered_set<std::string> failedImages, unsupportedImages;
+
+    // text drawables own their uniform slots and descriptor sets, as do
+    // image drawables that aren't in the texture table. template items
+    // have theirs once for all instances
+    size_t colorDrawables { 0 }, imageDrawables { 0 }, textDrawables { 0 };
+    size_t imageVram { 0 };
+    // textures too large to share a memory block
+    size_t dedicatedTextures { 0 };
+    size_t uniformBytes { 0 };
+    // RenderText keeps one vertex buffer per distinct layout
+    std::unordered_set<std::string> textLayouts;
+    size_t textVertexBytes { 0 };
+
+    size_t drawCalls { 0 };
+    // consecutive color drawables are one instanced draw, as are consecutive
+    // image drawables with descriptor indexing
+    bool descriptorIndexing { true };
+    uint32_t run { 0 };
+    size_t colorInstances { 0 }, imageInstances { 0 };
+
+    std::unordered_set<const Scene::Template*> seenTemplates;
+
+    size_t drawables() const { return colorDrawables + imageDrawables + textDrawables; }
+};
+
+enum { HasColor = 0x1, HasImage = 0x2, HasText = 0x4 };
+
+// what Render::makeDrawables makes for item
+static uint32_t drawablesOf(const Scene::Item& item)
+{
+    if (!item.geometry.isValid())
+        return 0;
+    uint32_t kinds = 0;
+    if (item.color.isValid())
+        kinds |= HasColor;
+    if (item.image.image)
+        kinds |= HasImage;
+    if (!item.text.contents.empty() && item.text.size > 0)
+        kinds |= HasText;
+    return kinds;
+}
+
+// drawables in the order Render records them
+static void countDrawCalls(uint32_t kinds, Stats& stats)
+{
+    for (uint32_t kind : { HasColor, HasImage, HasText }) {
+        if (!(kinds & kind))
+            continue;
+        const bool batched = kind == HasColor || (kind == HasImage && stats.descriptorIndexing);
+        if (kind == HasColor)
+            ++stats.colorInstances;
+        else if (batched)
+            ++stats.imageInstances;
+        if (!batched || stats.run != kind)
+            ++stats.drawCalls;
+        stats.run = batched ? kind : 0;
+    }
+}
+
+static void countImage(const Scene::ImageData& image, Stats& stats)
+{
+    if (image.src.empty())
+        return;
+    if (!image.image) {
+        stats.failedImages.insert(image.src);
+        return;
+    }
+    if (stats.decoded.insert(image.image.get()).second) {
+        stats.decodedBytes += image.image->data.size();
+    }
+}
+
+// code points that aren't whitespace, close enough to what the layout ends
+// up with for latin text
+static size_t visibleGlyphs(const Text& text, std::unordered_set<uint64_t>* distinct)
+{
+    const auto& contents = text.contents;
+    size_t count = 0;
+    for (size_t i = 0; i < contents.size();) {
+        const uint8_t lead = contents[i];
+        uint32_t cp = lead, extra = 0;
+        if (lead >= 0xf0) {
+            cp = lead & 0x07;
+            extra = 3;
+        } else if (lead >= 0xe0) {
+            cp = lead & 0x0f;
+            extra = 2;
+        } else if (lead >= 0xc0) {
+            cp = lead & 0x1f;
+            extra = 1;
+        }
+        ++i;
+        for (; extra > 0 && i < contents.size(); --extra, ++i) {
+            cp = (cp << 6) | (contents[i] & 0x3f);
+        }
+        if (cp == ' ' || cp == '\t' || cp == '\n' || cp == '\r')
+            continue;
+        ++count;
+        if (distinct) {
+            distinct->insert(cp | (static_cast<uint64_t>(text.bold) << 32) | (static_cast<uint64_t>(text.italic) << 33));
+        }
+    }
+    return count;
+}
+
+static void countGlyphs(const Text& text, Stats& stats)
+{
+    stats.glyphs += visibleGlyphs(text, &stats.distinctGlyphs);
+}
+
+// the gpu resources of the drawables Render makes for item
+static void countDrawables(const Scene::Item& item, Stats& stats)
+{
+    const uint32_t kinds = drawablesOf(item);
+    if (kinds & HasColor) {
+        ++stats.colorDrawables;
+    }
+    if (kinds & HasImage) {
+        ++stats.imageDrawables;
+        const auto& image = *item.image.image;
+        // every image drawable uploads a texture of its own
+        if (image.depth == 8 || image.depth == 32) {
+            const size_t bytes = static_cast<size_t>(image.width) * image.height * (image.depth / 8);
+            stats.imageVram += bytes;
+            if (bytes > RenderLimits::MemoryBlockSize / 2)
+                ++stats.dedicatedTextures;
+        } else {
+            stats.unsupportedImages.insert(item.image.src);
+        }
+    }
+    if (kinds & HasText) {
+        ++stats.textDrawables;
+        stats.uniformBytes += RenderLimits::TextUniformSize;
+        const auto& text = item.text;
+        const std::string key = std::to_string(text.size) + (text.bold ? "b" : "-") + (text.italic ? "i" : "-")
+            + std::to_string(item.geometry.width) + ":" + text.contents;
+        if (stats.textLayouts.insert(key).second) {
+            stats.textVertexBytes += visibleGlyphs(text, nullptr) * RenderLimits::VerticesPerGlyph * RenderLimits::TextVertexSize;
+        }
+    }
+}
+
+static void countTemplate(const Scene::Template& tmpl, Stats& stats)
+{
+    if (!stats.seenTemplates.insert(&tmpl).second)
+        return;
+    ++stats.templates;
+    stats.templateItems += tmpl.items.size();
+    for (const auto* item : tmpl.items) {
+        countImage(item->image, stats);
+        countImage(item->backgroundImage, stats);
+        countDrawables(*item, stats);
+    }
+}
+
+static void countInstance(const Scene::Instance& instance, Stats& stats)
+{
+    const auto& tmpl = *instance.tmpl;
+    countTemplate(tmpl, stats);
+
+    // every instance draws all of the template's items, overridden ones
+    // have drawables of their own
+    for (uint32_t i = 0; i < tmpl.items.size(); ++i) {
+        const auto& original = *tmpl.items[i];
+        const auto* override = instance.find(i);
+        if (!override) {
+            countDrawCalls(drawablesOf(original), stats);
+            if (!original.text.contents.empty())
+                countGlyphs(original.text, stats);
+            continue;
+        }
+        Scene::Item overridden;
+        overridden.color = original.color;
+        overridden.geometry = original.geometry;
+        overridden.text = original.text;
+        overridden.image = original.image;
+        if (override->hasText)
+            overridden.text.contents = override->text;
+        if (override->hasImage) {
+            overridden.image = override->image;
+            countImage(overridden.image, stats);
+        }
+        countDrawables(overridden, stats);
+        countDrawCalls(drawablesOf(overridden), stats);
+        if (!overridden.text.contents.empty())
+            countGlyphs(overridden.text, stats);
+    }
+}
+
+static void countItem(const Scene::Item& item, Stats& stats)
+{
+    ++stats.items;
+    const uint32_t kinds = drawablesOf(item);
+    if (kinds & HasColor)
+        ++stats.colors;
+    if (kinds & HasImage)
+        ++stats.images;
+    if (kinds & HasText)
+        ++stats.texts;
+    if (item.instance)
+        ++stats.instances;
+    if (!item.childrenSrc.empty())
+        ++stats.childrenSrc;
+    if (!kinds && !item.instance && item.childrenSrc.empty())
+        ++stats.empty;
+
+    countImage(item.image, stats);
+    countImage(item.backgroundImage, stats);
+    if (!item.text.contents.empty())
+        countGlyphs(item.text, stats);
+    countDrawables(item, stats);
+    countDrawCalls(kinds, stats);
+
+    if (item.instance)
+        countInstance(*item.instance, stats);
+
+    for (const auto& child : item.children) {
+        countItem(*child, stats);
+    }
+}
+
+static std::string formatBytes(size_t bytes)
+{
+    char buf[32];
+    if (bytes >= 1024 * 1024) {
+        snprintf(buf, sizeof(buf), "%.1f MB", bytes / (1024. * 1024.));
+    } else if (bytes >= 1024) {
+        snprintf(buf, sizeof(buf), "%.1f KB", bytes / 1024.);
+    } else {
+        snprintf(buf, sizeof(buf), "%zu B", bytes);
+    }
+    return buf;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path = nullptr;
+    // Window asks for minImageCount + 1, which is 3 nearly everywhere
+    uint32_t swapChainImages = 3;
+    bool descriptorIndexing = true;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--swapchain-images") && i + 1 < argc) {
+            swapChainImages = static_cast<uint32_t>(std::max(1, atoi(argv[++i])));
+        } else if (!strcmp(argv[i], "--no-descriptor-indexing")) {
+            descriptorIndexing = false;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (!path) {
+        printf("usage: %s [--swapchain-images <count>] [--no-descriptor-indexing] <scene.json>\n", argv[0]);
+        return 1;
+    }
+
+    const Scene scene = Scene::sceneFromJSON(path);
+    if (!scene.root) {
+        printf("unable to load scene '%s'\n", path);
+        return 1;
+    }
+
+    Stats stats;
+    stats.descriptorIndexing = descriptorIndexing;
+    countItem(*scene.root, stats);
+
+    const size_t drawables = stats.drawables();
+    // images and text share one sampler, see render/SamplerCache.h
+    const size_t samplers = stats.imageDrawables + stats.textDrawables > 0 ? 1 : 0;
+    // text drawables and images that don't fit the texture table have a slot in a uniform page and
+    // a descriptor set each. the table holds at most MaxTextures, devices may allow fewer
+    const size_t tableImages = descriptorIndexing ? std::min<size_t>(stats.imageDrawables, RenderLimits::MaxTextures) : 0;
+    const size_t uniformDrawables = stats.imageDrawables - tableImages + stats.textDrawables;
+    stats.uniformBytes += (stats.imageDrawables - tableImages) * RenderLimits::ImageUniformSize;
+    const size_t uniformPages = (uniformDrawables + RenderLimits::UniformSlotsPerPage - 1) / RenderLimits::UniformSlotsPerPage;
+    const size_t uniformPageSize = static_cast<size_t>(RenderLimits::UniformSlotsPerPage) * RenderLimits::MaxUniformAlignment * swapChainImages;
+    const size_t descriptorSets = uniformDrawables;
+    // the instance buffers grow in powers of two
+    const size_t instanceBytes = stats.colorInstances * RenderLimits::ColorInstanceSize + stats.imageInstances * RenderLimits::ImageInstanceSize;
+    size_t instanceCapacity = instanceBytes ? 8192 : 0;
+    while (instanceCapacity < instanceBytes) {
+        instanceCapacity *= 2;
+    }
+    const size_t instanceBufferBytes = instanceCapacity * swapChainImages;
+    // MemoryAllocator blocks, host visible ones for uniforms, instances, text vertices and the
+    // glyph staging buffer and device local ones for textures and the glyph atlas
+    const size_t atlasBytes = static_cast<size_t>(RenderLimits::GlyphAtlasWidth) * RenderLimits::GlyphAtlasHeight;
+    auto blocks = [](size_t bytes) { return (bytes + RenderLimits::MemoryBlockSize - 1) / RenderLimits::MemoryBlockSize; };
+    const size_t allocations = blocks(uniformPages * uniformPageSize + instanceBufferBytes + stats.textVertexBytes + atlasBytes)
+        + blocks(stats.imageVram + atlasBytes) + stats.dedicatedTextures;
+    const size_t glyphCells = RenderLimits::GlyphAtlasWidth / RenderLimits::GlyphRenderSize * (RenderLimits::GlyphAtlasHeight / RenderLimits::GlyphRenderSize);
+
+    printf("scene '%s'\n", path);
+    printf("items          %zu (color %zu, image %zu, text %zu, instances %zu, childrenSrc %zu, empty %zu)\n",
+           stats.items, stats.colors, stats.images, stats.texts, stats.instances, stats.childrenSrc, stats.empty);
+    if (stats.templates > 0) {
+        printf("templates      %zu used, %zu items\n", stats.templates, stats.templateItems);
+    }
+    printf("glyphs         %zu, %zu distinct (about %zu fit the glyph atlas)\n", stats.glyphs, stats.distinctGlyphs.size(), glyphCells);
+    printf("images         %zu distinct decoded, %s in memory, %s of textures\n",
+           stats.decoded.size(), formatBytes(stats.decodedBytes).c_str(), formatBytes(stats.imageVram).c_str());
+    printf("drawables      %zu (color %zu, image %zu, text %zu)\n",
+           drawables, stats.colorDrawables, stats.imageDrawables, stats.textDrawables);
+    printf("descriptors    %zu sets of %u\n", descriptorSets, RenderLimits::MaxDescriptorSets);
+    printf("uniforms       %s of uniform data in %zu pages of up to %s for %u swapchain images\n",
+           formatBytes(stats.uniformBytes * swapChainImages).c_str(), uniformPages, formatBytes(uniformPageSize).c_str(), swapChainImages);
+    printf("instances      %zu color and %zu image with everything visible, %s of instance buffers\n",
+           stats.colorInstances, stats.imageInstances, formatBytes(instanceBufferBytes).c_str());
+    if (descriptorIndexing) {
+        printf("textures       %zu in the texture table of %u\n", tableImages, RenderLimits::MaxTextures);
+    }
+    printf("text vertices  %zu buffers, %s\n", stats.textLayouts.size(), formatBytes(stats.textVertexBytes).c_str());
+    printf("allocations    about %zu device memory blocks, %zu samplers\n", allocations, samplers);
+    printf("draw calls     %zu per frame with everything visible\n", stats.drawCalls);
+    if (stats.childrenSrc > 0) {
+        printf("               childrenSrc subtrees aren't loaded and not included\n");
+    }
+
+    bool exceeded = false;
+    auto warn = [&exceeded](const char* what, size_t value, size_t limit) {
+        if (value > limit) {
+            printf("warning: %zu %s, more than the limit of %zu\n", value, what, limit);
+            exceeded = true;
+        }
+    };
+    warn("descriptor sets", descriptorSets, RenderLimits::MaxDescriptorSets);
+    warn("device memory allocations", allocations, RenderLimits::MaxMemoryAllocations);
+    warn("samplers", samplers, RenderLimits::MaxSamplers);
+    warn("distinct glyphs", stats.distinctGlyphs.size(), glyphCells);
+    for (const auto& src : stats.failedImages) {
+        printf("warning: image '%s' didn't decode and won't be drawn\n", src.c_str());
+    }
+    for (const auto& src : stats.unsupportedImages) {
+        printf("warning: image '%s' has a depth Render can't upload\n", src.c_str());
+    }
+
+    return exceeded ? 2 : 0;
+}